@@ -52,14 +52,15 @@ namespace logSys
         std::cout << "平均每秒输出: " << (size_t)(msg_num / max_time) << "条日志" << std::endl;
         std::cout << "平均每秒输出: " << (size_t)(msg_len * msg_num / max_time / 1024 / 1024) << "MB" << std::endl;
     }
-    void bench_sync(size_t thread_num, size_t msg_len, size_t msg_num)
+    // 同步日志器没有全局锁, 文件落地方式决定多线程写入是否互相等待
+    void bench_sync(size_t thread_num, size_t msg_len, size_t msg_num, FileWriteMode mode = FileWriteMode::APPEND)
     {
         LoggerBuilder::ptr builder = std::make_shared<GlobalLoggerBuilder>();
         builder->buildFormatter("%m%n");
         builder->buildLimitLevel(LogLevel::Level::DEBUG);
         builder->buildLoggerName("sync_logger");
         builder->buildLoggerType(logSys::LoggerType::LOGGER_SYNC);
-        builder->buildSink<FileSink>("./logdir/sync_logger.log");
+        builder->buildSink<FileSink>("./logdir/sync_logger.log", mode);
         Logger::ptr lp = builder->build();
         bench(lp->getName(), thread_num, msg_len, msg_num);
     }
@@ -75,10 +76,66 @@ namespace logSys
         Logger::ptr lp = builder->build();
         bench(lp->getName(), thread_num, msg_len, msg_num);
     }
+    // 滚动文件性能测试: 额外输出每次滚动在写入线程上的耗时分布
+    void bench_roll(size_t thread_num, size_t msg_len, size_t msg_num, size_t roll_size)
+    {
+        RollBySizeSink::ptr sink = std::make_shared<RollBySizeSink>("./logdir/roll_bench/roll-", roll_size,
+                                                                    RetentionPolicy(4), true);
+        LoggerBuilder::ptr builder = std::make_shared<GlobalLoggerBuilder>();
+        builder->buildFormatter("%m%n");
+        builder->buildLimitLevel(LogLevel::Level::DEBUG);
+        builder->buildLoggerName("roll_logger");
+        builder->buildLoggerType(logSys::LoggerType::LOGGER_SYNC);
+        builder->buildSink(sink);
+        Logger::ptr lp = builder->build();
+        bench(lp->getName(), thread_num, msg_len, msg_num);
+        sink->rollLatency().print(std::cout, "滚动耗时");
+    }
+    // 消息内容生成的耗时: vasprintf 对比 {} 格式化, 只测格式化本身, 不落地
+    static int bench_vasprintf(char **out, const char *fmt, ...)
+    {
+        va_list al;
+        va_start(al, fmt);
+        int len = vasprintf(out, fmt, al);
+        va_end(al);
+        return len;
+    }
+    void bench_format(size_t msg_num)
+    {
+        using namespace std::chrono;
+        size_t total = 0;
+        auto start = high_resolution_clock::now();
+        for (size_t i = 0; i < msg_num; i++)
+        {
+            char *buf = nullptr;
+            int len = bench_vasprintf(&buf, "req=%lu user=%d cost=%g status=%s bytes=%lu",
+                                      (unsigned long)i, (int)(i % 100000), i * 0.25, "ok", (unsigned long)(i * 7));
+            total += len;
+            free(buf);
+        }
+        duration<double> t1 = duration_cast<duration<double>>(high_resolution_clock::now() - start);
+
+        std::string out;
+        start = high_resolution_clock::now();
+        for (size_t i = 0; i < msg_num; i++)
+        {
+            out.clear();
+            util::Format::append(out, "req={} user={} cost={} status={} bytes={}",
+                                 i, (int)(i % 100000), i * 0.25, "ok", i * 7);
+            total += out.size();
+        }
+        duration<double> t2 = duration_cast<duration<double>>(high_resolution_clock::now() - start);
+        std::cout << "vasprintf: " << t1.count() * 1e9 / msg_num << "ns/条"
+                  << " {}格式化: " << t2.count() * 1e9 / msg_num << "ns/条"
+                  << " (" << total << ")" << std::endl;
+    }
 }
 
 int main()
 {
+    logSys::bench_format(2e6);
     logSys::bench_async(4, 100, 2e7);
+    logSys::bench_sync(4, 100, 2e6, logSys::FileWriteMode::PWRITE);
+    logSys::bench_roll(4, 100, 2e6, 4 * 1024 * 1024);
     return 0;
 }
\ No newline at end of file
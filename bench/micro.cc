@@ -0,0 +1,332 @@
+#include "logSys.h"
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <iomanip>
+#include <new>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+/*
+    组件微基准: 分别测量各个环节, 定位是哪一段变慢
+        1. 每个格式化子项 / 常见模式的完整格式化
+        2. Buffer、RingBuffer、ChunkBuffer的写入和增容
+        3. AsyncLooper::push 在1~64个生产者线程下的开销
+        4. 日志器调用(生成消息 + 格式化 + 空落地), 即一条记录在调用线程上的全部序列化开销
+        5. 各落地方向写tmpfs(/dev/shm), 空落地用于扣除落地之外的开销
+    每项输出 ns/op 和 allocs/op; 分配次数统计全局operator new, 不包括直接调用malloc的部分(如vasprintf)
+    用法: microbench [名字前缀], 只运行名字以该前缀开头的项目
+*/
+namespace
+{
+    std::atomic<uint64_t> g_allocs(0);
+    volatile size_t g_sink = 0; // 防止被测代码的结果被优化掉
+}
+void *operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size == 0 ? 1 : size);
+    if(p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+
+namespace logSys
+{
+    class MicroBench
+    {
+    public:
+        MicroBench(const std::string &filter) :_filter(filter) {}
+        bool selected(const std::string &name) const { return name.compare(0, _filter.size(), _filter) == 0; }
+        // 单线程执行ops次f(i), 先预热十分之一
+        template<typename F>
+        void run(const std::string &name, size_t ops, F f)
+        {
+            if(!selected(name)) return;
+            for(size_t i = 0; i < ops / 10; i++) f(i);
+            uint64_t allocs = g_allocs.load();
+            uint64_t start = monoNanos();
+            for(size_t i = 0; i < ops; i++) f(i);
+            report(name, monoNanos() - start, ops, g_allocs.load() - allocs);
+        }
+        // threads个线程各执行ops / threads次f(i), 按墙钟时间折算每次的耗时
+        template<typename F>
+        void runThreads(const std::string &name, size_t threads, size_t ops, F f)
+        {
+            if(!selected(name)) return;
+            size_t per_thread = ops / threads;
+            std::atomic<size_t> ready(0);
+            std::atomic<bool> go(false);
+            std::vector<std::thread> workers;
+            for(size_t t = 0; t < threads; t++)
+            {
+                workers.emplace_back([&](){
+                    ready++;
+                    while(!go.load()) std::this_thread::yield();
+                    for(size_t i = 0; i < per_thread; i++) f(i);
+                });
+            }
+            while(ready.load() != threads) std::this_thread::yield();
+            uint64_t allocs = g_allocs.load();
+            uint64_t start = monoNanos();
+            go = true;
+            for(auto &w : workers) w.join();
+            report(name, monoNanos() - start, per_thread * threads, g_allocs.load() - allocs);
+        }
+    private:
+        static void report(const std::string &name, uint64_t ns, size_t ops, uint64_t allocs)
+        {
+            std::cout << std::left << std::setw(44) << name << std::right << std::fixed
+                      << std::setw(12) << std::setprecision(1) << (double)ns / ops << " ns/op"
+                      << std::setw(10) << std::setprecision(3) << (double)allocs / ops << " allocs/op" << std::endl;
+        }
+    private:
+        std::string _filter;
+    };
+
+    const char *g_payload = "user 10086 login from 192.168.1.100, cost 1.25ms, status ok";
+
+    // 每个格式化子项单独输出到复用的字符串
+    void benchFormatItems(MicroBench &mb)
+    {
+        LogField fields[] = { { "uid", 10086 }, { "ip", "192.168.1.100" }, { "cost", 1.25 }, { "ok", true } };
+        LogMsg msg(LogLevel::Level::INFO, 42, "micro.cc", "micro", g_payload);
+        msg._fields = fields;
+        msg._field_count = 4;
+        std::string out;
+        StringStreamBuf buf;
+        buf.bind(&out);
+        std::ostream os(&buf);
+        std::vector<std::pair<std::string, FormatItem::ptr>> items = {
+            { "item/%d{%H:%M:%S}", std::make_shared<TimeFormatItem>("%H:%M:%S") },
+            { "item/%d{%Y-%m-%d %H:%M:%S}", std::make_shared<TimeFormatItem>("%Y-%m-%d %H:%M:%S") },
+            { "item/%T", std::make_shared<TabFormatItem>() },
+            { "item/%t", std::make_shared<ThreadFormatItem>() },
+            { "item/%N", std::make_shared<ThreadNameFormatItem>() },
+            { "item/%p", std::make_shared<LevelFormatItem>() },
+            { "item/%c", std::make_shared<NameFormatItem>() },
+            { "item/%f", std::make_shared<FileFormatItem>() },
+            { "item/%l", std::make_shared<LineFormatItem>() },
+            { "item/%m", std::make_shared<MsgFormatItem>(false) },
+            { "item/%m{escape}", std::make_shared<MsgFormatItem>(true) },
+            { "item/%k", std::make_shared<FieldsFormatItem>() },
+            { "item/%n", std::make_shared<NLineFormatItem>() },
+            { "item/literal", std::make_shared<OtherFormatItem>("] [") },
+        };
+        for(auto &item : items)
+        {
+            FormatItem *fi = item.second.get();
+            mb.run(item.first, 1000000, [&](size_t){
+                out.clear();
+                fi->format(os, msg);
+                g_sink = g_sink + out.size();
+            });
+        }
+    }
+
+    // 常见模式的完整格式化
+    void benchFormatters(MicroBench &mb)
+    {
+        LogField fields[] = { { "uid", 10086 }, { "ip", "192.168.1.100" }, { "cost", 1.25 }, { "ok", true } };
+        LogMsg msg(LogLevel::Level::INFO, 42, "micro.cc", "micro", g_payload);
+        msg._fields = fields;
+        msg._field_count = 4;
+        std::vector<std::pair<std::string, Formatter::ptr>> formatters = {
+            { "format/%m%n", std::make_shared<Formatter>("%m%n") },
+            { "format/default", std::make_shared<Formatter>() },
+            { "format/full-date+name", std::make_shared<Formatter>("[%d{%Y-%m-%d %H:%M:%S}][%N][%p][%c][%f:%l] %m%n") },
+            { "format/default+fields", std::make_shared<Formatter>("%d{%H:%M:%S}%T[%p]%T%f:%l%T%m %k%n") },
+            { "format/json", std::make_shared<JsonFormatter>() },
+            { "format/logfmt", std::make_shared<LogfmtFormatter>() },
+        };
+        std::string out;
+        for(auto &f : formatters)
+        {
+            Formatter *fmt = f.second.get();
+            mb.run(f.first, 1000000, [&](size_t){
+                out.clear();
+                fmt->format(out, msg);
+                g_sink = g_sink + out.size();
+            });
+        }
+    }
+
+    void benchBuffers(MicroBench &mb)
+    {
+        std::string line(100, 'a');
+        {
+            // 稳态: 写满后重置, 不增容
+            Buffer buf;
+            mb.run("buffer/writeAndPush-100B", 5000000, [&](size_t){
+                if(buf.tailIdleSize() < line.size()) buf.reset();
+                buf.writeAndPush(line.data(), line.size());
+            });
+        }
+        // 增容: 从4KB开始写到16MB, 包含ensureWriteAble的全部扩容和拷贝
+        mb.run("buffer/grow-4KB-to-16MB", 20, [&](size_t){
+            Buffer buf(4096);
+            while(buf.readAbleSize() < 16 * 1024 * 1024) buf.writeAndPush(line.data(), line.size());
+            g_sink = g_sink + buf.readAbleSize();
+        });
+        // 读位置前移后写入, ensureWriteAble把数据搬回头部
+        {
+            Buffer buf(64 * 1024);
+            mb.run("buffer/ensureWriteAble-compact", 5000000, [&](size_t){
+                if(buf.readAbleSize() >= 32 * 1024) buf.moveReadBack(buf.readAbleSize() - 100);
+                buf.writeAndPush(line.data(), line.size());
+            });
+        }
+        {
+            RingBuffer ring(ASYNC_RING_SIZE);
+            mb.run("ring/writeAndPush+moveReadBack-100B", 5000000, [&](size_t){
+                if(ring.writeAbleSize() < line.size()) ring.moveReadBack(ring.readAbleSize());
+                ring.writeAndPush(line.data(), line.size());
+            });
+        }
+        {
+            ChunkPool pool;
+            ChunkBuffer chunks(pool);
+            mb.run("chunk/writeAndPush-100B", 5000000, [&](size_t){
+                if(chunks.readAbleSize() >= BUFFER_DEFAULT_SIZE) chunks.reset();
+                chunks.writeAndPush(line.data(), line.size());
+            });
+        }
+    }
+
+    // 工作线程回调为空, 只测生产者侧: 加锁、拷贝、唤醒, 定长模式包括缓冲区满时的等待
+    void benchLooper(MicroBench &mb)
+    {
+        std::string line(100, 'a');
+        const size_t threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+        for(AsyncType type : { AsyncType::AsyncSafe, AsyncType::AsyncUnSafe, AsyncType::AsyncOrdered })
+        {
+            const char *kind = type == AsyncType::AsyncSafe ? "safe" : (type == AsyncType::AsyncUnSafe ? "unsafe" : "ordered");
+            for(size_t n : threads)
+            {
+                std::string name = std::string("looper/push-") + kind + "-" + std::to_string(n) + "t";
+                if(!mb.selected(name)) continue;
+                AsyncLooper looper([](const struct iovec *, int, const RecordMeta &){}, type);
+                RecordMeta meta;
+                meta.add(util::Date::now(), LogLevel::Level::INFO);
+                mb.runThreads(name, n, 2000000, [&](size_t){
+                    looper.push(line.data(), line.size(), AsyncLane::NORMAL, nullptr, &meta);
+                });
+            }
+        }
+    }
+
+    // 一次日志调用在调用线程上的全部开销: 生成消息、格式化, 落地为空
+    void benchLogger(MicroBench &mb)
+    {
+        std::vector<SinkBinding> sinks = { SinkBinding(std::make_shared<NullSink>()) };
+        Logger::ptr plain = std::make_shared<SyncLogger>("micro", LogLevel::Level::DEBUG, std::make_shared<Formatter>(), sinks);
+        Logger::ptr json = std::make_shared<SyncLogger>("micro", LogLevel::Level::DEBUG, std::make_shared<JsonFormatter>(), sinks);
+        Logger::ptr quiet = std::make_shared<SyncLogger>("micro", LogLevel::Level::INFO, std::make_shared<Formatter>(), sinks);
+        mb.run("logger/printf", 1000000, [&](size_t i){
+            plain->info("user %d login from %s, cost %.2fms", (int)i, "192.168.1.100", 1.25);
+        });
+        mb.run("logger/logFmt", 1000000, [&](size_t i){
+            LOGF_INFO(plain, "user {} login from {}, cost {}ms", i, "192.168.1.100", 1.25);
+        });
+        mb.run("logger/stream", 1000000, [&](size_t i){
+            LOG_INFO(plain) << "user " << i << " login from " << "192.168.1.100" << ", cost " << 1.25 << "ms";
+        });
+        mb.run("logger/fields-json", 1000000, [&](size_t i){
+            LOGKV(json, LogLevel::Level::INFO, "login", { "uid", i }, { "ip", "192.168.1.100" }, { "cost", 1.25 });
+        });
+        mb.run("logger/disabled", 10000000, [&](size_t i){
+            LOGF_DEBUG(quiet, "never {}", i);
+        });
+        // 请求id和租户: 每次调用手工拼进消息, 对比放在诊断上下文中由%X输出
+        Logger::ptr tagged = std::make_shared<SyncLogger>("micro", LogLevel::Level::DEBUG,
+            std::make_shared<Formatter>("%d{%H:%M:%S}%T%t%T[%p]%T[%c]%T[%X{req} %X{tenant}]%T%f:%l%T%m%n"), sinks);
+        std::string req = "9f1c2a7e-request", tenant = "acme";
+        mb.run("logger/tags-inline", 1000000, [&](size_t i){
+            plain->info("[%s %s] user %d login", req.c_str(), tenant.c_str(), (int)i);
+        });
+        MDC::Scope scope({ { "req", req }, { "tenant", tenant } });
+        mb.run("logger/tags-mdc", 1000000, [&](size_t i){
+            tagged->info("user %d login", (int)i);
+        });
+    }
+
+    // 落地方向写tmpfs, 每次写一条100字节的记录
+    void removeDir(const std::string &dir)
+    {
+        DIR *d = opendir(dir.c_str());
+        if(d == nullptr) return;
+        struct dirent *ent;
+        while((ent = readdir(d)) != nullptr)
+        {
+            std::string name = ent->d_name;
+            if(name != "." && name != "..") unlink((dir + "/" + name).c_str());
+        }
+        closedir(d);
+        rmdir(dir.c_str());
+    }
+    void benchSinks(MicroBench &mb)
+    {
+        std::string dir = util::File::exists("/dev/shm") ? "/dev/shm/logsys-micro" : "./logdir/micro";
+        removeDir(dir);
+        std::string line(99, 'a');
+        line += '\n';
+        RecordMeta meta;
+        meta.add(util::Date::now(), LogLevel::Level::INFO);
+        int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        {
+            std::vector<std::pair<std::string, LogSink::ptr>> sinks = {
+                { "sink/null", std::make_shared<NullSink>() },
+                { "sink/console-devnull", std::make_shared<ConsoleSink>(devnull, ColorMode::NEVER) },
+                { "sink/file-append", std::make_shared<FileSink>(dir + "/append.log") },
+                { "sink/file-pwrite", std::make_shared<FileSink>(dir + "/pwrite.log", FileWriteMode::PWRITE) },
+                { "sink/file-append-indexed", std::make_shared<FileSink>(dir + "/indexed.log", FileWriteMode::APPEND, true) },
+                { "sink/roll-size-16MB", std::make_shared<RollBySizeSink>(dir + "/roll-", 16 * 1024 * 1024, RetentionPolicy(2)) },
+                { "sink/roll-time-hour", std::make_shared<RollByTimeSink>(dir + "/hour-", TimeGap::HOUR_GAP, RetentionPolicy(2)) },
+            };
+            for(auto &s : sinks)
+            {
+                LogSink *sink = s.second.get();
+                mb.run(s.first, 500000, [&](size_t){
+                    sink->write(line.data(), line.size(), LogLevel::Level::INFO, &meta);
+                });
+            }
+            // 异步批次: 一次写64KB
+            std::string batch;
+            while(batch.size() < 64 * 1024) batch += line;
+            struct iovec iov = { (void *)batch.data(), batch.size() };
+            for(auto &s : sinks)
+            {
+                LogSink *sink = s.second.get();
+                mb.run(s.first + "-batch64KB", 5000, [&](size_t){
+                    sink->write(&iov, 1, &meta);
+                });
+            }
+        }
+        close(devnull);
+        removeDir(dir);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    logSys::MicroBench mb(argc > 1 ? argv[1] : "");
+    logSys::benchFormatItems(mb);
+    logSys::benchFormatters(mb);
+    logSys::benchBuffers(mb);
+    logSys::benchLooper(mb);
+    logSys::benchLogger(mb);
+    logSys::benchSinks(mb);
+    return 0;
+}
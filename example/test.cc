@@ -1,70 +1,6 @@
 #include "logSys.h"
 #include <iostream>
 #include <unistd.h>
-/*
-    日志落地方式扩展: 以时间段方式落地
-*/
-// 通过枚举时间段，避免让用户自己计算
-enum class Time_Gap
-{
-    SECOND_GAP,
-    MINUTE_GAP,
-    HOUR_GAP,
-    DAY_GAP
-};
-class RollByTimeSink : public logSys::LogSink
-{
-public:
-    RollByTimeSink(const std::string &basename, Time_Gap gap_type)
-    :_basename(basename)
-    {
-        switch(gap_type)
-        {
-            case Time_Gap::SECOND_GAP: _time_gap = 1; break;
-            case Time_Gap::MINUTE_GAP: _time_gap = 60; break;
-            case Time_Gap::HOUR_GAP: _time_gap = 60 * 60; break;
-            case Time_Gap::DAY_GAP: _time_gap = 60 * 60 * 24; break;
-        }
-        time_t tm = logSys::util::Date::now();
-        // 处理时间间隔为1的特殊情况
-        _cur_gap = _time_gap == 1 ? tm : tm % _time_gap;
-        std::string pathname = createNewFile();
-        logSys::util::File::createDirectory(logSys::util::File::path(pathname));
-        _ofs.open(pathname, std::ios::binary | std::ios::app);
-        assert(_ofs.good());
-    }
-    void log(const char *data, size_t len) override
-    {
-        time_t tm = logSys::util::Date::now();
-        size_t cur_gap = _time_gap == 1 ? tm : tm %  _time_gap;
-        if(cur_gap != _cur_gap)
-        {
-            _cur_gap = cur_gap;
-            _ofs.close(); // 先关闭之前文件
-            std::string pathname = createNewFile();
-            _ofs.open(pathname, std::ios::binary | std::ios::app);
-            assert(_ofs.is_open());
-        }
-        _ofs.write(data, len);
-    }
-private:
-    std::string createNewFile()
-    {
-        time_t t = logSys::util::Date::now();
-        struct std::tm tl;
-        localtime_r(&t, &tl);
-        char buffer[64] = { 0 };
-        strftime(buffer, 63, "%Y-%m-%d %H:%M:%S", &tl);
-        std::string pathname = _basename + buffer;
-        pathname += ".log";
-        return pathname;
-    }
-private:
-    std::string _basename;
-    std::ofstream _ofs;
-    size_t _time_gap;
-    size_t _cur_gap;
-};
 void test_logger()
 {
     auto logger = logSys::LoggerManager::getInstance().getLogger("root");
@@ -90,6 +26,19 @@ int main()
     lp->build(); // 创建了全局日志器
     test_logger();
 */ 
+/*
+    // 网络落地: 需要本机有接收端, 断线与补发的自动测试见 test/netsink.cc
+    logSys::LoggerBuilder::ptr nb = std::make_shared<logSys::LocalLoggerBuilder>();
+    nb->buildLoggerName("net_logger");
+    nb->buildLoggerType(logSys::LoggerType::LOGGER_ASYNC);
+    nb->buildSink<logSys::NetSink>("127.0.0.1", 9000, logSys::NetProto::TCP, "./logdir/net.spill");
+    logSys::Logger::ptr nl = nb->build();
+    for(int i = 0; i < 100000; i++)
+    {
+        nl->info(__FILE__, __LINE__, "mylog: %d", i);
+        usleep(100);
+    }
+*/
 /*
     // test for buffer
     // 1. read file
@@ -152,8 +101,8 @@ int main()
 /*
     logSys::LogMsg msg(logSys::LogLevel::Level::DEBUG, __LINE__, __FILE__, "mylog", "测试格式化功能...");
     std::shared_ptr<logSys::Formatter> f = std::make_shared<logSys::Formatter>("[%d{%H:%M:%S}]%T[%t]%T[%p]%T[%c]%T%f:%l%T%m%n");
-    std::vector<logSys::LogSink::ptr> sinks;
-    logSys::LogSink::ptr psink = logSys::SinkFactory::create<RollByTimeSink>("./logdir/mylog", Time_Gap::SECOND_GAP);
+    std::vector<logSys::SinkBinding> sinks;
+    logSys::LogSink::ptr psink = logSys::SinkFactory::create<logSys::RollByTimeSink>("./logdir/mylog", logSys::TimeGap::SECOND_GAP);
     sinks.push_back(psink);
     psink = logSys::SinkFactory::create<logSys::StdoutSink>();
     sinks.push_back(psink);
@@ -173,7 +122,7 @@ int main()
     logSys::Formatter f("[%d{%H:%M:%S}]%T[%t]%T[%p]%T[%c]%T%f:%l%T%m%n");
 
     auto ret = f.format(msg);
-    logSys::LogSink::ptr psink = logSys::SinkFactory::create<RollByTimeSink>("./logdir/mylog", Time_Gap::SECOND_GAP);
+    logSys::LogSink::ptr psink = logSys::SinkFactory::create<logSys::RollByTimeSink>("./logdir/mylog", logSys::TimeGap::SECOND_GAP);
     time_t old = logSys::util::Date::now();
     while(logSys::util::Date::now() < old + 5)
     {
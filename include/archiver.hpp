@@ -0,0 +1,339 @@
+#pragma once
+#include "util.hpp"
+#include "index.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <unordered_map>
+#include <cerrno>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+/*
+    滚动日志归档器
+        1. 后台线程预先创建下一个分段, 滚动时只需交换文件描述符
+        2. 后台线程处理已经关闭的日志分段: 关闭、重命名、压缩、清理
+        3. 按最大文件数/最大总字节数保留分段
+        日志写入线程只负责投递任务，不做任何额外的文件系统操作
+*/
+extern char **environ;
+namespace logSys
+{
+    // 滚动文件保留策略, 0表示不限制
+    struct RetentionPolicy
+    {
+        RetentionPolicy(size_t max_files = 0, size_t max_total_bytes = 0, bool compress = false)
+        :_max_files(max_files), _max_total_bytes(max_total_bytes), _compress(compress)
+        {}
+        size_t _max_files;       // 最多保留的已关闭分段数
+        size_t _max_total_bytes; // 已关闭分段总大小上限
+        bool _compress;          // 是否gzip压缩已关闭分段
+    };
+
+    class SegmentArchiver
+    {
+    public:
+        using ptr = std::shared_ptr<SegmentArchiver>;
+        // 预先创建好的分段
+        struct Prepared
+        {
+            int _fd;
+            std::string _pathname; // 临时文件名, 以.开头不会被当作分段扫描
+        };
+        // basename: 滚动文件前缀, 如 ./logdir/rollbysize
+        // prealloc: 预创建分段时用fallocate预留的字节数, 0表示不预留
+        SegmentArchiver(const std::string &basename, const RetentionPolicy &policy, size_t prealloc = 0)
+        :_dir(util::File::path(basename)), _policy(policy), _prealloc(prealloc),
+        _total_bytes(0), _prepare_count(0), _running(true)
+        {
+            auto pos = basename.find_last_of("/\\");
+            _prefix = pos == std::string::npos ? basename : basename.substr(pos + 1);
+            _prepared._fd = -1;
+            _thread = std::thread(&SegmentArchiver::threadEntry, this);
+        }
+        ~SegmentArchiver()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            _thread.join();
+            // 没有被使用的预创建分段直接删除
+            if(_prepared._fd >= 0)
+            {
+                close(_prepared._fd);
+                unlink(_prepared._pathname.c_str());
+            }
+        }
+        // 取走预创建好的分段, 后台还没准备好时返回false
+        bool takePrepared(Prepared &out)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(_prepared._fd < 0) return false;
+            out._fd = _prepared._fd;
+            out._pathname.swap(_prepared._pathname);
+            _prepared._fd = -1;
+            return true;
+        }
+        // 请求预创建下一个分段
+        void prepare() { post(Task{Task::PREPARE, -1, std::string(), std::string()}); }
+        // 把预创建的临时文件重命名为正式的分段名
+        void rename(const std::string &from, const std::string &to)
+        {
+            post(Task{Task::RENAME, -1, from, to});
+        }
+        // 扫描上次运行遗留的分段, active为当前正在写入的文件, 不纳入管理
+        void scan(const std::string &active) { post(Task{Task::SCAN, -1, active, std::string()}); }
+        // 投递一个已经写完的分段, 由后台关闭文件描述符后归档
+        void submit(int fd, const std::string &pathname)
+        {
+            post(Task{Task::ARCHIVE, fd, pathname, std::string()});
+        }
+    private:
+        struct Task
+        {
+            enum Type { PREPARE, RENAME, SCAN, ARCHIVE } _type;
+            int _fd;
+            std::string _from;
+            std::string _to;
+        };
+        struct Segment
+        {
+            std::string _pathname;
+            size_t _size;
+            time_t _mtime;
+        };
+        void post(Task &&task)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _pending.push_back(std::move(task));
+            }
+            _cond.notify_one();
+        }
+        static bool endsWith(const std::string &str, const std::string &suffix)
+        {
+            return str.size() >= suffix.size()
+                && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+        // 从pos开始跳过连续的数字, 返回第一个非数字的位置
+        static size_t skipDigits(const std::string &str, size_t pos)
+        {
+            while(pos < str.size() && str[pos] >= '0' && str[pos] <= '9') pos++;
+            return pos;
+        }
+        // 只认本落地生成的分段名: 前缀 + YYYYmmddHHMMSS-计数[.重名序号] + .log[.gz]
+        // 不能只比较前缀, 否则前缀为app时会把app-debug的分段也算进来
+        bool isSegment(const std::string &name) const
+        {
+            if(name.compare(0, _prefix.size(), _prefix) != 0) return false;
+            size_t pos = _prefix.size();
+            size_t end = skipDigits(name, pos);
+            if(end - pos != 14 || end >= name.size() || name[end] != '-') return false;
+            pos = end + 1;
+            end = skipDigits(name, pos);
+            if(end == pos) return false;
+            // doRename在重名时插入的序号
+            if(end < name.size() && name[end] == '.' && skipDigits(name, end + 1) > end + 1)
+            {
+                end = skipDigits(name, end + 1);
+            }
+            std::string rest = name.substr(end);
+            return rest == ".log" || rest == ".log.gz";
+        }
+        void threadEntry()
+        {
+            while(1)
+            {
+                std::deque<Task> tasks;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond.wait(lock, [&](){ return !_running || !_pending.empty(); });
+                    if(!_running && _pending.empty()) return;
+                    tasks.swap(_pending);
+                }
+                for(auto &task : tasks)
+                {
+                    switch(task._type)
+                    {
+                        case Task::PREPARE: doPrepare(); break;
+                        case Task::RENAME: doRename(task._from, task._to); break;
+                        case Task::SCAN: doScan(task._from); break;
+                        case Task::ARCHIVE: doArchive(task._fd, task._from); break;
+                    }
+                }
+                retain();
+            }
+        }
+        void doPrepare()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if(_prepared._fd >= 0 || !_running) return;
+            }
+            std::string pathname = _dir + "." + _prefix + ".next-" + std::to_string(_prepare_count++);
+            int fd = open(pathname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+            if(fd < 0)
+            {
+                std::cout << "预创建日志分段失败: " << pathname << std::endl;
+                return;
+            }
+            // 保持文件大小不变, 只预留磁盘块
+            if(_prealloc > 0) fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, _prealloc);
+            std::unique_lock<std::mutex> lock(_mutex);
+            _prepared._fd = fd;
+            _prepared._pathname = pathname;
+        }
+        // 目标已存在时不覆盖, 在.log前追加序号
+        void doRename(const std::string &from, const std::string &to)
+        {
+            std::string target = to;
+            for(int i = 1; !renameNoReplace(from, target); i++)
+            {
+                if(errno != EEXIST)
+                {
+                    std::cout << "重命名日志分段失败: " << from << std::endl;
+                    target = from;
+                    break;
+                }
+                target = to.substr(0, to.size() - 4) + "." + std::to_string(i) + ".log";
+            }
+            if(target != to)
+            {
+                _renamed[to] = target;
+                ::rename(IndexWriter::pathFor(to).c_str(), IndexWriter::pathFor(target).c_str());
+            }
+        }
+        static bool renameNoReplace(const std::string &from, const std::string &to)
+        {
+#ifdef RENAME_NOREPLACE
+            if(renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0) return true;
+            if(errno != EINVAL && errno != ENOSYS) return false;
+#endif
+            if(util::File::exists(to))
+            {
+                errno = EEXIST;
+                return false;
+            }
+            return ::rename(from.c_str(), to.c_str()) == 0;
+        }
+        // 写入线程记录的文件名可能因为重名被改过, 查出真实文件名
+        std::string resolve(const std::string &pathname)
+        {
+            auto it = _renamed.find(pathname);
+            if(it == _renamed.end()) return pathname;
+            std::string real = it->second;
+            _renamed.erase(it);
+            return real;
+        }
+        void doScan(const std::string &active)
+        {
+            auto it = _renamed.find(active);
+            std::string real_active = it == _renamed.end() ? active : it->second;
+            std::vector<Segment> found;
+            DIR *dir = opendir(_dir.c_str());
+            if(dir == nullptr) return;
+            struct dirent *ent;
+            while((ent = readdir(dir)) != nullptr)
+            {
+                std::string name = ent->d_name;
+                if(!isSegment(name)) continue;
+                std::string pathname = _dir + name;
+                if(pathname == real_active) continue;
+                struct stat st;
+                if(stat(pathname.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+                // 遗留的未压缩分段补做压缩
+                if(_policy._compress && endsWith(name, ".log") && compress(pathname))
+                {
+                    pathname += ".gz";
+                    if(stat(pathname.c_str(), &st) != 0) continue;
+                }
+                found.push_back(Segment{pathname, (size_t)st.st_size, st.st_mtime});
+            }
+            closedir(dir);
+            // 按修改时间从旧到新排列, 时间相同按文件名
+            std::sort(found.begin(), found.end(), [](const Segment &a, const Segment &b){
+                return a._mtime != b._mtime ? a._mtime < b._mtime : a._pathname < b._pathname;
+            });
+            // 遗留分段都比本次运行产生的分段旧
+            _segments.insert(_segments.begin(), found.begin(), found.end());
+            for(auto &seg : found) _total_bytes += seg._size;
+        }
+        // 处理单个分段: 关闭、可选压缩, 然后纳入保留管理
+        void doArchive(int fd, const std::string &name)
+        {
+            struct stat st;
+            if(fd >= 0)
+            {
+                // 释放fallocate预留但没有用到的磁盘块
+                if(_prealloc > 0 && fstat(fd, &st) == 0) ftruncate(fd, st.st_size);
+                close(fd);
+            }
+            std::string pathname = resolve(name);
+            if(_policy._compress && compress(pathname))
+            {
+                pathname += ".gz";
+            }
+            if(stat(pathname.c_str(), &st) != 0) return;
+            _total_bytes += st.st_size;
+            _segments.push_back(Segment{pathname, (size_t)st.st_size, st.st_mtime});
+        }
+        // 调用gzip压缩, 成功后原文件被gzip删除, 生成 pathname.gz
+        bool compress(const std::string &pathname)
+        {
+            std::string arg0 = "gzip", arg1 = "-f", arg2 = pathname;
+            char *argv[] = { &arg0[0], &arg1[0], &arg2[0], nullptr };
+            pid_t pid;
+            if(posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) != 0)
+            {
+                std::cout << "启动gzip失败, 保留未压缩分段: " << pathname << std::endl;
+                return false;
+            }
+            int status = 0;
+            while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        // 超出保留策略时从最旧的分段开始删除
+        void retain()
+        {
+            while(!_segments.empty() &&
+                 ((_policy._max_files && _segments.size() > _policy._max_files) ||
+                  (_policy._max_total_bytes && _total_bytes > _policy._max_total_bytes)))
+            {
+                Segment &seg = _segments.front();
+                if(unlink(seg._pathname.c_str()) != 0 && errno != ENOENT)
+                {
+                    std::cout << "删除过期日志分段失败: " << seg._pathname << std::endl;
+                }
+                unlink(IndexWriter::pathFor(seg._pathname).c_str()); // 分段的旁路索引, 可能不存在
+                _total_bytes -= seg._size;
+                _segments.pop_front();
+            }
+        }
+    private:
+        std::string _dir;    // 分段所在目录
+        std::string _prefix; // 分段文件名前缀
+        RetentionPolicy _policy;
+        size_t _prealloc;
+        // 以下几项只在归档线程中访问
+        std::deque<Segment> _segments; // 已关闭分段, 从旧到新
+        size_t _total_bytes;
+        std::unordered_map<std::string, std::string> _renamed; // 因重名改过的文件名
+        size_t _prepare_count;
+        Prepared _prepared; // 预创建好等待取走的分段, 受_mutex保护
+        std::deque<Task> _pending; // 待处理任务
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _running;
+        std::thread _thread; // 归档线程
+    };
+}
@@ -2,8 +2,18 @@
 #include <vector>
 #include <string>
 #include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <sys/uio.h>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 /*
     自定义缓冲区
+        1. Buffer: 线性缓冲区, 可以增容, 用于双缓冲交换
+        2. RingBuffer: 定长环形缓冲区, 容量为2的幂, 可读区域最多分成两段, 不需要搬移数据
+        3. ChunkBuffer: 由定长块串成的缓冲区, 增长只追加一块, 已写数据不拷贝; 块从ChunkPool中取用
+        4. StampedQueue: 单生产者单消费者的无锁记录队列, 每条记录带时间戳和序号, 用于按时间归并
 */
 namespace logSys
 {
@@ -13,7 +23,7 @@ namespace logSys
     class Buffer
     {
     public: 
-        Buffer():_buffer(BUFFER_DEFAULT_SIZE), _write_idx(0), _read_idx(0)
+        explicit Buffer(size_t size = BUFFER_DEFAULT_SIZE):_buffer(size), _read_idx(0), _write_idx(0)
         {}
         char *begin()
         {
@@ -97,8 +107,9 @@ namespace logSys
             // 缓冲区大小足够
             if(len <= tailIdleSize() + headIdleSize())
             {
+                size_t readable = readAbleSize();
                 std::copy(readPositon(), writePosition(), begin());
-                _read_idx = 0, _write_idx = len;
+                _read_idx = 0, _write_idx = readable;
             }
             // 空间不够增容
             else
@@ -130,4 +141,265 @@ namespace logSys
         size_t _read_idx;
         size_t _write_idx;
     };
-}
\ No newline at end of file
+
+    // 环形缓冲区: 读写位置单调递增, 取模得到实际下标
+    // 写满前不会覆盖未读数据, 也不会重新分配内存, 读者可以在锁外使用readSpans得到的区域
+    class RingBuffer
+    {
+    public:
+        explicit RingBuffer(size_t capacity = BUFFER_DEFAULT_SIZE)
+        :_buffer(roundUp(capacity)), _mask(_buffer.size() - 1), _read_idx(0), _write_idx(0)
+        {}
+        size_t capacity() const { return _buffer.size(); }
+        bool empty() const { return _write_idx == _read_idx; }
+        size_t readAbleSize() const { return _write_idx - _read_idx; }
+        size_t writeAbleSize() const { return _buffer.size() - readAbleSize(); }
+        // 写数据并且移动写位置, 调用者保证空间足够
+        void writeAndPush(const char *data, size_t len)
+        {
+            assert(len <= writeAbleSize());
+            size_t pos = _write_idx & _mask;
+            size_t first = std::min(len, _buffer.size() - pos);
+            memcpy(&_buffer[pos], data, first);
+            memcpy(&_buffer[0], data + first, len - first);
+            _write_idx += len;
+        }
+        // 可读区域, 返回段数(0~2), 回绕时第二段从缓冲区开头开始
+        int readSpans(struct iovec iov[2])
+        {
+            size_t len = readAbleSize();
+            if(len == 0) return 0;
+            size_t pos = _read_idx & _mask;
+            size_t first = std::min(len, _buffer.size() - pos);
+            iov[0].iov_base = &_buffer[pos];
+            iov[0].iov_len = first;
+            if(first == len) return 1;
+            iov[1].iov_base = &_buffer[0];
+            iov[1].iov_len = len - first;
+            return 2;
+        }
+        // 移动读位置
+        void moveReadBack(size_t len)
+        {
+            assert(len <= readAbleSize());
+            _read_idx += len;
+        }
+        void reset()
+        {
+            _read_idx = _write_idx = 0;
+        }
+    private:
+        static size_t roundUp(size_t n)
+        {
+            size_t cap = 1;
+            while(cap < n) cap <<= 1;
+            return cap;
+        }
+    private:
+        std::vector<char> _buffer;
+        size_t _mask;
+        size_t _read_idx;  // 已经读到的位置
+        size_t _write_idx; // 已经写到的位置
+    };
+
+    #define CHUNK_SIZE (256*1024)          // 块大小
+    #define CHUNK_POOL_RETAIN 16           // 池中最多保留的空闲块数, 多余的释放
+    // 数据块, 分配时不清零
+    struct Chunk
+    {
+        size_t _len;
+        char _data[CHUNK_SIZE];
+    };
+    // 块池: 生产者和工作线程各自取用和归还, 自带一把锁, 每个块只在取用和归还时加锁一次
+    class ChunkPool
+    {
+    public:
+        ChunkPool() = default;
+        ChunkPool(const ChunkPool &) = delete;
+        ChunkPool &operator=(const ChunkPool &) = delete;
+        ~ChunkPool()
+        {
+            for(Chunk *c : _free) delete c;
+        }
+        Chunk *get()
+        {
+            Chunk *c = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(!_free.empty())
+                {
+                    c = _free.back();
+                    _free.pop_back();
+                }
+            }
+            if(c == nullptr) c = new Chunk;
+            c->_len = 0;
+            return c;
+        }
+        void put(Chunk *c)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(_free.size() < CHUNK_POOL_RETAIN)
+                {
+                    _free.push_back(c);
+                    return;
+                }
+            }
+            delete c;
+        }
+    private:
+        std::mutex _mutex;
+        std::vector<Chunk *> _free;
+    };
+    // 块链缓冲区: 只支持追加写和整体读出, 用于不定长的双缓冲交换
+    class ChunkBuffer
+    {
+    public:
+        explicit ChunkBuffer(ChunkPool &pool) :_pool(&pool), _size(0) {}
+        ChunkBuffer(const ChunkBuffer &) = delete;
+        ChunkBuffer &operator=(const ChunkBuffer &) = delete;
+        ~ChunkBuffer() { reset(); }
+        bool empty() const { return _size == 0; }
+        size_t readAbleSize() const { return _size; }
+        size_t chunkCount() const { return _chunks.size(); }
+        // 追加数据, 当前块写满时取新块, 一条记录可以跨块
+        void writeAndPush(const char *data, size_t len)
+        {
+            _size += len;
+            while(len > 0)
+            {
+                if(_chunks.empty() || _chunks.back()->_len == CHUNK_SIZE) _chunks.push_back(_pool->get());
+                Chunk *c = _chunks.back();
+                size_t n = std::min(len, (size_t)CHUNK_SIZE - c->_len);
+                memcpy(c->_data + c->_len, data, n);
+                c->_len += n;
+                data += n;
+                len -= n;
+            }
+        }
+        // 从第first块开始填写最多max段, 返回填写的段数, 不分配内存
+        int readSpans(struct iovec *iov, int max, size_t first = 0) const
+        {
+            int cnt = 0;
+            for(size_t i = first; i < _chunks.size() && cnt < max; i++)
+            {
+                iov[cnt].iov_base = _chunks[i]->_data;
+                iov[cnt].iov_len = _chunks[i]->_len;
+                cnt++;
+            }
+            return cnt;
+        }
+        void swap(ChunkBuffer &other)
+        {
+            std::swap(_pool, other._pool);
+            _chunks.swap(other._chunks);
+            std::swap(_size, other._size);
+        }
+        // 把块还给池
+        void reset()
+        {
+            for(Chunk *c : _chunks) _pool->put(c);
+            _chunks.clear();
+            _size = 0;
+        }
+    private:
+        ChunkPool *_pool;
+        std::vector<Chunk *> _chunks;
+        size_t _size;
+    };
+
+    // 队列中一条记录的头部, 后面紧跟_len字节数据, 整条记录按8字节对齐
+    struct StampedRecord
+    {
+        uint64_t _ts;       // 入队时间, 纳秒
+        uint64_t _seq;      // 生产者内的序号
+        int64_t _min_time;  // 记录的元数据, 见RecordMeta
+        int64_t _max_time;
+        uint32_t _len;      // 数据长度, WRAP表示从这里回绕到开头
+        uint32_t _levels;
+    };
+    // 单生产者单消费者的记录队列: 读写位置单调递增, 记录在缓冲区中连续存放, 尾部放不下时回绕
+    // 消费者用peek/next逐条查看, 数据落地之后再用release归还空间
+    class StampedQueue
+    {
+    public:
+        static const uint32_t WRAP = UINT32_MAX;
+        explicit StampedQueue(size_t capacity)
+        :_buffer(roundUp(capacity)), _mask(_buffer.size() - 1), _read_idx(0), _write_idx(0)
+        {}
+        StampedQueue(const StampedQueue &) = delete;
+        StampedQueue &operator=(const StampedQueue &) = delete;
+        size_t capacity() const { return _buffer.size(); }
+        bool empty() const
+        {
+            return _read_idx.load(std::memory_order_acquire) == _write_idx.load(std::memory_order_acquire);
+        }
+        // 能否放下len字节的记录(不考虑回绕), 超过时永远无法写入
+        bool fits(size_t len) const { return recordSize(len) <= _buffer.size() / 2; }
+        // 生产者: 现在能否写入len字节的记录; 消费者只会归还空间, 返回true之后一直成立
+        bool writeAble(size_t len) const
+        {
+            size_t need = recordSize(len);
+            uint64_t w = _write_idx.load(std::memory_order_relaxed);
+            size_t pos = w & _mask;
+            size_t waste = _buffer.size() - pos < need ? _buffer.size() - pos : 0;
+            return w + waste + need - _read_idx.load(std::memory_order_acquire) <= _buffer.size();
+        }
+        // 生产者写入一条记录, 调用者先用writeAble确认空间
+        void push(const StampedRecord &header, const char *data)
+        {
+            assert(writeAble(header._len));
+            size_t need = recordSize(header._len);
+            uint64_t w = _write_idx.load(std::memory_order_relaxed);
+            size_t pos = w & _mask;
+            size_t waste = _buffer.size() - pos < need ? _buffer.size() - pos : 0;
+            if(waste > 0)
+            {
+                // 尾部剩余空间至少8字节, 放得下头部时写回绕标记, 否则消费者自己跳过
+                if(waste >= sizeof(StampedRecord)) recordAt(pos)->_len = WRAP;
+                w += waste;
+                pos = 0;
+            }
+            memcpy(&_buffer[pos], &header, sizeof(StampedRecord));
+            memcpy(&_buffer[pos + sizeof(StampedRecord)], data, header._len);
+            _write_idx.store(w + need, std::memory_order_release);
+        }
+        // 消费者: 从pos开始的下一条记录, 没有时返回nullptr; pos会跳过回绕的空间
+        const StampedRecord *peek(uint64_t &pos) const
+        {
+            uint64_t w = _write_idx.load(std::memory_order_acquire);
+            if(pos == w) return nullptr;
+            size_t off = pos & _mask;
+            if(_buffer.size() - off < sizeof(StampedRecord) || recordAt(off)->_len == WRAP)
+            {
+                pos += _buffer.size() - off;
+                if(pos == w) return nullptr;
+                off = 0;
+            }
+            return recordAt(off);
+        }
+        // 记录之后的位置, pos为peek返回该记录时的位置
+        uint64_t next(uint64_t pos, const StampedRecord *record) const { return pos + recordSize(record->_len); }
+        const char *payload(const StampedRecord *record) const { return (const char *)(record + 1); }
+        uint64_t readPos() const { return _read_idx.load(std::memory_order_relaxed); }
+        uint64_t writePos() const { return _write_idx.load(std::memory_order_acquire); }
+        // 归还pos之前的空间
+        void release(uint64_t pos) { _read_idx.store(pos, std::memory_order_release); }
+    private:
+        static size_t recordSize(size_t len) { return (sizeof(StampedRecord) + len + 7) & ~(size_t)7; }
+        static size_t roundUp(size_t n)
+        {
+            size_t cap = 64;
+            while(cap < n) cap <<= 1;
+            return cap;
+        }
+        StampedRecord *recordAt(size_t off) { return reinterpret_cast<StampedRecord *>(&_buffer[off]); }
+        const StampedRecord *recordAt(size_t off) const { return reinterpret_cast<const StampedRecord *>(&_buffer[off]); }
+    private:
+        std::vector<char> _buffer;
+        size_t _mask;
+        std::atomic<uint64_t> _read_idx;  // 消费者已经归还的位置
+        std::atomic<uint64_t> _write_idx; // 生产者已经发布的位置
+    };
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <signal.h>
+/*
+    崩溃日志落地
+        进程收到 SIGSEGV/SIGABRT 等信号时, 把已注册异步日志器缓冲区中还没写出的数据
+        直接write(2)到各个落地方向的文件描述符, 然后交还给原来的信号处理方式
+        信号处理函数中不加锁、不分配内存, 注册表是固定大小的原子指针数组
+    备用信号栈是每个线程各自的: install()只给调用线程设置, 异步工作线程启动时自己设置
+    其他线程(包括install之前已经启动的工作线程)栈溢出时也要落地日志, 需要各自调用installThread()
+*/
+namespace logSys
+{
+    class CrashHandler
+    {
+    public:
+        using FlushFunc = void (*)(void *ctx);
+        static const size_t MAX_ENTRIES = 64;
+        static const size_t ALT_STACK_SIZE = 64 * 1024;
+        // 安装信号处理函数, 需要用户显式调用(opt-in), 同时给调用线程设置备用信号栈
+        static void install(std::initializer_list<int> signals = { SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL })
+        {
+            installThread();
+            for(int sig : signals)
+            {
+                if(sig <= 0 || sig >= NSIG) continue;
+                struct sigaction sa;
+                memset(&sa, 0, sizeof(sa));
+                sa.sa_sigaction = &CrashHandler::handler;
+                sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+                sigemptyset(&sa.sa_mask);
+                sigaction(sig, &sa, &oldActions()[sig]);
+            }
+            installed().store(true);
+        }
+        // 给调用线程设置备用信号栈, 用于在栈溢出时仍能执行处理函数; 重复调用无效果, 线程退出时释放
+        static void installThread()
+        {
+            static thread_local AltStack stack;
+            stack.init();
+        }
+        // 是否已经调用过install, 工作线程据此决定是否需要备用栈
+        static std::atomic<bool> &installed()
+        {
+            static std::atomic<bool> flag(false);
+            return flag;
+        }
+        // 注册崩溃时要执行的落地函数, 注册表满时返回false
+        static bool add(void *ctx, FlushFunc func)
+        {
+            Entry *entries = table();
+            for(size_t i = 0; i < MAX_ENTRIES; i++)
+            {
+                void *expected = nullptr;
+                // 先占位再写函数, 最后发布ctx, 处理函数只认发布后的条目
+                if(entries[i]._owner.compare_exchange_strong(expected, ctx))
+                {
+                    entries[i]._func = func;
+                    entries[i]._ctx.store(ctx, std::memory_order_release);
+                    return true;
+                }
+            }
+            return false;
+        }
+        static void remove(void *ctx)
+        {
+            Entry *entries = table();
+            for(size_t i = 0; i < MAX_ENTRIES; i++)
+            {
+                if(entries[i]._owner.load() != ctx) continue;
+                entries[i]._ctx.store(nullptr, std::memory_order_release);
+                entries[i]._owner.store(nullptr);
+            }
+        }
+    private:
+        // 线程私有的备用信号栈
+        struct AltStack
+        {
+            AltStack() :_mem(nullptr) {}
+            ~AltStack()
+            {
+                if(_mem == nullptr) return;
+                // 先停用再释放, 之后到达的信号不会落在已释放的内存上
+                stack_t ss;
+                memset(&ss, 0, sizeof(ss));
+                ss.ss_flags = SS_DISABLE;
+                sigaltstack(&ss, nullptr);
+                free(_mem);
+            }
+            void init()
+            {
+                if(_mem != nullptr) return;
+                _mem = (char *)malloc(ALT_STACK_SIZE);
+                if(_mem == nullptr) return;
+                stack_t ss;
+                memset(&ss, 0, sizeof(ss));
+                ss.ss_sp = _mem;
+                ss.ss_size = ALT_STACK_SIZE;
+                sigaltstack(&ss, nullptr);
+            }
+            char *_mem;
+        };
+        struct Entry
+        {
+            std::atomic<void *> _owner; // 占用该条目的注册者
+            std::atomic<void *> _ctx;   // 已发布的注册者
+            FlushFunc _func;
+        };
+        static Entry *table()
+        {
+            static Entry entries[MAX_ENTRIES];
+            return entries;
+        }
+        static struct sigaction *oldActions()
+        {
+            static struct sigaction actions[NSIG];
+            return actions;
+        }
+        static void handler(int sig, siginfo_t *, void *)
+        {
+            // 多个线程同时崩溃时只落地一次
+            static std::atomic<bool> flushing(false);
+            if(!flushing.exchange(true))
+            {
+                Entry *entries = table();
+                for(size_t i = 0; i < MAX_ENTRIES; i++)
+                {
+                    void *ctx = entries[i]._ctx.load(std::memory_order_acquire);
+                    if(ctx != nullptr) entries[i]._func(ctx);
+                }
+            }
+            // 恢复原来的处理方式后重新发出信号, 保留core dump和默认退出码
+            sigaction(sig, &oldActions()[sig], nullptr);
+            raise(sig);
+        }
+    };
+}
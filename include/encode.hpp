@@ -0,0 +1,580 @@
+#pragma once
+/*编码工具类
+    1. 整数转字符串: 查表每次输出两位
+    2. 浮点数转字符串: Grisu2算法, 结果可以无损还原
+    3. 字符串转义: 用SSE2/AVX2查找需要转义的字节(运行时按CPU选择), 干净的区间整段拷贝
+        JSON转义: 双引号、反斜杠、控制字符
+        行内转义: 换行等控制字符和反斜杠, 保证一条日志只占一行
+*/
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <ostream>
+// x86-64上SSE2总是可用, AVX2在运行时按CPU选择; 定义LOGSYS_NO_SIMD可强制使用标量实现
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LOGSYS_NO_SIMD)
+#define LOGSYS_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define LOGSYS_X86_SIMD 0
+#endif
+
+namespace logSys
+{
+    namespace util
+    {
+        class Number
+        {
+        public:
+            // 输出缓冲区至少需要的大小
+            static const size_t MAX_INT_LEN = 21;
+            static const size_t MAX_DOUBLE_LEN = 32;
+
+            // 写入buf并返回长度, 不追加'\0'
+            static size_t utoa(uint64_t value, char *buf)
+            {
+                char tmp[MAX_INT_LEN];
+                char *p = tmp + MAX_INT_LEN;
+                while(value >= 100)
+                {
+                    const char *d = digits() + (value % 100) * 2;
+                    value /= 100;
+                    *--p = d[1];
+                    *--p = d[0];
+                }
+                if(value >= 10)
+                {
+                    const char *d = digits() + value * 2;
+                    *--p = d[1];
+                    *--p = d[0];
+                }
+                else
+                {
+                    *--p = (char)('0' + value);
+                }
+                size_t len = tmp + MAX_INT_LEN - p;
+                memcpy(buf, p, len);
+                return len;
+            }
+            static size_t itoa(int64_t value, char *buf)
+            {
+                if(value >= 0) return utoa((uint64_t)value, buf);
+                *buf = '-';
+                return 1 + utoa(0 - (uint64_t)value, buf + 1);
+            }
+            // 最短且能无损还原的十进制表示, 非有限值由调用者处理
+            static size_t dtoa(double value, char *buf)
+            {
+                char *p = buf;
+                if(std::signbit(value))
+                {
+                    *p++ = '-';
+                    value = -value;
+                }
+                if(value == 0)
+                {
+                    memcpy(p, "0.0", 3);
+                    return p + 3 - buf;
+                }
+                int length = 0, k = 0;
+                grisu2(value, p, &length, &k);
+                return prettify(p, length, k) - buf;
+            }
+            static void append(std::string &out, int64_t value)
+            {
+                char buf[MAX_INT_LEN];
+                out.append(buf, itoa(value, buf));
+            }
+            static void append(std::string &out, uint64_t value)
+            {
+                char buf[MAX_INT_LEN];
+                out.append(buf, utoa(value, buf));
+            }
+            static void append(std::string &out, double value)
+            {
+                char buf[MAX_DOUBLE_LEN];
+                out.append(buf, dtoa(value, buf));
+            }
+            // "00" "01" ... "99"
+            static const char *digits()
+            {
+                static const char table[] =
+                    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                    "8081828384858687888990919293949596979899";
+                return table;
+            }
+        private:
+            // 用64位有效数字和二进制指数表示的浮点数
+            struct DiyFp
+            {
+                DiyFp(uint64_t f, int e) :_f(f), _e(e) {}
+                explicit DiyFp(double d)
+                {
+                    uint64_t u;
+                    memcpy(&u, &d, sizeof(u));
+                    int biased_e = (int)((u & EXPONENT_MASK) >> 52);
+                    uint64_t significand = u & SIGNIFICAND_MASK;
+                    if(biased_e != 0)
+                    {
+                        _f = significand + HIDDEN_BIT;
+                        _e = biased_e - EXPONENT_BIAS;
+                    }
+                    else
+                    {
+                        _f = significand;
+                        _e = 1 - EXPONENT_BIAS;
+                    }
+                }
+                DiyFp operator-(const DiyFp &rhs) const { return DiyFp(_f - rhs._f, _e); }
+                DiyFp operator*(const DiyFp &rhs) const
+                {
+                    unsigned __int128 p = (unsigned __int128)_f * rhs._f;
+                    uint64_t h = (uint64_t)(p >> 64);
+                    uint64_t l = (uint64_t)p;
+                    if(l & (1ULL << 63)) h++; // 四舍五入
+                    return DiyFp(h, _e + rhs._e + 64);
+                }
+                DiyFp normalize() const
+                {
+                    int s = __builtin_clzll(_f);
+                    return DiyFp(_f << s, _e - s);
+                }
+                DiyFp normalizeBoundary() const
+                {
+                    DiyFp res = *this;
+                    while(!(res._f & (HIDDEN_BIT << 1)))
+                    {
+                        res._f <<= 1;
+                        res._e--;
+                    }
+                    res._f <<= 64 - 52 - 2;
+                    res._e -= 64 - 52 - 2;
+                    return res;
+                }
+                // 相邻浮点数中点构成的区间, 区间内任意值都能还原成原值
+                void normalizedBoundaries(DiyFp *minus, DiyFp *plus) const
+                {
+                    DiyFp pl = DiyFp((_f << 1) + 1, _e - 1).normalizeBoundary();
+                    DiyFp mi = (_f == HIDDEN_BIT) ? DiyFp((_f << 2) - 1, _e - 2) : DiyFp((_f << 1) - 1, _e - 1);
+                    mi._f <<= mi._e - pl._e;
+                    mi._e = pl._e;
+                    *plus = pl;
+                    *minus = mi;
+                }
+                static const uint64_t EXPONENT_MASK = 0x7FF0000000000000ULL;
+                static const uint64_t SIGNIFICAND_MASK = 0x000FFFFFFFFFFFFFULL;
+                static const uint64_t HIDDEN_BIT = 0x0010000000000000ULL;
+                static const int EXPONENT_BIAS = 0x3FF + 52;
+                uint64_t _f;
+                int _e;
+            };
+            // 10^-348, 10^-340, ..., 10^340 的规格化表示
+            static DiyFp cachedPower(int e, int *k)
+            {
+                static const uint64_t powers_f[] = {
+                    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+                    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+                    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+                    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+                    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+                    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+                    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+                    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+                    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+                    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+                    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+                    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+                    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+                    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+                    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+                    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+                    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+                    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+                    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+                    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+                    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+                    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+                    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+                    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+                    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+                    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+                    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+                    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+                    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+                };
+                static const int16_t powers_e[] = {
+                    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+                    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+                    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+                    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+                    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+                    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+                    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+                    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+                    907, 933, 960, 986, 1013, 1039, 1066
+                };
+                // 选择使乘积的二进制指数落在[-60, -32]的10的幂
+                double dk = (-61 - e) * 0.30102999566398114 + 347;
+                int ik = (int)dk;
+                if(dk - ik > 0.0) ik++;
+                unsigned index = (unsigned)((ik >> 3) + 1);
+                *k = -(-348 + (int)(index << 3));
+                return DiyFp(powers_f[index], powers_e[index]);
+            }
+            static int countDigits(uint32_t n)
+            {
+                if(n < 10) return 1;
+                if(n < 100) return 2;
+                if(n < 1000) return 3;
+                if(n < 10000) return 4;
+                if(n < 100000) return 5;
+                if(n < 1000000) return 6;
+                if(n < 10000000) return 7;
+                if(n < 100000000) return 8;
+                return 9;
+            }
+            static void grisuRound(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+            {
+                while(rest < wp_w && delta - rest >= ten_kappa &&
+                      (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+                {
+                    buf[len - 1]--;
+                    rest += ten_kappa;
+                }
+            }
+            static void digitGen(const DiyFp &w, const DiyFp &mp, uint64_t delta, char *buf, int *len, int *k)
+            {
+                static const uint64_t pow10[] = {
+                    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+                    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+                    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+                    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+                };
+                const DiyFp one(1ULL << -mp._e, mp._e);
+                const DiyFp wp_w = mp - w;
+                uint32_t p1 = (uint32_t)(mp._f >> -one._e);
+                uint64_t p2 = mp._f & (one._f - 1);
+                int kappa = countDigits(p1);
+                *len = 0;
+                // 整数部分
+                while(kappa > 0)
+                {
+                    uint32_t div = (uint32_t)pow10[kappa - 1];
+                    uint32_t d = p1 / div;
+                    p1 %= div;
+                    if(d || *len) buf[(*len)++] = (char)('0' + d);
+                    kappa--;
+                    uint64_t tmp = ((uint64_t)p1 << -one._e) + p2;
+                    if(tmp <= delta)
+                    {
+                        *k += kappa;
+                        grisuRound(buf, *len, delta, tmp, pow10[kappa] << -one._e, wp_w._f);
+                        return;
+                    }
+                }
+                // 小数部分
+                while(1)
+                {
+                    p2 *= 10;
+                    delta *= 10;
+                    char d = (char)(p2 >> -one._e);
+                    if(d || *len) buf[(*len)++] = (char)('0' + d);
+                    p2 &= one._f - 1;
+                    kappa--;
+                    if(p2 < delta)
+                    {
+                        *k += kappa;
+                        int index = -kappa;
+                        grisuRound(buf, *len, delta, p2, one._f, wp_w._f * (index < 20 ? pow10[index] : 0));
+                        return;
+                    }
+                }
+            }
+            // 生成数字串buf[0, len)和十进制指数k, 值为 buf * 10^k
+            static void grisu2(double value, char *buf, int *len, int *k)
+            {
+                const DiyFp v(value);
+                DiyFp w_m(0, 0), w_p(0, 0);
+                v.normalizedBoundaries(&w_m, &w_p);
+                const DiyFp c_mk = cachedPower(w_p._e, k);
+                const DiyFp w = v.normalize() * c_mk;
+                DiyFp wp = w_p * c_mk;
+                DiyFp wm = w_m * c_mk;
+                wm._f++;
+                wp._f--;
+                digitGen(w, wp, wp._f - wm._f, buf, len, k);
+            }
+            static char *writeExponent(int k, char *buf)
+            {
+                if(k < 0)
+                {
+                    *buf++ = '-';
+                    k = -k;
+                }
+                if(k >= 100)
+                {
+                    *buf++ = (char)('0' + k / 100);
+                    k %= 100;
+                    memcpy(buf, digits() + k * 2, 2);
+                    buf += 2;
+                }
+                else if(k >= 10)
+                {
+                    memcpy(buf, digits() + k * 2, 2);
+                    buf += 2;
+                }
+                else
+                {
+                    *buf++ = (char)('0' + k);
+                }
+                return buf;
+            }
+            // 数字串转换为常见写法: 12340000.0 12.34 0.001234 1.234e+30
+            static char *prettify(char *buf, int length, int k)
+            {
+                const int kk = length + k; // 10^(kk-1) <= v < 10^kk
+                if(0 <= k && kk <= 21)
+                {
+                    for(int i = length; i < kk; i++) buf[i] = '0';
+                    buf[kk] = '.';
+                    buf[kk + 1] = '0';
+                    return buf + kk + 2;
+                }
+                else if(0 < kk && kk <= 21)
+                {
+                    memmove(buf + kk + 1, buf + kk, length - kk);
+                    buf[kk] = '.';
+                    return buf + length + 1;
+                }
+                else if(-6 < kk && kk <= 0)
+                {
+                    const int offset = 2 - kk;
+                    memmove(buf + offset, buf, length);
+                    buf[0] = '0';
+                    buf[1] = '.';
+                    for(int i = 2; i < offset; i++) buf[i] = '0';
+                    return buf + length + offset;
+                }
+                else if(length == 1)
+                {
+                    buf[1] = 'e';
+                    return writeExponent(kk - 1, buf + 2);
+                }
+                else
+                {
+                    memmove(buf + 2, buf + 1, length - 1);
+                    buf[1] = '.';
+                    buf[length + 1] = 'e';
+                    return writeExponent(kk - 1, buf + length + 2);
+                }
+            }
+        };
+
+        class Escape
+        {
+        public:
+            typedef size_t (*FindFunc)(const char *data, size_t len);
+            // JSON字符串中需要转义的字节: 双引号、反斜杠、控制字符
+            static bool jsonNeedEscape(unsigned char c)
+            {
+                return c < 0x20 || c == '"' || c == '\\';
+            }
+            // 按行解析时需要转义的字节: 除制表符外的控制字符、DEL、反斜杠
+            static bool lineNeedEscape(unsigned char c)
+            {
+                return (c < 0x20 && c != '\t') || c == 0x7f || c == '\\';
+            }
+            // 返回第一个需要转义的字节下标, 没有则返回len
+            static size_t jsonFind(const char *data, size_t len)
+            {
+                static const FindFunc func = select(&jsonFindAvx2, &jsonFindSse2, &jsonFindScalar);
+                return func(data, len);
+            }
+            static size_t lineFind(const char *data, size_t len)
+            {
+                static const FindFunc func = select(&lineFindAvx2, &lineFindSse2, &lineFindScalar);
+                return func(data, len);
+            }
+            // 当前CPU使用的实现, 便于确认运行时分派结果
+            static const char *simdName()
+            {
+#if LOGSYS_X86_SIMD
+                return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+                return "scalar";
+#endif
+            }
+            // 追加转义后的内容, 不包含两侧引号
+            static void appendJson(std::string &out, const char *data, size_t len)
+            {
+                while(len > 0)
+                {
+                    size_t pos = jsonFind(data, len);
+                    out.append(data, pos);
+                    if(pos == len) return;
+                    appendJsonChar(out, (unsigned char)data[pos]);
+                    data += pos + 1;
+                    len -= pos + 1;
+                }
+            }
+            // 写出单行安全的内容: 换行写作\n, 其他控制字符写作\xHH, 反斜杠写作两个反斜杠
+            // 没有需要转义的字节时只有一次扫描和一次整段写入
+            static void writeLine(std::ostream &os, const char *data, size_t len)
+            {
+                while(len > 0)
+                {
+                    size_t pos = lineFind(data, len);
+                    os.write(data, pos);
+                    if(pos == len) return;
+                    char buf[4];
+                    os.write(buf, lineChar((unsigned char)data[pos], buf));
+                    data += pos + 1;
+                    len -= pos + 1;
+                }
+            }
+        private:
+            static FindFunc select(FindFunc avx2, FindFunc sse2, FindFunc scalar)
+            {
+#if LOGSYS_X86_SIMD
+                (void)scalar;
+                if(__builtin_cpu_supports("avx2")) return avx2;
+                return sse2;
+#else
+                (void)avx2; (void)sse2;
+                return scalar;
+#endif
+            }
+            static size_t jsonFindScalar(const char *data, size_t len)
+            {
+                for(size_t i = 0; i < len; i++)
+                {
+                    if(jsonNeedEscape((unsigned char)data[i])) return i;
+                }
+                return len;
+            }
+            static size_t lineFindScalar(const char *data, size_t len)
+            {
+                for(size_t i = 0; i < len; i++)
+                {
+                    if(lineNeedEscape((unsigned char)data[i])) return i;
+                }
+                return len;
+            }
+#if LOGSYS_X86_SIMD
+            // 无符号比较 v <= 0x1f 等价于 max(v, 0x1f) == 0x1f
+            static size_t jsonFindSse2(const char *data, size_t len)
+            {
+                const __m128i quote = _mm_set1_epi8('"');
+                const __m128i slash = _mm_set1_epi8('\\');
+                const __m128i ctrl = _mm_set1_epi8(0x1f);
+                size_t i = 0;
+                for(; i + 16 <= len; i += 16)
+                {
+                    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+                    __m128i hit = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+                        _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+                    int mask = _mm_movemask_epi8(hit);
+                    if(mask) return i + __builtin_ctz(mask);
+                }
+                return i + jsonFindScalar(data + i, len - i);
+            }
+            static size_t lineFindSse2(const char *data, size_t len)
+            {
+                const __m128i tab = _mm_set1_epi8('\t');
+                const __m128i del = _mm_set1_epi8(0x7f);
+                const __m128i slash = _mm_set1_epi8('\\');
+                const __m128i ctrl = _mm_set1_epi8(0x1f);
+                size_t i = 0;
+                for(; i + 16 <= len; i += 16)
+                {
+                    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+                    __m128i c = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab),
+                                                 _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+                    __m128i hit = _mm_or_si128(c,
+                        _mm_or_si128(_mm_cmpeq_epi8(v, del), _mm_cmpeq_epi8(v, slash)));
+                    int mask = _mm_movemask_epi8(hit);
+                    if(mask) return i + __builtin_ctz(mask);
+                }
+                return i + lineFindScalar(data + i, len - i);
+            }
+            __attribute__((target("avx2")))
+            static size_t jsonFindAvx2(const char *data, size_t len)
+            {
+                const __m256i quote = _mm256_set1_epi8('"');
+                const __m256i slash = _mm256_set1_epi8('\\');
+                const __m256i ctrl = _mm256_set1_epi8(0x1f);
+                size_t i = 0;
+                for(; i + 32 <= len; i += 32)
+                {
+                    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+                    __m256i hit = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, slash)),
+                        _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl));
+                    unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+                    if(mask) return i + __builtin_ctz(mask);
+                }
+                return i + jsonFindSse2(data + i, len - i);
+            }
+            __attribute__((target("avx2")))
+            static size_t lineFindAvx2(const char *data, size_t len)
+            {
+                const __m256i tab = _mm256_set1_epi8('\t');
+                const __m256i del = _mm256_set1_epi8(0x7f);
+                const __m256i slash = _mm256_set1_epi8('\\');
+                const __m256i ctrl = _mm256_set1_epi8(0x1f);
+                size_t i = 0;
+                for(; i + 32 <= len; i += 32)
+                {
+                    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+                    __m256i c = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab),
+                                                    _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl));
+                    __m256i hit = _mm256_or_si256(c,
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, del), _mm256_cmpeq_epi8(v, slash)));
+                    unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+                    if(mask) return i + __builtin_ctz(mask);
+                }
+                return i + lineFindSse2(data + i, len - i);
+            }
+#else
+            static size_t jsonFindSse2(const char *data, size_t len) { return jsonFindScalar(data, len); }
+            static size_t lineFindSse2(const char *data, size_t len) { return lineFindScalar(data, len); }
+            static size_t jsonFindAvx2(const char *data, size_t len) { return jsonFindScalar(data, len); }
+            static size_t lineFindAvx2(const char *data, size_t len) { return lineFindScalar(data, len); }
+#endif
+            static void appendJsonChar(std::string &out, unsigned char c)
+            {
+                switch(c)
+                {
+                    case '"': out.append("\\\"", 2); return;
+                    case '\\': out.append("\\\\", 2); return;
+                    case '\n': out.append("\\n", 2); return;
+                    case '\r': out.append("\\r", 2); return;
+                    case '\t': out.append("\\t", 2); return;
+                    case '\b': out.append("\\b", 2); return;
+                    case '\f': out.append("\\f", 2); return;
+                }
+                static const char hex[] = "0123456789abcdef";
+                char buf[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+                out.append(buf, 6);
+            }
+            // 单个字节的行内转义, 返回写入长度
+            static size_t lineChar(unsigned char c, char *buf)
+            {
+                buf[0] = '\\';
+                switch(c)
+                {
+                    case '\\': buf[1] = '\\'; return 2;
+                    case '\n': buf[1] = 'n'; return 2;
+                    case '\r': buf[1] = 'r'; return 2;
+                }
+                static const char hex[] = "0123456789abcdef";
+                buf[1] = 'x';
+                buf[2] = hex[c >> 4];
+                buf[3] = hex[c & 0xf];
+                return 4;
+            }
+        };
+    }
+}
@@ -0,0 +1,255 @@
+#pragma once
+#include "encode.hpp"
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+/*
+    类型安全的 {} 格式化
+        1. 占位符写作 {}, 字面的大括号写作 {{ 和 }}
+        2. 参数按类型直接编码进目标字符串: 整数/浮点数用util::Number, 字符串直接拷贝, 不经过printf
+        3. 字面量格式串在编译期检查占位符个数(见logSys.h中的LOGF宏)
+           C++11的constexpr无法在编译期生成分段表, LOGF在每个调用点保存一个静态的Pattern:
+           占位符个数是模板参数, 转义和参数位置在第一次执行时解析一次, 之后只按分段拼接, 不再扫描格式串
+        4. 自定义类型通过特化FormatTraits支持:
+            template<> struct logSys::FormatTraits<Point>
+            {
+                static void append(std::string &out, const Point &p) { ... }
+            };
+*/
+namespace logSys
+{
+    template<typename T>
+    struct FormatTraits
+    {
+        static void append(std::string &out, const T &value)
+        {
+            static_assert(sizeof(T) == 0, "该类型不支持{}格式化, 请特化logSys::FormatTraits");
+        }
+    };
+
+    namespace util
+    {
+        class Format
+        {
+        public:
+            static const size_t BAD_PATTERN = (size_t)-1;
+            // 编译期统计占位符个数, 大括号不配对时返回BAD_PATTERN
+            static constexpr size_t placeholders(const char *s, size_t n = 0)
+            {
+                return *s == '\0' ? n
+                     : *s == '{' ? (s[1] == '{' ? placeholders(s + 2, n)
+                                  : s[1] == '}' ? placeholders(s + 2, n + 1) : BAD_PATTERN)
+                     : *s == '}' ? (s[1] == '}' ? placeholders(s + 2, n) : BAD_PATTERN)
+                     : placeholders(s + 1, n);
+            }
+            // 只在decltype中使用, 得到参数个数
+            template<typename ...Args>
+            static std::integral_constant<size_t, sizeof...(Args)> argCount(const Args &...);
+
+            // 类型擦除后的参数: 编码函数 + 参数地址, 避免递归展开
+            struct Arg
+            {
+                void (*_append)(std::string &, const void *);
+                const void *_value;
+            };
+            // 预先解析的格式串: 去掉转义后的字面文本 + N个参数插入的位置
+            template<size_t N>
+            class Pattern
+            {
+            public:
+                explicit Pattern(const char *fmt)
+                {
+                    size_t idx = 0;
+                    for(const char *p = fmt; *p != '\0'; p++)
+                    {
+                        if((*p == '{' || *p == '}') && p[1] == *p)
+                        {
+                            _text.push_back(*p++); // {{ 或 }}
+                        }
+                        else if(*p == '{' && p[1] == '}' && idx < N)
+                        {
+                            _cut[idx++] = _text.size();
+                            p++;
+                        }
+                        else _text.push_back(*p);
+                    }
+                    for(; idx < N; idx++) _cut[idx] = _text.size();
+                }
+                void append(std::string &out, const Arg *args) const
+                {
+                    size_t pos = 0;
+                    for(size_t i = 0; i < N; i++)
+                    {
+                        out.append(_text, pos, _cut[i] - pos);
+                        args[i]._append(out, args[i]._value);
+                        pos = _cut[i];
+                    }
+                    out.append(_text, pos, std::string::npos);
+                }
+            private:
+                std::string _text;
+                size_t _cut[N == 0 || N == BAD_PATTERN ? 1 : N];
+            };
+            template<typename ...Args>
+            static void append(std::string &out, const char *fmt, const Args &...args)
+            {
+                Arg list[sizeof...(Args) + 1] = { makeArg(args)..., { nullptr, nullptr } };
+                vappend(out, fmt, strlen(fmt), list, sizeof...(Args));
+            }
+            template<size_t N, typename ...Args>
+            static void append(std::string &out, const Pattern<N> &pattern, const Args &...args)
+            {
+                static_assert(N == sizeof...(Args), "格式串中{}的个数与参数个数不一致");
+                Arg list[sizeof...(Args) + 1] = { makeArg(args)..., { nullptr, nullptr } };
+                pattern.append(out, list);
+            }
+            // 按类型编码单个值, 供流式接口使用
+            template<typename T>
+            static void appendValue(std::string &out, const T &value)
+            {
+                Appender<T>::append(out, value);
+            }
+            // 多余的占位符原样输出, 多余的参数忽略
+            static void vappend(std::string &out, const char *fmt, size_t len, const Arg *args, size_t count)
+            {
+                const char *p = fmt;
+                const char *end = fmt + len;
+                size_t idx = 0;
+                while(p < end)
+                {
+                    const char *q = p;
+                    while(q < end && *q != '{' && *q != '}') q++;
+                    out.append(p, q - p);
+                    if(q == end) break;
+                    if(q + 1 < end && q[1] == q[0])
+                    {
+                        out.push_back(*q); // {{ 或 }}
+                        p = q + 2;
+                    }
+                    else if(*q == '{' && q + 1 < end && q[1] == '}' && idx < count)
+                    {
+                        args[idx]._append(out, args[idx]._value);
+                        idx++;
+                        p = q + 2;
+                    }
+                    else
+                    {
+                        out.push_back(*q); // 不配对的括号原样输出
+                        p = q + 1;
+                    }
+                }
+            }
+        private:
+            // 各类型的编码方式, 未覆盖的类型交给FormatTraits
+            template<typename T, typename Enable = void>
+            struct Appender
+            {
+                static void append(std::string &out, const T &v) { FormatTraits<T>::append(out, v); }
+            };
+            template<typename T>
+            static void thunk(std::string &out, const void *v)
+            {
+                Appender<T>::append(out, *static_cast<const T *>(v));
+            }
+            template<typename T>
+            static Arg makeArg(const T &v)
+            {
+                Arg arg = { &Format::thunk<T>, &v };
+                return arg;
+            }
+            static void appendString(std::string &out, const char *s)
+            {
+                if(s == nullptr) out.append("(null)", 6);
+                else out.append(s);
+            }
+            static void appendPointer(std::string &out, const void *p)
+            {
+                static const char digits[] = "0123456789abcdef";
+                char buf[2 + sizeof(void *) * 2];
+                char *end = buf + sizeof(buf);
+                char *w = end;
+                uintptr_t v = (uintptr_t)p;
+                do
+                {
+                    *--w = digits[v & 0xf];
+                    v >>= 4;
+                } while(v != 0);
+                *--w = 'x';
+                *--w = '0';
+                out.append(w, end - w);
+            }
+        };
+
+        template<>
+        struct Format::Appender<bool>
+        {
+            static void append(std::string &out, bool v)
+            {
+                if(v) out.append("true", 4);
+                else out.append("false", 5);
+            }
+        };
+        template<>
+        struct Format::Appender<char>
+        {
+            static void append(std::string &out, char v) { out.push_back(v); }
+        };
+        template<typename T>
+        struct Format::Appender<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value
+                                                           && !std::is_same<T, char>::value>::type>
+        {
+            static void append(std::string &out, T v) { Number::append(out, (int64_t)v); }
+        };
+        template<typename T>
+        struct Format::Appender<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+                                                           && !std::is_same<T, bool>::value
+                                                           && !std::is_same<T, char>::value>::type>
+        {
+            static void append(std::string &out, T v) { Number::append(out, (uint64_t)v); }
+        };
+        template<typename T>
+        struct Format::Appender<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+        {
+            static void append(std::string &out, T v) { Number::append(out, (double)v); }
+        };
+        template<typename T>
+        struct Format::Appender<T, typename std::enable_if<std::is_enum<T>::value>::type>
+        {
+            static void append(std::string &out, T v)
+            {
+                Appender<typename std::underlying_type<T>::type>::append(out, (typename std::underlying_type<T>::type)v);
+            }
+        };
+        template<>
+        struct Format::Appender<std::string>
+        {
+            static void append(std::string &out, const std::string &v) { out.append(v); }
+        };
+        template<>
+        struct Format::Appender<const char *>
+        {
+            static void append(std::string &out, const char *v) { appendString(out, v); }
+        };
+        template<>
+        struct Format::Appender<char *>
+        {
+            static void append(std::string &out, const char *v) { appendString(out, v); }
+        };
+        template<size_t N>
+        struct Format::Appender<char[N]>
+        {
+            static void append(std::string &out, const char (&v)[N]) { out.append(v, strnlen(v, N)); }
+        };
+        template<typename T>
+        struct Format::Appender<T *>
+        {
+            static void append(std::string &out, const T *v) { appendPointer(out, v); }
+        };
+        template<>
+        struct Format::Appender<std::nullptr_t>
+        {
+            static void append(std::string &out, std::nullptr_t) { out.append("nullptr", 7); }
+        };
+    }
+}
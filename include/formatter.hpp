@@ -1,6 +1,8 @@
 #pragma once
 #include "util.hpp"
 #include "message.hpp"
+#include "encode.hpp"
+#include "mdc.hpp"
 #include <iostream>
 #include <string>
 #include <vector>
@@ -8,18 +10,22 @@
 #include <sstream>
 #include <ctime>
 #include <cassert>
+#include <cmath>
 namespace logSys
 {
     /*
         %d 日期
         %T 缩进
-        %t 线程id
+        %t 线程id(内核线程id)
+        %N 线程名, 没有线程名时输出线程id
         %p 日志级别
         %c 日志器名称
         %f 文件名
         %l 行号
-        %m 日志消息
+        %m 日志消息, %m{escape} 转义消息中的换行和控制字符
         %n 换行
+        %k 结构化字段, 以 key=value 形式输出
+        %X{key} 当前线程诊断上下文中key的值, %X 以 key=value 形式输出整个上下文
     */
     // 抽象格式化子项
     class FormatItem
@@ -61,7 +67,19 @@ namespace logSys
     public:
         void format(std::ostream &os, const LogMsg &msg) override
         {
-            os << msg._pid;
+            if(msg._thread != nullptr) os.write(msg._thread->_tid_str.data(), msg._thread->_tid_str.size());
+            else os << msg._tid;
+        }
+    };
+
+    class ThreadNameFormatItem : public FormatItem
+    {
+    public:
+        void format(std::ostream &os, const LogMsg &msg) override
+        {
+            if(msg._thread == nullptr) os << msg._tid;
+            else if(msg._thread->_name.empty()) os.write(msg._thread->_tid_str.data(), msg._thread->_tid_str.size());
+            else os.write(msg._thread->_name.data(), msg._thread->_name.size());
         }
     };
 
@@ -104,10 +122,35 @@ namespace logSys
     class MsgFormatItem : public FormatItem
     {
     public:
+        // escape: 转义换行和控制字符, 保证一条日志只占一行
+        MsgFormatItem(bool escape = false)
+        :_escape(escape)
+        {}
         void format(std::ostream &os, const LogMsg &msg) override
         {
-            os << msg._payload;
+            if(_escape) util::Escape::writeLine(os, msg._payload, msg._payload_len);
+            else os.write(msg._payload, msg._payload_len);
         }
+    private:
+        bool _escape;
+    };
+
+    class FieldsFormatItem : public FormatItem
+    {
+    public:
+        void format(std::ostream &os, const LogMsg &msg) override;
+    };
+
+    // 诊断上下文: 单个值直接输出, 整个上下文使用与logfmt格式化器共用的缓存
+    class MdcFormatItem : public FormatItem
+    {
+    public:
+        MdcFormatItem(const std::string &key)
+        :_key(key)
+        {}
+        void format(std::ostream &os, const LogMsg &msg) override;
+    private:
+        std::string _key; // 为空表示整个上下文
     };
 
     class NLineFormatItem : public FormatItem
@@ -132,7 +175,28 @@ namespace logSys
     private:
         std::string _format;
     };
-    
+
+    // 把输出追加到外部字符串的流缓冲区, 每个线程复用一个绑定它的ostream
+    class StringStreamBuf : public std::streambuf
+    {
+    public:
+        StringStreamBuf() :_out(nullptr) {}
+        void bind(std::string *out) { _out = out; }
+    protected:
+        int_type overflow(int_type c) override
+        {
+            if(c != traits_type::eof()) _out->push_back((char)c);
+            return c;
+        }
+        std::streamsize xsputn(const char *s, std::streamsize n) override
+        {
+            _out->append(s, n);
+            return n;
+        }
+    private:
+        std::string *_out;
+    };
+
     class Formatter
     {
     public:
@@ -143,8 +207,9 @@ namespace logSys
         {
             assert(parsePattern());
         }
+        virtual ~Formatter() = default;
         // 将日志消息格式化
-        void format(std::ostream &os, const LogMsg &msg)
+        virtual void format(std::ostream &os, const LogMsg &msg)
         {
             for(auto & it : _items)
             {
@@ -152,12 +217,34 @@ namespace logSys
             }
         }
         // 将日志消息格式化
-        std::string format(const LogMsg &msg)
+        virtual std::string format(const LogMsg &msg)
         {
-            std::stringstream ss;
-            format(ss, msg);
-            return ss.str();
+            std::string out;
+            format(out, msg);
+            return out;
         }
+        // 将日志消息格式化后追加到out, out可以复用容量
+        virtual void format(std::string &out, const LogMsg &msg)
+        {
+            struct LocalStream
+            {
+                LocalStream() :_os(&_buf) {}
+                StringStreamBuf _buf;
+                std::ostream _os;
+            };
+            static thread_local LocalStream ls;
+            ls._buf.bind(&out);
+            format(ls._os, msg);
+            ls._buf.bind(nullptr);
+        }
+        // 模式串解析后的子项: key为格式化字符(如"p"、"d"), 原始字符串的key为空, value为参数或原始字符串
+        // 供日志分析工具按同一模式定位行中的字段
+        struct LayoutItem
+        {
+            std::string _key;
+            std::string _value;
+        };
+        const std::vector<LayoutItem> &layout() const { return _layout; }
     private:
         bool parsePattern()
         {
@@ -171,7 +258,7 @@ namespace logSys
                 if(pos == std::string::npos)
                 {
                     value = _pattern.substr(index);
-                    _items.push_back(createItem(key, value));
+                    addItem(key, value);
                     break;
                 }
                 else if(pos == index)
@@ -181,7 +268,8 @@ namespace logSys
                 else
                 {
                     value = _pattern.substr(index, pos - index);
-                    _items.push_back(createItem(key, value));
+                    addItem(key, value);
+                    value.clear(); // 原始字符串不能当作后面格式化子项的参数
                 }
 
                 // 走到%的下一个字符
@@ -194,7 +282,7 @@ namespace logSys
                 // 如果是%%代表原始字符串%
                 if(_pattern[index] == '%')
                 {
-                    _items.push_back(createItem("", "%"));
+                    addItem("", "%");
                     index++;
                     continue;
                 }
@@ -215,19 +303,24 @@ namespace logSys
                         else 
                         {
                             value = _pattern.substr(index, pos - index);
-                            _items.push_back(createItem(key, value));
+                            addItem(key, value);
                             index = pos + 1;
                         }
                     }
                     else
                     {
-                        _items.push_back(createItem(key, value));
+                        addItem(key, value);
                         index++;
                     }
                 }
             }
             return true;
         }
+        void addItem(const std::string &key, const std::string &value)
+        {
+            _items.push_back(createItem(key, value));
+            _layout.push_back(LayoutItem{ key, value });
+        }
         FormatItem::ptr createItem(const std::string &key, const std::string &value)
         {
             // key为空表示原始字符串, 原始字符串在value
@@ -237,15 +330,26 @@ namespace logSys
             }
             // %d{%H:%M:%S}%T%t%T[%p]%T[%c]%T%f:%l%T%m%n
             // 正常格式化字符
-            if(key == "d") return std::make_shared<TimeFormatItem>(value);
+            if(key == "d") return std::make_shared<TimeFormatItem>(value.empty() ? "%H:%M:%S" : value);
             else if(key == "T") return std::make_shared<TabFormatItem>();
             else if(key == "t") return std::make_shared<ThreadFormatItem>();
+            else if(key == "N") return std::make_shared<ThreadNameFormatItem>();
             else if(key == "p") return std::make_shared<LevelFormatItem>();
             else if(key == "c") return std::make_shared<NameFormatItem>();
             else if(key == "f") return std::make_shared<FileFormatItem>();
             else if(key == "l") return std::make_shared<LineFormatItem>();
-            else if(key == "m") return std::make_shared<MsgFormatItem>();
+            else if(key == "m")
+            {
+                if(!value.empty() && value != "escape")
+                {
+                    std::cout << "不支持的消息选项: " << value << "\n";
+                    abort();
+                }
+                return std::make_shared<MsgFormatItem>(value == "escape");
+            }
             else if(key == "n") return std::make_shared<NLineFormatItem>();
+            else if(key == "k") return std::make_shared<FieldsFormatItem>();
+            else if(key == "X") return std::make_shared<MdcFormatItem>(value);
             else
             {
                 std::cout << "没有找到合适的格式化符: " << key << "\n";
@@ -255,5 +359,265 @@ namespace logSys
     private:
         std::string _pattern; // 格式化模式
         std::vector<FormatItem::ptr> _items; // 格式化子项
+        std::vector<LayoutItem> _layout; // 与_items一一对应的解析结果
     };
+
+    // 结构化格式化器基类: 不经过ostream, 直接编码到输出字符串
+    class StructFormatter : public Formatter
+    {
+    public:
+        StructFormatter(const std::string &time_format)
+        :Formatter(""), _time_format(time_format)
+        {}
+        void format(std::ostream &os, const LogMsg &msg) override
+        {
+            std::string out;
+            encode(out, msg);
+            os.write(out.c_str(), out.size());
+        }
+        std::string format(const LogMsg &msg) override
+        {
+            std::string out;
+            out.reserve(128 + msg._payload_len + msg._field_count * 32);
+            encode(out, msg);
+            return out;
+        }
+        void format(std::string &out, const LogMsg &msg) override
+        {
+            encode(out, msg);
+        }
+        // 追加编码后的日志到out
+        virtual void encode(std::string &out, const LogMsg &msg) = 0;
+    protected:
+        // 同一秒内的时间字符串只生成一次, 每个线程各自缓存
+        void appendTime(std::string &out, time_t t)
+        {
+            struct TimeCache
+            {
+                const StructFormatter *_owner;
+                time_t _time;
+                size_t _len;
+                char _buf[64];
+            };
+            static thread_local TimeCache cache = { nullptr, 0, 0, { 0 } };
+            if(cache._owner != this || cache._time != t)
+            {
+                struct tm tl;
+                localtime_r(&t, &tl);
+                cache._len = strftime(cache._buf, sizeof(cache._buf), _time_format.c_str(), &tl);
+                cache._owner = this;
+                cache._time = t;
+            }
+            out.append(cache._buf, cache._len);
+        }
+        // 与%t输出一致, 使用线程缓存好的字符串
+        static void appendThread(std::string &out, const LogMsg &msg)
+        {
+            if(msg._thread != nullptr) out.append(msg._thread->_tid_str);
+            else util::Number::append(out, (int64_t)msg._tid);
+        }
+        // 与固定字段同名的上下文键加上"mdc."前缀, 避免同一条记录中出现重复的键
+        static bool reservedKey(const std::string &key)
+        {
+            static const char *const names[] = { "time", "level", "logger", "thread", "thread_name", "file", "line", "msg" };
+            for(const char *name : names)
+            {
+                if(key == name) return true;
+            }
+            return false;
+        }
+    protected:
+        std::string _time_format;
+    };
+
+    // JSON格式化器, 每条日志输出一行JSON对象
+    class JsonFormatter : public StructFormatter
+    {
+    public:
+        using ptr = std::shared_ptr<JsonFormatter>;
+        JsonFormatter(const std::string &time_format = "%Y-%m-%d %H:%M:%S")
+        :StructFormatter(time_format)
+        {}
+        void encode(std::string &out, const LogMsg &msg) override
+        {
+            out.append("{\"time\":\"", 9);
+            appendTime(out, msg._ctime);
+            out.append("\",\"level\":\"", 11);
+            out.append(LogLevel::toString(msg._level));
+            out.append("\",\"logger\":\"", 12);
+            util::Escape::appendJson(out, msg._name, strlen(msg._name));
+            out.append("\",\"thread\":", 11);
+            appendThread(out, msg);
+            if(msg._thread != nullptr && !msg._thread->_name.empty())
+            {
+                out.append(",\"thread_name\":\"", 16);
+                util::Escape::appendJson(out, msg._thread->_name.c_str(), msg._thread->_name.size());
+                out.push_back('"');
+            }
+            out.append(",\"file\":\"", 9);
+            util::Escape::appendJson(out, msg._file, strlen(msg._file));
+            out.append("\",\"line\":", 9);
+            util::Number::append(out, (uint64_t)msg._line);
+            out.append(",\"msg\":\"", 8);
+            util::Escape::appendJson(out, msg._payload, msg._payload_len);
+            out.push_back('"');
+            // 诊断上下文属于创建记录的线程, 跨线程格式化的记录(如飞行记录)不输出
+            if(msg._thread != nullptr) out.append(MDC::rendered(MDC::Style::JSON, [](std::string &text, const MDC::Entries &entries){
+                for(auto &e : entries)
+                {
+                    text.append(",\"", 2);
+                    if(reservedKey(e.first)) text.append("mdc.", 4);
+                    util::Escape::appendJson(text, e.first.c_str(), e.first.size());
+                    text.append("\":\"", 3);
+                    util::Escape::appendJson(text, e.second.c_str(), e.second.size());
+                    text.push_back('"');
+                }
+            }));
+            for(size_t i = 0; i < msg._field_count; i++)
+            {
+                const LogField &field = msg._fields[i];
+                out.append(",\"", 2);
+                util::Escape::appendJson(out, field._key, strlen(field._key));
+                out.append("\":", 2);
+                appendValue(out, field);
+            }
+            out.append("}\n", 2);
+        }
+        static void appendValue(std::string &out, const LogField &field)
+        {
+            switch(field._type)
+            {
+                case LogField::Type::INT: util::Number::append(out, field._value._i); break;
+                case LogField::Type::UINT: util::Number::append(out, field._value._u); break;
+                case LogField::Type::DOUBLE:
+                    // JSON没有NaN和无穷大
+                    if(std::isfinite(field._value._d)) util::Number::append(out, field._value._d);
+                    else out.append("null", 4);
+                    break;
+                case LogField::Type::BOOL:
+                    if(field._value._b) out.append("true", 4);
+                    else out.append("false", 5);
+                    break;
+                case LogField::Type::STRING:
+                    out.push_back('"');
+                    util::Escape::appendJson(out, field._str, field._len);
+                    out.push_back('"');
+                    break;
+            }
+        }
+    };
+
+    // logfmt格式化器, 每条日志输出一行 key=value
+    class LogfmtFormatter : public StructFormatter
+    {
+    public:
+        using ptr = std::shared_ptr<LogfmtFormatter>;
+        LogfmtFormatter(const std::string &time_format = "%Y-%m-%dT%H:%M:%S")
+        :StructFormatter(time_format)
+        {}
+        void encode(std::string &out, const LogMsg &msg) override
+        {
+            out.append("time=", 5);
+            appendTime(out, msg._ctime);
+            out.append(" level=", 7);
+            out.append(LogLevel::toString(msg._level));
+            out.append(" logger=", 8);
+            appendString(out, msg._name, strlen(msg._name));
+            out.append(" thread=", 8);
+            appendThread(out, msg);
+            if(msg._thread != nullptr && !msg._thread->_name.empty())
+            {
+                out.append(" thread_name=", 13);
+                appendString(out, msg._thread->_name.c_str(), msg._thread->_name.size());
+            }
+            out.append(" file=", 6);
+            appendString(out, msg._file, strlen(msg._file));
+            out.append(" line=", 6);
+            util::Number::append(out, (uint64_t)msg._line);
+            out.append(" msg=", 5);
+            appendString(out, msg._payload, msg._payload_len);
+            if(msg._thread != nullptr) out.append(mdcText());
+            appendFields(out, msg);
+            out.push_back('\n');
+        }
+        // 每个字段前带一个空格
+        static void appendFields(std::string &out, const LogMsg &msg)
+        {
+            for(size_t i = 0; i < msg._field_count; i++)
+            {
+                const LogField &field = msg._fields[i];
+                out.push_back(' ');
+                appendKey(out, field._key, strlen(field._key));
+                out.push_back('=');
+                if(field._type == LogField::Type::STRING) appendString(out, field._str, field._len);
+                else JsonFormatter::appendValue(out, field);
+            }
+        }
+        // 当前线程的诊断上下文, 每项前带一个空格
+        static const std::string &mdcText()
+        {
+            return MDC::rendered(MDC::Style::LOGFMT, [](std::string &text, const MDC::Entries &entries){
+                for(auto &e : entries)
+                {
+                    text.push_back(' ');
+                    if(reservedKey(e.first)) text.append("mdc.", 4);
+                    appendKey(text, e.first.c_str(), e.first.size());
+                    text.push_back('=');
+                    appendString(text, e.second.c_str(), e.second.size());
+                }
+            });
+        }
+        // logfmt的键不能加引号, 空格、=、引号、反斜杠和控制字符替换为'_', 空键写作'_'
+        static void appendKey(std::string &out, const char *key, size_t len)
+        {
+            if(len == 0)
+            {
+                out.push_back('_');
+                return;
+            }
+            size_t start = out.size();
+            out.append(key, len);
+            for(size_t i = start; i < out.size(); i++)
+            {
+                unsigned char c = (unsigned char)out[i];
+                if(c <= ' ' || c == '=' || c == '"' || c == '\\' || c == 0x7f) out[i] = '_';
+            }
+        }
+        // 含空格、=、引号或控制字符时加引号并转义
+        static void appendString(std::string &out, const char *data, size_t len)
+        {
+            bool quote = len == 0 || util::Escape::jsonFind(data, len) != len
+                      || memchr(data, ' ', len) != nullptr || memchr(data, '=', len) != nullptr;
+            if(!quote)
+            {
+                out.append(data, len);
+                return;
+            }
+            out.push_back('"');
+            util::Escape::appendJson(out, data, len);
+            out.push_back('"');
+        }
+    };
+
+    inline void FieldsFormatItem::format(std::ostream &os, const LogMsg &msg)
+    {
+        if(msg._field_count == 0) return;
+        std::string out;
+        LogfmtFormatter::appendFields(out, msg);
+        os.write(out.c_str() + 1, out.size() - 1); // 去掉开头的空格
+    }
+
+    inline void MdcFormatItem::format(std::ostream &os, const LogMsg &msg)
+    {
+        // 诊断上下文属于创建记录的线程, 跨线程格式化的记录(如飞行记录)不输出
+        if(msg._thread == nullptr) return;
+        if(!_key.empty())
+        {
+            const std::string *value = MDC::get(_key);
+            if(value != nullptr) os.write(value->data(), value->size());
+            return;
+        }
+        const std::string &text = LogfmtFormatter::mdcText();
+        if(!text.empty()) os.write(text.data() + 1, text.size() - 1); // 去掉开头的空格
+    }
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#pragma once
+#include "util.hpp"
+#include "level.hpp"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+/*
+    日志文件的旁路索引
+        1. 文件落地方向开启索引后, 每写满一块(默认64KB)在 <日志文件>.idx 追加一个定长条目:
+           块的起始偏移、长度、块内记录的最早/最晚时间、块内出现过的等级位图
+        2. 条目只在块写满、滚动和关闭时写出, 每块一次write, 由落地方向的写入线程维护
+        3. 查询时按时间区间和等级过滤条目, 得到需要扫描的字节区间; 没有被索引覆盖的部分(空洞和未写满的尾块)总是需要扫描
+        4. 异步日志器按批次汇总元数据, 块的时间和等级是块内批次的并集, 只会多选不会漏选
+*/
+namespace logSys
+{
+    #define INDEX_BLOCK_SIZE (64 * 1024) // 每个索引条目覆盖的最少字节数
+    // 一段日志数据的元数据: 时间范围和出现过的等级
+    struct RecordMeta
+    {
+        RecordMeta() :_min_time(0), _max_time(0), _levels(0) {}
+        static uint32_t levelBit(LogLevel::Level level) { return 1u << (int)level; }
+        // 不低于level的所有等级
+        static uint32_t atLeast(LogLevel::Level level) { return ~(levelBit(level) - 1); }
+        bool empty() const { return _levels == 0; }
+        void add(time_t t, LogLevel::Level level)
+        {
+            if(empty() || t < _min_time) _min_time = t;
+            if(empty() || t > _max_time) _max_time = t;
+            _levels |= levelBit(level);
+        }
+        void merge(const RecordMeta &other)
+        {
+            if(other.empty()) return;
+            if(empty() || other._min_time < _min_time) _min_time = other._min_time;
+            if(empty() || other._max_time > _max_time) _max_time = other._max_time;
+            _levels |= other._levels;
+        }
+        time_t _min_time;
+        time_t _max_time;
+        uint32_t _levels; // 第i位表示出现过等级i, 0表示没有元数据
+    };
+    // 索引文件头和条目, 按本机字节序写入
+    struct IndexHeader
+    {
+        char _magic[8];
+        uint32_t _version;
+        uint32_t _entry_size;
+    };
+    struct IndexEntry
+    {
+        uint64_t _offset;
+        uint64_t _length;
+        int64_t _min_time;
+        int64_t _max_time;
+        uint32_t _levels; // 0表示块内的数据没有元数据, 查询时总是选中
+        uint32_t _reserved;
+    };
+    // 索引写入器, 调用者负责串行化
+    class IndexWriter
+    {
+    public:
+        IndexWriter() :_fd(-1), _offset(0), _block_start(0) {}
+        ~IndexWriter() { close(); }
+        // 日志文件对应的索引文件名, 压缩后的分段沿用压缩前的索引
+        static std::string pathFor(const std::string &log_path)
+        {
+            std::string path = log_path;
+            if(path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0) path.resize(path.size() - 3);
+            return path + ".idx";
+        }
+        // 开始索引log_path, offset为日志文件当前的长度; 之前打开的索引先关闭
+        // 日志文件为空时已有的索引属于别的数据, 清空重建
+        bool open(const std::string &log_path, uint64_t offset)
+        {
+            close();
+            std::string path = pathFor(log_path);
+            int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+            _fd = ::open(path.c_str(), offset == 0 ? flags | O_TRUNC : flags, 0644);
+            if(_fd < 0)
+            {
+                std::cout << "打开日志索引失败: " << path << std::endl;
+                return false;
+            }
+            struct stat st;
+            if(fstat(_fd, &st) == 0 && st.st_size == 0)
+            {
+                IndexHeader header;
+                memcpy(header._magic, "LSYSIDX", 8);
+                header._version = 1;
+                header._entry_size = sizeof(IndexEntry);
+                util::File::writeAll(_fd, (const char *)&header, sizeof(header));
+            }
+            _offset = _block_start = offset;
+            _block = RecordMeta();
+            return true;
+        }
+        // 日志文件追加了len字节, 写满一块时写出条目
+        void add(const RecordMeta &meta, size_t len)
+        {
+            if(_fd < 0) return;
+            _block.merge(meta);
+            _offset += len;
+            if(_offset - _block_start >= INDEX_BLOCK_SIZE) flush();
+        }
+        // 日志文件写入失败后按实际长度offset重新对齐, 没有写成功的数据不属于任何块
+        void resync(uint64_t offset)
+        {
+            if(_fd < 0) return;
+            flush();
+            _offset = _block_start = offset;
+        }
+        // 写出未满的块, 只在滚动和关闭时调用, 平时未满的尾块由查询方扫描
+        void flush()
+        {
+            if(_fd < 0 || _offset == _block_start) return;
+            IndexEntry entry;
+            entry._offset = _block_start;
+            entry._length = _offset - _block_start;
+            entry._min_time = _block._min_time;
+            entry._max_time = _block._max_time;
+            entry._levels = _block._levels;
+            entry._reserved = 0;
+            util::File::writeAll(_fd, (const char *)&entry, sizeof(entry));
+            _block_start = _offset;
+            _block = RecordMeta();
+        }
+        void close()
+        {
+            if(_fd < 0) return;
+            flush();
+            ::close(_fd);
+            _fd = -1;
+        }
+    private:
+        int _fd;
+        uint64_t _offset;      // 日志文件当前长度
+        uint64_t _block_start; // 当前块的起始偏移
+        RecordMeta _block;     // 当前块的元数据
+    };
+    // 索引查询
+    class LogIndex
+    {
+    public:
+        // 需要扫描的字节区间, _length为UINT64_MAX表示到文件末尾
+        struct Range
+        {
+            uint64_t _offset;
+            uint64_t _length;
+        };
+        // 读取索引条目, 索引不存在或格式不对时返回false
+        static bool load(const std::string &log_path, std::vector<IndexEntry> &entries)
+        {
+            std::string path = IndexWriter::pathFor(log_path);
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0) return false;
+            IndexHeader header;
+            bool ok = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+                   && memcmp(header._magic, "LSYSIDX", 8) == 0
+                   && header._entry_size == sizeof(IndexEntry);
+            IndexEntry buf[256];
+            ssize_t n;
+            while(ok && (n = read(fd, buf, sizeof(buf))) > 0)
+            {
+                // 崩溃时可能留下不完整的最后一条, 丢弃
+                entries.insert(entries.end(), buf, buf + n / sizeof(IndexEntry));
+                if(n % sizeof(IndexEntry) != 0) break;
+            }
+            ::close(fd);
+            return ok;
+        }
+        // 时间在[from, to]内且等级命中level_mask的记录可能所在的区间, 相邻区间合并
+        // 没有索引时返回整个文件
+        static std::vector<Range> query(const std::string &log_path, time_t from, time_t to,
+                                        uint32_t level_mask = ~0u)
+        {
+            std::vector<Range> ranges;
+            std::vector<IndexEntry> entries;
+            load(log_path, entries);
+            uint64_t cursor = 0;
+            for(auto &e : entries)
+            {
+                if(e._offset + e._length <= cursor) continue;
+                // 索引没有覆盖的空洞(如开启索引前写入的数据)需要扫描
+                if(e._offset > cursor) append(ranges, cursor, e._offset - cursor);
+                bool hit = e._levels == 0
+                        || ((e._levels & level_mask) != 0 && e._max_time >= from && e._min_time <= to);
+                if(hit) append(ranges, e._offset, e._length);
+                cursor = e._offset + e._length;
+            }
+            append(ranges, cursor, UINT64_MAX);
+            return ranges;
+        }
+    private:
+        static void append(std::vector<Range> &ranges, uint64_t offset, uint64_t length)
+        {
+            if(!ranges.empty() && ranges.back()._length != UINT64_MAX
+               && ranges.back()._offset + ranges.back()._length == offset)
+            {
+                ranges.back()._length = length == UINT64_MAX ? UINT64_MAX : ranges.back()._length + length;
+                return;
+            }
+            ranges.push_back(Range{ offset, length });
+        }
+    };
+}
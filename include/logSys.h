@@ -1,5 +1,6 @@
 #pragma once
 #include "logger.hpp"
+#include "stream.hpp"
 namespace logSys
 {
     Logger::ptr getLogger(const std::string &name)
@@ -11,16 +12,51 @@ namespace logSys
         return LoggerManager::getInstance().rootLogger();
     }
     // 日志系统全局接口
+    // 编译期去掉__FILE__中的目录, 只保留文件名
+    #define LOGSYS_FILE (__FILE__ + std::integral_constant<size_t, logSys::util::basenameOffset(__FILE__)>::value)
     // 用宏函数实现代理模式代理接口
-    #define debug(fmt, ...) debug(__FILE__, __LINE__, fmt, #__VA_ARGS__)
-    #define info(fmt, ...) info(__FILE__, __LINE__, fmt, #__VA_ARGS__)
-    #define warn(fmt, ...) warn(__FILE__, __LINE__, fmt, #__VA_ARGS__)
-    #define error(fmt, ...) error(__FILE__, __LINE__, fmt, #__VA_ARGS__)
-    #define fatal(fmt, ...) fatal(__FILE__, __LINE__, fmt, #__VA_ARGS__)
+    #define debug(fmt, ...) debug(LOGSYS_FILE, __LINE__, fmt, ##__VA_ARGS__)
+    #define info(fmt, ...) info(LOGSYS_FILE, __LINE__, fmt, ##__VA_ARGS__)
+    #define warn(fmt, ...) warn(LOGSYS_FILE, __LINE__, fmt, ##__VA_ARGS__)
+    #define error(fmt, ...) error(LOGSYS_FILE, __LINE__, fmt, ##__VA_ARGS__)
+    #define fatal(fmt, ...) fatal(LOGSYS_FILE, __LINE__, fmt, ##__VA_ARGS__)
 
-    #define LOGDEBUG(fmt, ...) rootLogger()->debug(fmt, #__VA_ARGS__)
-    #define LOGINFO(fmt, ...) rootLogger()->info(fmt, #__VA_ARGS__)
-    #define LOGWARN(fmt, ...) rootLogger()->warn(fmt, #__VA_ARGS__)
-    #define LOGERROR(fmt, ...) rootLogger()->error(fmt, #__VA_ARGS__)
-    #define LOGFATAL(fmt, ...) rootLogger()->fatal(fmt, #__VA_ARGS__)
+    #define LOGDEBUG(fmt, ...) rootLogger()->debug(fmt, ##__VA_ARGS__)
+    #define LOGINFO(fmt, ...) rootLogger()->info(fmt, ##__VA_ARGS__)
+    #define LOGWARN(fmt, ...) rootLogger()->warn(fmt, ##__VA_ARGS__)
+    #define LOGERROR(fmt, ...) rootLogger()->error(fmt, ##__VA_ARGS__)
+    #define LOGFATAL(fmt, ...) rootLogger()->fatal(fmt, ##__VA_ARGS__)
+
+    // 结构化日志接口, 字段写作 {"key", value}
+    // LOGKV(logger, logSys::LogLevel::Level::INFO, "login", {"uid", 42}, {"ok", true});
+    #define LOGKV(logger, level, msg, ...) (logger)->logFields(level, LOGSYS_FILE, __LINE__, msg, { __VA_ARGS__ })
+
+    // {}格式化接口, 格式串必须是字面量, 占位符个数与参数个数在编译期检查
+    // 格式串在每个调用点只解析一次
+    // LOGF_INFO(logger, "user {} login from {}, cost {}ms", uid, ip, 1.5);
+    #define LOGF(logger, level, fmt, ...) \
+        do \
+        { \
+            static_assert(logSys::util::Format::placeholders(fmt) == \
+                          decltype(logSys::util::Format::argCount(__VA_ARGS__))::value, \
+                          "格式串中{}的个数与参数个数不一致"); \
+            static const logSys::util::Format::Pattern<logSys::util::Format::placeholders(fmt)> logsys_pattern(fmt); \
+            (logger)->logFmt(level, LOGSYS_FILE, __LINE__, logsys_pattern, ##__VA_ARGS__); \
+        } while (0)
+    #define LOGF_DEBUG(logger, fmt, ...) LOGF(logger, logSys::LogLevel::Level::DEBUG, fmt, ##__VA_ARGS__)
+    #define LOGF_INFO(logger, fmt, ...) LOGF(logger, logSys::LogLevel::Level::INFO, fmt, ##__VA_ARGS__)
+    #define LOGF_WARN(logger, fmt, ...) LOGF(logger, logSys::LogLevel::Level::WARNING, fmt, ##__VA_ARGS__)
+    #define LOGF_ERROR(logger, fmt, ...) LOGF(logger, logSys::LogLevel::Level::ERROR, fmt, ##__VA_ARGS__)
+    #define LOGF_FATAL(logger, fmt, ...) LOGF(logger, logSys::LogLevel::Level::FATAL, fmt, ##__VA_ARGS__)
+
+    // 流式接口, 等级未开启时不对<<右侧的操作数求值
+    // LOG_INFO(logger) << "x=" << x;
+    #define LOG_STREAM(logger, level) \
+        !(logger)->enabled(level) ? (void)0 \
+            : logSys::LogStreamVoidify() & logSys::LogStream(*(logger), level, LOGSYS_FILE, __LINE__)
+    #define LOG_DEBUG(logger) LOG_STREAM(logger, logSys::LogLevel::Level::DEBUG)
+    #define LOG_INFO(logger) LOG_STREAM(logger, logSys::LogLevel::Level::INFO)
+    #define LOG_WARN(logger) LOG_STREAM(logger, logSys::LogLevel::Level::WARNING)
+    #define LOG_ERROR(logger) LOG_STREAM(logger, logSys::LogLevel::Level::ERROR)
+    #define LOG_FATAL(logger) LOG_STREAM(logger, logSys::LogLevel::Level::FATAL)
 }
\ No newline at end of file
@@ -3,16 +3,37 @@
 #include "level.hpp"
 #include "formatter.hpp"
 #include "sink.hpp"
+#include "shmring.hpp"
+#include "netsink.hpp"
 #include "message.hpp"
 #include "looper.hpp"
+#include "crash.hpp"
+#include "recorder.hpp"
+#include "fmt.hpp"
 #include <cstdarg>
 #include <mutex>
 #include <atomic>
 #include <unordered_map>
+#include <set>
+#include <thread>
+#include <condition_variable>
+#include <initializer_list>
 // 抽象日志器类
 namespace logSys
 {
-    
+    // 日志器使用一个落地方向的方式: 等级和格式化器属于日志器, 同一个落地方向被多个日志器共用时互不影响
+    struct SinkBinding
+    {
+        SinkBinding(const LogSink::ptr &sink, LogLevel::Level level = LogLevel::Level::DEBUG,
+                    const Formatter::ptr &formatter = Formatter::ptr())
+            : _sink(sink), _level(level), _formatter(formatter)
+        {
+        }
+        LogSink::ptr _sink;
+        LogLevel::Level _level;    // 低于等级的日志不会为这个落地方向格式化
+        Formatter::ptr _formatter; // 为空时使用日志器的格式化器
+    };
+
     class Logger
     {
     public:
@@ -20,89 +41,279 @@ namespace logSys
         Logger(const std::string &logger_name,
                LogLevel::Level limit_level,
                const std::shared_ptr<Formatter> &formatter,
-               std::vector<LogSink::ptr> sinks)
+               const std::vector<SinkBinding> &sinks)
             : _logger_name(logger_name),
-              _limit_level(limit_level), _formatter(formatter),
-              _sinks(sinks.begin(), sinks.end())
-        {}
+              _limit_level(limit_level), _formatter(formatter)
+        {
+            for (auto &binding : sinks)
+                _sinks.push_back(binding._sink);
+            buildGroups(sinks);
+        }
         virtual ~Logger() = default;
         std::string getName() const{ return _logger_name; };
         void debug(const char *file, size_t line, const char *fmt, ...)
         {
-            if (LogLevel::Level::DEBUG < _limit_level)
+            if (LogLevel::Level::DEBUG < _limit_level && !_recorder)
                 return;
             va_list al;
             va_start(al, fmt);
-            std::string msg = serialize(LogLevel::Level::DEBUG, file, line, fmt, al);
+            logv(LogLevel::Level::DEBUG, file, line, fmt, al);
             va_end(al);
-            log(msg);
         }
         void info(const char *file, size_t line, const char *fmt, ...)
         {
-            if (LogLevel::Level::INFO < _limit_level)
+            if (LogLevel::Level::INFO < _limit_level && !_recorder)
                 return;
             va_list al;
             va_start(al, fmt);
-            std::string msg = serialize(LogLevel::Level::INFO, file, line, fmt, al);
+            logv(LogLevel::Level::INFO, file, line, fmt, al);
             va_end(al);
-            log(msg);
         }
         void warn(const char *file, size_t line, const char *fmt, ...)
         {
-            if (LogLevel::Level::WARNING < _limit_level)
+            if (LogLevel::Level::WARNING < _limit_level && !_recorder)
                 return;
             va_list al;
             va_start(al, fmt);
-            std::string msg = serialize(LogLevel::Level::WARNING, file, line, fmt, al);
+            logv(LogLevel::Level::WARNING, file, line, fmt, al);
             va_end(al);
-            log(msg);
         }
         void error(const char *file, size_t line, const char *fmt, ...)
         {
-            if (LogLevel::Level::ERROR < _limit_level)
+            if (LogLevel::Level::ERROR < _limit_level && !_recorder)
                 return;
             va_list al;
             va_start(al, fmt);
-            std::string msg = serialize(LogLevel::Level::ERROR, file, line, fmt, al);
+            logv(LogLevel::Level::ERROR, file, line, fmt, al);
             va_end(al);
-            log(msg);
         }
         void fatal(const char *file, size_t line, const char *fmt, ...)
         {
-            if (LogLevel::Level::FATAL < _limit_level)
+            if (LogLevel::Level::FATAL < _limit_level && !_recorder)
                 return;
             va_list al;
             va_start(al, fmt);
-            std::string msg = serialize(LogLevel::Level::FATAL, file, line, fmt, al);
+            logv(LogLevel::Level::FATAL, file, line, fmt, al);
             va_end(al);
-            log(msg);
+        }
+        // 结构化日志: 字段保持类型交给格式化器编码, 不在调用处拼接字符串
+        void logFields(LogLevel::Level level, const char *file, size_t line, const char *msg,
+                       std::initializer_list<LogField> fields)
+        {
+            if (level < _limit_level)
+            {
+                if (_recorder && _recorder->shouldRecord(level))
+                    _recorder->record(level, file, line, msg);
+                return;
+            }
+            uint64_t start = monoNanos();
+            beginRecord();
+            LogMsg lm(level, line, file, _logger_name.c_str(), msg);
+            lm._fields = fields.begin();
+            lm._field_count = fields.size();
+            emit(lm, start);
+            endRecord();
+        }
+        // {}格式化接口, 参数按类型直接编码, 占位符个数由LOGF宏在编译期检查
+        template<typename ...Args>
+        void logFmt(LogLevel::Level level, const char *file, size_t line, const char *fmt, const Args &...args)
+        {
+            if (!enabled(level))
+                return;
+            uint64_t start = monoNanos();
+            util::ThreadBuffer buf;
+            util::Format::append(buf.str(), fmt, args...);
+            commit(level, file, line, buf.str().data(), buf.str().size(), start);
+        }
+        // LOGF宏使用的版本, 格式串已在调用点解析好
+        template<size_t N, typename ...Args>
+        void logFmt(LogLevel::Level level, const char *file, size_t line, const util::Format::Pattern<N> &fmt, const Args &...args)
+        {
+            if (!enabled(level))
+                return;
+            uint64_t start = monoNanos();
+            util::ThreadBuffer buf;
+            util::Format::append(buf.str(), fmt, args...);
+            commit(level, file, line, buf.str().data(), buf.str().size(), start);
+        }
+        // 该等级的日志是否需要生成消息内容(输出或写入飞行记录器)
+        bool enabled(LogLevel::Level level) const
+        {
+            return level >= _limit_level || (_recorder && _recorder->shouldRecord(level));
+        }
+        // 提交已经生成的消息内容, start为调用开始的时间
+        void commit(LogLevel::Level level, const char *file, size_t line, const char *payload, size_t len, uint64_t start)
+        {
+            if (level < _limit_level)
+            {
+                if (_recorder && _recorder->shouldRecord(level))
+                    _recorder->record(level, file, line, payload, len);
+                return;
+            }
+            beginRecord();
+            LogMsg lm(level, line, file, _logger_name.c_str(), payload, len);
+            emit(lm, start);
+            endRecord();
+        }
+        // 设置飞行记录器, 需要在日志器开始使用前设置
+        void setRecorder(const FlightRecorder::ptr &recorder) { _recorder = recorder; }
+        const std::vector<LogSink::ptr> &sinks() const { return _sinks; }
+        // 收集日志器自身的指标, 落地方向的指标由LoggerManager去重后收集
+        virtual void collectMetrics(MetricsSnapshot &snap) const
+        {
+            MetricsSnapshot::Labels labels = { { "logger", _logger_name } };
+            snap.counter("logsys_logger_records_total", "Records emitted by the logger", labels, _records.value());
+            snap.counter("logsys_logger_bytes_total", "Formatted bytes emitted by the logger", labels, _bytes.value());
+            snap.histogram("logsys_logger_call_seconds", "Time spent inside a logging call on the caller thread", labels, _call_latency);
         }
 
     protected:
-        // 
-        std::string serialize(LogLevel::Level level, const char *file, size_t line, const char *fmt, va_list al)
+        void logv(LogLevel::Level level, const char *file, size_t line, const char *fmt, va_list al)
         {
+            if (level < _limit_level)
+            {
+                // 低于输出等级的日志只写入飞行记录器
+                if (_recorder && _recorder->shouldRecord(level))
+                    _recorder->record(level, file, line, fmt, al);
+                return;
+            }
+            uint64_t start = monoNanos();
             char *buffer = nullptr;
-            std::string str;
-            if (vasprintf(&buffer, fmt, al) < 0)
+            int len = vasprintf(&buffer, fmt, al);
+            if (len < 0)
             {
                 std::cout << "格式化字符串失败" << std::endl;
+                return;
             }
-            str += buffer;
+            beginRecord();
+            LogMsg lm(level, line, file, _logger_name.c_str(), buffer, len);
+            emit(lm, start);
+            endRecord();
             free(buffer);
-            LogMsg lm(level, line, file, _logger_name, str);
-            std::string msg = _formatter->format(lm);
-            return msg;
         }
-        // 抽象实际落地方式
-        virtual void log(const std::string &msg) = 0;
+        // 每个不同的格式化器只格式化一次, 输出串使用线程私有缓冲区
+        void emit(const LogMsg &lm, uint64_t start)
+        {
+            FlightRecorder::Range history(0, 0);
+            if (_recorder && lm._level >= _recorder->triggerLevel())
+                history = _recorder->claim();
+            bool with_history = history.first != history.second;
+            size_t bytes = 0;
+            for (auto &fg : _format_groups)
+            {
+                if (lm._level < fg._level)
+                    continue;
+                util::ThreadBuffer buf;
+                std::string &msg = buf.str();
+                fg._formatter->format(msg, lm);
+                if (!with_history)
+                    bytes += msg.size();
+                for (size_t group : fg._groups)
+                {
+                    const SinkGroup &sg = _sink_groups[group];
+                    if (lm._level < sg._level)
+                        continue;
+                    if (!with_history)
+                    {
+                        log(group, msg, lm, false);
+                        continue;
+                    }
+                    // 先输出触发日志之前的记录, 和触发日志一起落地保证顺序
+                    // 历史按每组自己的等级过滤, 同一格式化器下等级更高的组不会收到低等级的历史
+                    util::ThreadBuffer hbuf;
+                    std::string &out = hbuf.str();
+                    _recorder->dump(history, *fg._formatter, _logger_name.c_str(), out, sg._level);
+                    out += msg;
+                    log(group, out, lm, true);
+                    bytes += out.size();
+                }
+            }
+            account(bytes, start);
+        }
+        void account(size_t bytes, uint64_t start)
+        {
+            _records.add();
+            _bytes.add(bytes);
+            _call_latency.record(monoNanos() - start);
+        }
+        // 一条记录创建之前和落地之后调用, 两次调用之间创建的LogMsg的_mono不早于begin的时刻
+        // 有序异步日志器在这里公布时间戳下界, 让工作线程等待正在格式化的记录
+        virtual void beginRecord() {}
+        virtual void endRecord() {}
+        // 抽象实际落地方式, 把格式化后的msg写到第group组落地方向
+        // lm为对应的日志消息, 等级供需要区分等级的落地方向(如控制台上色)使用; with_history表示msg前面带有飞行记录
+        virtual void log(size_t group, const std::string &msg, const LogMsg &lm, bool with_history) = 0;
+        // msg的元数据, 供维护索引的落地方向使用; 飞行记录的时间和等级不确定, 按最宽处理
+        static RecordMeta metaOf(const LogMsg &lm, bool with_history)
+        {
+            RecordMeta meta;
+            meta.add(lm._ctime, lm._level);
+            if (with_history)
+            {
+                meta._min_time = 0;
+                meta._levels = ~0u;
+            }
+            return meta;
+        }
+    private:
+        // 按格式化器和等级把落地方向分组, 输出等级提高到所有落地方向中最低的等级
+        void buildGroups(const std::vector<SinkBinding> &sinks)
+        {
+            LogLevel::Level lowest = LogLevel::Level::OFF;
+            for (auto &binding : sinks)
+            {
+                const LogSink::ptr &sink = binding._sink;
+                Formatter::ptr formatter = binding._formatter ? binding._formatter : _formatter;
+                LogLevel::Level level = binding._level;
+                if (level < lowest)
+                    lowest = level;
+                size_t fi = 0;
+                while (fi < _format_groups.size() && _format_groups[fi]._formatter != formatter)
+                    fi++;
+                if (fi == _format_groups.size())
+                    _format_groups.push_back(FormatGroup{ formatter, level, std::vector<size_t>() });
+                FormatGroup &fg = _format_groups[fi];
+                if (level < fg._level)
+                    fg._level = level;
+                size_t gi = 0;
+                while (gi < fg._groups.size() && _sink_groups[fg._groups[gi]]._level != level)
+                    gi++;
+                if (gi == fg._groups.size())
+                {
+                    fg._groups.push_back(_sink_groups.size());
+                    _sink_groups.push_back(SinkGroup{ level, formatter, std::vector<LogSink::ptr>() });
+                }
+                _sink_groups[fg._groups[gi]]._sinks.push_back(sink);
+            }
+            if (lowest > _limit_level)
+                _limit_level = lowest;
+        }
 
     protected:
-        std::string _logger_name;         // 日志器名称
-        std::atomic<LogLevel::Level> _limit_level;     // 日志器输出等级限制
+        const std::string _logger_name;   // 日志器名称, 日志消息直接引用它
+        std::atomic<LogLevel::Level> _limit_level;     // 日志器输出等级限制, 不低于所有落地方向中最低的等级
         std::shared_ptr<Formatter> _formatter;             // 日志格式化器
         std::vector<LogSink::ptr> _sinks; // 多个日志落地方式
-        std::mutex _mutex;                // 锁，避免多个线程使用一个日志器冲突
+        // 等级相同且格式化器相同的落地方向为一组, 同步日志器逐个写, 异步日志器每组一个工作器
+        struct SinkGroup
+        {
+            LogLevel::Level _level;
+            Formatter::ptr _formatter;
+            std::vector<LogSink::ptr> _sinks;
+        };
+        // 使用同一格式化器的各组, _level为其中最低的等级
+        struct FormatGroup
+        {
+            Formatter::ptr _formatter;
+            LogLevel::Level _level;
+            std::vector<size_t> _groups;
+        };
+        std::vector<SinkGroup> _sink_groups;
+        std::vector<FormatGroup> _format_groups;
+        FlightRecorder::ptr _recorder;    // 飞行记录器, 可以为空
+        Counter _records;                 // 输出的日志条数
+        Counter _bytes;                   // 输出的字节数
+        LatencyHistogram _call_latency;   // 调用线程在日志调用中花费的时间
     };
 
     // 同步日志器
@@ -112,17 +323,18 @@ namespace logSys
         SyncLogger(const std::string &logger_name,
                    LogLevel::Level limit_level,
                    const std::shared_ptr<Formatter> &formatter,
-                   std::vector<LogSink::ptr> sinks)
+                   const std::vector<SinkBinding> &sinks)
             : Logger(logger_name, limit_level, formatter, sinks)
         {
         }
     protected:
-        void log(const std::string &msg) override
+        // 不加日志器级别的锁: 每个落地方向自己决定是否需要串行化
+        void log(size_t group, const std::string &msg, const LogMsg &lm, bool with_history) override
         {
-            std::lock_guard<std::mutex> lock(_mutex);
-            for (auto &sink : _sinks)
+            RecordMeta meta = metaOf(lm, with_history);
+            for (auto &sink : _sink_groups[group]._sinks)
             {
-                sink->log(msg.c_str(), msg.length());
+                sink->write(msg.c_str(), msg.length(), lm._level, &meta);
             }
         }
     };
@@ -133,29 +345,144 @@ namespace logSys
         AsyncLogger(const std::string &logger_name,
                     LogLevel::Level limit_level,
                     const std::shared_ptr<Formatter> &formatter,
-                    std::vector<LogSink::ptr> sinks,
-                    AsyncType async_type = AsyncType::AsyncSafe)
+                    const std::vector<SinkBinding> &sinks,
+                    AsyncType async_type = AsyncType::AsyncSafe,
+                    LogLevel::Level urgent_level = LogLevel::Level::ERROR,
+                    bool urgent_sync = false,
+                    size_t dedup_window_ms = 0)
             : Logger(logger_name, limit_level, formatter, sinks),
-            _looper(std::make_shared<AsyncLooper>(std::bind(&AsyncLogger::asyncLog, this, std::placeholders::_1), async_type))
+            _urgent_level(urgent_level), _urgent_sync(urgent_sync), _dedup(dedup_window_ms > 0),
+            _ordered(async_type == AsyncType::AsyncOrdered)
         {
+            // 每组落地方向一个工作器, 组内的记录已经按组的等级过滤
+            for(size_t i = 0; i < _sink_groups.size(); i++)
+            {
+                _loopers.push_back(std::make_shared<AsyncLooper>(
+                    std::bind(&AsyncLogger::asyncLog, this, i, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), async_type,
+                    std::bind(&AsyncLogger::backpressured, this, i),
+                    std::bind(&AsyncLogger::urgentFlush, this, i)));
+                if(_dedup)
+                {
+                    using namespace std::placeholders;
+                    _loopers[i]->setDedup(dedup_window_ms * 1000000, std::bind(&AsyncLogger::dedupSummary, this, i, _1, _2, _3, _4));
+                }
+            }
+            CrashHandler::add(this, &AsyncLogger::crashFlush);
+        }
+        ~AsyncLogger()
+        {
+            CrashHandler::remove(this);
+        }
+        void collectMetrics(MetricsSnapshot &snap) const override
+        {
+            Logger::collectMetrics(snap);
+            for(size_t i = 0; i < _loopers.size(); i++)
+            {
+                MetricsSnapshot::Labels labels = { { "logger", _logger_name } };
+                if(_loopers.size() > 1) labels.push_back({ "group", std::to_string(i) });
+                _loopers[i]->collectMetrics(snap, labels);
+            }
         }
     protected:
-        void log(const std::string &msg) override
+        // 批次中混有多个等级, 异步落地不区分等级; urgent_level以上的记录走紧急通道
+        void log(size_t group, const std::string &msg, const LogMsg &lm, bool with_history) override
+        {
+            AsyncLane lane = lm._level >= _urgent_level ? AsyncLane::URGENT : AsyncLane::NORMAL;
+            RecordMeta meta = metaOf(lm, with_history);
+            if(_ordered)
+            {
+                // 按记录创建的时间排序, 下界已经在beginRecord中公布
+                _loopers[group]->push(msg.c_str(), msg.size(), lane, nullptr, &meta, lm._mono);
+                return;
+            }
+            if(!_dedup || with_history)
+            {
+                // 带飞行记录的消息不折叠, 否则会丢掉前面的历史
+                _loopers[group]->push(msg.c_str(), msg.size(), lane, nullptr, &meta);
+                return;
+            }
+            DedupKey key;
+            key._hash = util::fnv1a(lm._payload, lm._payload_len,
+                                    util::fnv1a(&lm._line, sizeof(lm._line), (uint64_t)(uintptr_t)lm._file ^ (uint64_t)lm._level));
+            key._level = lm._level;
+            key._file = lm._file;
+            key._line = lm._line;
+            key._tid = lm._tid;
+            _loopers[group]->push(msg.c_str(), msg.size(), lane, &key, &meta);
+        }
+        void beginRecord() override
+        {
+            if(!_ordered) return;
+            for(auto &looper : _loopers) looper->beginStamp();
+        }
+        void endRecord() override
+        {
+            if(!_ordered) return;
+            for(auto &looper : _loopers) looper->endStamp();
+        }
+        // 重复汇总行使用该组的格式化器, 调用点与被折叠的记录相同
+        // 汇总行可能在工作线程或下一个写日志的线程上生成, 线程id取被折叠的记录, 不带线程名和MDC
+        void dedupSummary(size_t group, const DedupKey &key, uint64_t count, uint64_t span_ns, std::string &out)
         {
-            _looper->push(msg);
+            char text[128];
+            int n = snprintf(text, sizeof(text), "last message repeated %llu times over %.3fs",
+                             (unsigned long long)count, span_ns / 1e9);
+            LogMsg lm(key._level, key._line, key._file, _logger_name.c_str(), text, n);
+            lm._tid = key._tid;
+            lm._thread = nullptr;
+            _sink_groups[group]._formatter->format(out, lm);
         }
-        // 实际异步线程的落地回调
-        void asyncLog(Buffer &buffer)
+        // 紧急通道落地后立即刷新, 需要时持久化到磁盘
+        void urgentFlush(size_t group)
         {
-            // 不用加锁因为只有一个异步线程
-            for(auto &sink : _sinks)
+            for(auto &sink : _sink_groups[group]._sinks)
             {
-                sink->log(buffer.readPositon(), buffer.readAbleSize());
+                if(_urgent_sync) sink->sync();
+                else sink->flush();
             }
-        } 
+        }
+        // 实际异步线程的落地回调, 批次可能是环形缓冲区中的两段
+        void asyncLog(size_t group, const struct iovec *iov, int cnt, const RecordMeta &meta)
+        {
+            if(cnt == 0) return;
+            // 不用加锁因为每组只有一个异步线程
+            for(auto &sink : _sink_groups[group]._sinks)
+            {
+                sink->write(iov, cnt, &meta);
+            }
+        }
+        // 组内任一落地方向受阻时让工作器攒批
+        bool backpressured(size_t group) const
+        {
+            for(auto &sink : _sink_groups[group]._sinks)
+            {
+                if(sink->backpressured()) return true;
+            }
+            return false;
+        }
+        // 崩溃时把缓冲区中还没落地的日志写到每个落地方向, 在信号处理函数中执行
+        static void crashFlush(void *ctx)
+        {
+            AsyncLogger *self = static_cast<AsyncLogger *>(ctx);
+            for(size_t i = 0; i < self->_loopers.size(); i++)
+            {
+                for(auto &sink : self->_sink_groups[i]._sinks)
+                {
+                    int fd = sink->crashFd();
+                    if(fd < 0) continue;
+                    // 落地方向自己缓冲的数据比工作器中的早
+                    sink->crashFlush();
+                    self->_loopers[i]->crashDump(fd);
+                }
+            }
+        }
     private:  
-        // 异步工作器
-        AsyncLooper::ptr _looper;
+        LogLevel::Level _urgent_level; // 走紧急通道的最低等级, OFF表示不使用
+        bool _urgent_sync;             // 紧急通道落地后是否fdatasync
+        bool _dedup;                   // 是否折叠连续重复的记录
+        bool _ordered;                 // 工作器按记录创建时间排序落地
+        // 异步工作器, 与_sink_groups一一对应
+        std::vector<AsyncLooper::ptr> _loopers;
     };
 
     // 枚举日志器类型
@@ -171,7 +498,8 @@ namespace logSys
     public:
         LoggerBuilder()
         :_logger_type(LoggerType::LOGGER_SYNC), _limit_level(LogLevel::Level::DEBUG),
-        _async_type(AsyncType::AsyncSafe)
+        _async_type(AsyncType::AsyncSafe), _urgent_level(LogLevel::Level::ERROR), _urgent_sync(false),
+        _dedup_window_ms(0)
         {
         }
         using ptr = std::shared_ptr<LoggerBuilder>;
@@ -180,12 +508,35 @@ namespace logSys
         void buildLimitLevel(LogLevel::Level limit_level) { _limit_level = limit_level; }
         void buildFormatter(const Formatter::ptr &formatter) { _formatter = formatter; }
         void buildFormatter(const std::string &pattern) { _formatter = std::make_shared<Formatter>(pattern); }
+        // AsyncOrdered: 各线程的记录按时间顺序落地, 生产者之间不加锁, 不使用紧急通道和重复折叠
         void buildAsyncType(AsyncType async_type) { _async_type = async_type; }
+        // 异步日志器中level以上的日志走紧急通道, 不排在普通日志后面; sync为true时落地后fdatasync
+        void buildUrgentLane(LogLevel::Level level, bool sync = false)
+        {
+            _urgent_level = level;
+            _urgent_sync = sync;
+        }
+        // 异步日志器中同一调用点连续输出相同内容时, window_ms内只写第一条, 段结束时补一行重复次数和时间跨度
+        void buildDedup(size_t window_ms) { _dedup_window_ms = window_ms; }
+        // 低于输出等级的日志记录在内存中, 出现trigger等级以上的日志时一起输出
+        void buildFlightRecorder(size_t slots = 1024, LogLevel::Level trigger = LogLevel::Level::ERROR,
+                                 LogLevel::Level record = LogLevel::Level::DEBUG)
+        {
+            _recorder = std::make_shared<FlightRecorder>(slots, trigger, record);
+        }
         template<typename SinkType, typename ...Args>
         void buildSink(Args &&...args)
         {
             _sinks.push_back(SinkFactory::create<SinkType>(std::forward<Args>(args)...));
         }
+        // 添加外部已经创建好的落地方式, 便于调用者保留句柄
+        void buildSink(const LogSink::ptr &sink) { _sinks.push_back(sink); }
+        // 添加只接收level以上日志的落地方式, formatter不为空时该落地方向使用自己的格式化器
+        // 等级和格式化器只对这个日志器有效, 不修改落地方向本身
+        void buildSink(const LogSink::ptr &sink, LogLevel::Level level, const Formatter::ptr &formatter = Formatter::ptr())
+        {
+            _sinks.push_back(SinkBinding(sink, level, formatter));
+        }
         // 抽象建造日志器类
         virtual Logger::ptr build() = 0;
     protected:
@@ -193,8 +544,12 @@ namespace logSys
         LoggerType _logger_type;          // 日志器类型(同步/异步)
         LogLevel::Level _limit_level;     // 日志器输出等级限制
         Formatter::ptr _formatter;        // 日志格式化器
-        std::vector<LogSink::ptr> _sinks; // 多个日志落地方式
+        std::vector<SinkBinding> _sinks;  // 多个日志落地方式及各自的等级和格式化器
         AsyncType _async_type;            // 异步缓冲区类型
+        LogLevel::Level _urgent_level;    // 紧急通道等级
+        bool _urgent_sync;                // 紧急通道落地后是否持久化
+        size_t _dedup_window_ms;          // 重复折叠窗口, 0表示不折叠
+        FlightRecorder::ptr _recorder;    // 飞行记录器
     };
 
     // 局部日志器建造者
@@ -216,17 +571,21 @@ namespace logSys
             if(_sinks.empty())
             {
                 std::cout << "没有设置日志落地方向， 设置默认标准输出" << std::endl; 
-                _sinks.push_back(SinkFactory::create<StdoutSink>());
+                _sinks.push_back(SinkFactory::create<ConsoleSink>());
             }
             
+            Logger::ptr ret;
             if(_logger_type == LoggerType::LOGGER_ASYNC)
             {
-                return std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _async_type); 
+                ret = std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _async_type,
+                                                    _urgent_level, _urgent_sync, _dedup_window_ms); 
             }
             else
             {
-                return std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter, _sinks);
+                ret = std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter, _sinks);
             } 
+            ret->setRecorder(_recorder);
+            return ret;
         }
     };
     // 全局单例日志管理器
@@ -259,18 +618,100 @@ namespace logSys
             std::lock_guard<std::mutex> lock(_mutex);
             return _root_logger;
         }
+        // 收集所有已注册日志器、异步工作器和落地方向的指标, 多个日志器共用的落地方向只收集一次
+        // 名字(describe)相同的落地方向追加 sink_id=对象地址, 避免输出标签完全相同的序列
+        MetricsSnapshot snapshot()
+        {
+            std::vector<Logger::ptr> loggers;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for(auto &it : _loggers) loggers.push_back(it.second);
+            }
+            MetricsSnapshot snap;
+            std::set<const LogSink *> seen;
+            std::vector<std::pair<const LogSink *, std::string>> sinks;
+            std::unordered_map<std::string, size_t> names;
+            for(auto &logger : loggers)
+            {
+                logger->collectMetrics(snap);
+                for(auto &sink : logger->sinks())
+                {
+                    if(!seen.insert(sink.get()).second) continue;
+                    sinks.emplace_back(sink.get(), sink->describe());
+                    names[sinks.back().second]++;
+                }
+            }
+            for(auto &it : sinks)
+            {
+                MetricsSnapshot::Labels labels = { { "sink", it.second } };
+                if(names[it.second] > 1)
+                {
+                    char id[32];
+                    snprintf(id, sizeof(id), "%p", (const void *)it.first);
+                    labels.push_back({ "sink_id", id });
+                }
+                it.first->collectMetrics(snap, labels);
+            }
+            return snap;
+        }
+        // 每隔interval_ms把快照以Prometheus文本格式写到path, 先写临时文件再rename, 读者不会看到半个文件
+        void startMetricsDump(const std::string &path, size_t interval_ms = 10000)
+        {
+            stopMetricsDump();
+            util::File::createDirectory(util::File::path(path));
+            _dump_running = true;
+            _dump_thread = std::thread([this, path, interval_ms](){
+                std::unique_lock<std::mutex> lock(_dump_mutex);
+                while(_dump_running)
+                {
+                    _dump_cond.wait_for(lock, std::chrono::milliseconds(interval_ms), [this](){ return !_dump_running; });
+                    lock.unlock();
+                    dumpMetrics(path);
+                    lock.lock();
+                }
+            });
+        }
+        void stopMetricsDump()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_dump_mutex);
+                _dump_running = false;
+            }
+            _dump_cond.notify_all();
+            if(_dump_thread.joinable()) _dump_thread.join();
+        }
     private:
         LoggerManager()
+        :_dump_running(false)
         {
             LoggerBuilder::ptr builder = std::make_shared<LocalLoggerBuilder>();
             builder->buildLoggerName("root");
             _root_logger = builder->build();
             addLogger(_root_logger);
         }
+        ~LoggerManager()
+        {
+            stopMetricsDump();
+        }
+        void dumpMetrics(const std::string &path)
+        {
+            std::string text = snapshot().toPrometheus();
+            std::string tmp = path + ".tmp";
+            int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if(fd < 0) return;
+            bool ok = util::File::writeAll(fd, text.c_str(), text.size());
+            close(fd);
+            if(!ok || ::rename(tmp.c_str(), path.c_str()) != 0) unlink(tmp.c_str());
+        }
     private:
         std::mutex _mutex; // unordered_map线程不安全，curd都得加锁
         std::unordered_map<std::string, Logger::ptr> _loggers; 
         Logger::ptr _root_logger; // 默认的日志器: 输出到显示器
+        // 指标定期输出
+        bool _dump_running;
+        std::mutex _dump_mutex;
+        std::condition_variable _dump_cond;
+        std::thread _dump_thread;
     };
 
     class GlobalLoggerBuilder : public LoggerBuilder
@@ -291,7 +732,7 @@ namespace logSys
             if(_sinks.empty())
             {
                 std::cout << "没有设置日志落地方向， 设置默认标准输出" << std::endl; 
-                _sinks.push_back(SinkFactory::create<StdoutSink>());
+                _sinks.push_back(SinkFactory::create<ConsoleSink>());
             }
             Logger::ptr ret;
             if(_logger_type == LoggerType::LOGGER_SYNC)
@@ -300,8 +741,10 @@ namespace logSys
             }
             else
             {
-                ret = std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _async_type);
+                ret = std::make_shared<AsyncLogger>(_logger_name, _limit_level, _formatter, _sinks, _async_type,
+                                                    _urgent_level, _urgent_sync, _dedup_window_ms);
             }
+            ret->setRecorder(_recorder);
             LoggerManager::getInstance().addLogger(ret);
             return ret;
         }
@@ -1,25 +1,75 @@
 #pragma once
 #include "buffer.hpp"
+#include "util.hpp"
+#include "metrics.hpp"
+#include "level.hpp"
+#include "index.hpp"
+#include "crash.hpp"
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <chrono>
+#include <queue>
+#include <cstdint>
 namespace logSys
 {
+    #define ASYNC_PRESSURE_LINGER_MS 50 // 落地方向受阻时工作线程最多多等待的时间
+    #define ASYNC_RING_SIZE (2 * BUFFER_DEFAULT_SIZE) // 定长模式环形缓冲区的容量, 与双缓冲的总量相同
+    #define ASYNC_SLICE_SIZE (256 * 1024) // 普通批次分片落地的大小, 片间检查紧急通道
+    #define ASYNC_URGENT_LIMIT (4 * CHUNK_SIZE) // 紧急通道最多积压的字节数, 超过后改走普通通道
+    #define ASYNC_ORDERED_QUEUE_SIZE (256 * 1024) // 有序模式下每个生产者线程的队列容量
+    #define ASYNC_REORDER_WINDOW_MS 100 // 有序模式下最多等待一个正在入队的生产者的时间, 超过后它的记录按迟到处理
     // 异步缓冲区是否安全: 安全即缓冲区定长，不安全相反
+    // 定长: 生产者和工作线程共用一个环形缓冲区, 工作线程在锁外直接写出可读区域, 写完再归还空间
+    // 不定长: 双缓冲区交换, 缓冲区由定长块串成, 增长只追加块, 落地时所有块一次writev写出
+    // 有序: 每个生产者线程一个无锁队列, 记录带创建时的时间戳和序号, 工作线程多路归并后按时间顺序落地
+    //       生产者之间不加锁; 没有紧急通道和重复折叠, 两者都会打乱或需要在锁内判断顺序
     enum class AsyncType
     {
         AsyncSafe,
-        AsyncUnSafe
+        AsyncUnSafe,
+        AsyncOrdered
+    };
+    // 通道: 紧急通道积压不超过ASYNC_URGENT_LIMIT时生产者不会阻塞, 超过后按普通通道写入(定长模式下可能等待)
+    // 工作线程总是先落地紧急通道, 普通批次按片写出, 片间插入紧急数据; 紧急记录可能先于更早写入普通通道的记录落地
+    enum class AsyncLane
+    {
+        NORMAL,
+        URGENT
+    };
+    // 去重用的记录标识: 日志器内同一调用点、同一等级、同样内容的记录哈希相同
+    struct DedupKey
+    {
+        uint64_t _hash;
+        LogLevel::Level _level;
+        const char *_file; // __FILE__ 字面量
+        size_t _line;
+        pid_t _tid;        // 写出这一段第一条记录的线程, 不参与比较
     };
     class AsyncLooper 
     {
     public:
         using ptr = std::shared_ptr<AsyncLooper>;
-        using Functor = std::function<void(Buffer &)>;
-        AsyncLooper(const Functor& callback, AsyncType is_safe)
-        :_is_safe(is_safe), _callback(callback), _running(true),
+        // 一个批次的数据, 环形缓冲区回绕时分成两段; 元数据是整个批次的时间范围和等级
+        using Functor = std::function<void(const struct iovec *, int, const RecordMeta &)>;
+        using PressureProbe = std::function<bool()>;
+        using UrgentHook = std::function<void()>;
+        // 生成重复汇总行: 被折叠的记录标识, 折叠的条数, 从第一条到最后一条的纳秒数
+        using DedupHook = std::function<void(const DedupKey &, uint64_t, uint64_t, std::string &)>;
+        // probe: 可选, 返回true表示落地方向受阻, 此时工作线程先等生产者缓冲区积累到一半再落地
+        // urgent_hook: 可选, 每次紧急通道落地后调用(如刷新/持久化落地方向)
+        AsyncLooper(const Functor& callback, AsyncType is_safe, const PressureProbe &probe = PressureProbe(),
+                    const UrgentHook &urgent_hook = UrgentHook())
+        :_id(nextId()), _producer_count(0), _producers_version(0), _ordered_idle(false), _last_emitted(0),
+        _buffer_producer(_pool), _buffer_consumer(_pool),
+        _urgent_producer(_pool), _urgent_consumer(_pool), _urgent_since(0),
+        _ring(is_safe == AsyncType::AsyncSafe ? ASYNC_RING_SIZE : 1),
+        _running(true), _consumer_held(false), _urgent_held(false), _urgent_pending(false),
+        _callback(callback), _probe(probe), _urgent_hook(urgent_hook),
+        _dedup_window(0), _dup_active(false), _dup_count(0), _dup_start(0), _dup_last(0), _dup_lane(AsyncLane::NORMAL),
+        _is_safe(is_safe),
         _thread(&AsyncLooper::threadEntry, this)
         {}
         ~AsyncLooper()
@@ -27,53 +77,655 @@ namespace logSys
             _running = false;
             _cond_consumer.notify_all();
             _thread.join();
-            
+            // 生产者线程缓存中的队列不再使用, 下次查找时丢弃
+            for(auto &p : _producers) p->_closed.store(true, std::memory_order_release);
+        }
+        // 开启连续重复记录的折叠: window_ns内同一标识的后续记录只计数, 段结束时由hook生成一行汇总
+        // 需要在开始写入前设置
+        void setDedup(uint64_t window_ns, const DedupHook &hook)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _dedup_window = window_ns;
+            _dedup_hook = hook;
         }
-        void push(const char* data, size_t len)
+        // key不为空且开启了折叠时参与去重; meta不为空时并入所在批次的元数据
+        // stamp: 有序模式下记录的单调时钟时间戳, 调用方需要在取得它之前调用beginStamp; 为0时在入队时打
+        void push(const char* data, size_t len, AsyncLane lane = AsyncLane::NORMAL, const DedupKey *key = nullptr,
+                  const RecordMeta *meta = nullptr, uint64_t stamp = 0)
         {
+            if(_is_safe == AsyncType::AsyncOrdered)
+            {
+                pushOrdered(data, len, meta, stamp);
+                return;
+            }
             std::unique_lock<std::mutex> lock(_mutex);
+            if(key != nullptr && _dedup_window > 0)
+            {
+                uint64_t now = monoNanos();
+                if(_dup_active && sameRecord(*key, _dup_key) && now - _dup_start < _dedup_window)
+                {
+                    // 第一条被折叠时唤醒工作线程, 让它按段超时写出汇总
+                    if(++_dup_count == 1) _cond_consumer.notify_one();
+                    _dup_last = now;
+                    if(meta != nullptr) _dup_meta.merge(*meta);
+                    _dedup_suppressed.add();
+                    return;
+                }
+                // 新的一段, 先写出上一段的汇总; 写入可能等待空间, 状态先更新
+                util::ThreadBuffer summary;
+                AsyncLane summary_lane = _dup_lane;
+                RecordMeta summary_meta = _dup_meta;
+                if(_dup_count > 0) _dedup_hook(_dup_key, _dup_count, _dup_last - _dup_start, summary.str());
+                _dup_active = true;
+                _dup_key = *key;
+                _dup_count = 0;
+                _dup_start = _dup_last = now;
+                _dup_lane = lane;
+                _dup_meta = RecordMeta();
+                if(!summary.str().empty()) writeLocked(lock, summary.str().data(), summary.str().size(), summary_lane, &summary_meta);
+            }
+            writeLocked(lock, data, len, lane, meta);
+        }
+        void push(const std::string &data, AsyncLane lane = AsyncLane::NORMAL)
+        {
+            push(data.c_str(), data.size(), lane);
+        }
+        // 有序模式: 当前线程即将创建记录, 公布时间戳下界, 直到endStamp之前工作线程不会输出不早于它的记录
+        // 可以嵌套, 最外层生效
+        void beginStamp()
+        {
+            Producer &p = producer();
+            if(p._depth++ == 0) p._inflight.store(monoNanos(), std::memory_order_seq_cst);
+        }
+        void endStamp()
+        {
+            Producer &p = producer();
+            if(--p._depth == 0) p._inflight.store(0, std::memory_order_release);
+        }
+        // 崩溃时把还没落地的数据直接写到fd, 只在信号处理函数中调用
+        // 不加锁: 读到的可能是正在变化的缓冲区, 尽力而为; 正在落地的批次可能重复写出
+        // 顺序与工作线程一致: 紧急批次、紧急通道、普通批次、生产者缓冲区
+        void crashDump(int fd)
+        {
+            if(_is_safe == AsyncType::AsyncOrdered)
+            {
+                // 各队列依次写出, 不再归并
+                for(auto &p : _producers)
+                {
+                    uint64_t pos = p->_queue.readPos();
+                    const StampedRecord *r;
+                    while((r = p->_queue.peek(pos)) != nullptr)
+                    {
+                        util::File::writeAll(fd, p->_queue.payload(r), r->_len);
+                        pos = p->_queue.next(pos, r);
+                    }
+                }
+                return;
+            }
+            if(_urgent_held.load(std::memory_order_acquire)) crashDumpChunks(fd, _urgent_consumer);
+            crashDumpChunks(fd, _urgent_producer);
             if(_is_safe == AsyncType::AsyncSafe)
             {
-                _cond_producer.wait(lock, [&](){ return len <= _buffer_producer.writeAbleSize(); });
+                // 环中从读位置开始的数据包含正在落地的批次
+                struct iovec iov[2];
+                int cnt = _ring.readSpans(iov);
+                util::File::writevAll(fd, iov, cnt);
+                return;
             }
-            _buffer_producer.writeAndPush(data, len);
-            _cond_consumer.notify_one();
+            if(_consumer_held.load(std::memory_order_acquire)) crashDumpChunks(fd, _buffer_consumer);
+            crashDumpChunks(fd, _buffer_producer);
         }
-        void push(const std::string &data)
+        void collectMetrics(MetricsSnapshot &snap, const MetricsSnapshot::Labels &labels) const
         {
-            push(data.c_str(), data.size());
+            snap.gauge("logsys_looper_queued_bytes", "Bytes waiting in the producer buffer", labels, (double)_queued_bytes.value());
+            snap.counter("logsys_looper_swaps_total", "Producer/consumer buffer swaps", labels, _swaps.value());
+            snap.counter("logsys_looper_consumed_bytes_total", "Bytes handed to the sinks by the worker", labels, _batch_bytes.value());
+            snap.histogram("logsys_looper_producer_wait_seconds", "Time producers blocked on a full buffer (AsyncSafe)", labels, _producer_wait);
+            snap.histogram("logsys_looper_batch_seconds", "Time spent writing one batch to all sinks", labels, _batch_latency);
+            snap.counter("logsys_looper_urgent_bytes_total", "Bytes written through the urgent lane", labels, _urgent_bytes.value());
+            snap.counter("logsys_looper_dedup_suppressed_total", "Repeated records collapsed into summary lines", labels, _dedup_suppressed.value());
+            snap.histogram("logsys_looper_urgent_seconds", "Time from an urgent record being queued to its lane being written", labels, _urgent_latency);
+            snap.counter("logsys_looper_urgent_overflow_total", "Urgent records sent through the normal lane because the urgent lane was full", labels, _urgent_overflow.value());
+            if(_is_safe == AsyncType::AsyncOrdered)
+            {
+                snap.gauge("logsys_looper_producers", "Producer queues in ordered mode", labels, (double)_producers_gauge.value());
+                snap.counter("logsys_looper_reorder_late_total", "Records written after a later-stamped record (reorder window exceeded)", labels, _late.value());
+            }
         }
     private:
+        // 有序模式下一个生产者线程的队列
+        struct Producer
+        {
+            Producer(uint32_t id)
+            :_queue(ASYNC_ORDERED_QUEUE_SIZE), _inflight(0), _depth(0), _seq(0), _id(id), _abandoned(false), _closed(false), _peek(0)
+            {}
+            StampedQueue _queue;
+            std::atomic<uint64_t> _inflight; // 正在创建或入队的记录时间戳的下界, 0表示没有
+            uint32_t _depth;                 // beginStamp的嵌套层数, 只由生产者线程访问
+            uint64_t _seq;                   // 只由生产者线程访问
+            uint32_t _id;
+            std::atomic<bool> _abandoned;    // 生产者线程已经退出
+            std::atomic<bool> _closed;       // 工作器已经析构
+            uint64_t _peek;                  // 只由工作线程访问: 已经取出等待落地的位置
+        };
+        // 线程私有: 本线程在各个工作器中的队列, 线程退出时通知工作器回收
+        struct ProducerCache
+        {
+            ~ProducerCache()
+            {
+                for(auto &e : _entries) e.second->_abandoned.store(true, std::memory_order_release);
+            }
+            std::vector<std::pair<uint64_t, std::shared_ptr<Producer>>> _entries;
+        };
+        static ProducerCache &producerCache()
+        {
+            static thread_local ProducerCache cache;
+            return cache;
+        }
+        static uint64_t nextId()
+        {
+            static std::atomic<uint64_t> id(0);
+            return ++id;
+        }
+        // 当前线程的队列, 第一次写入时注册, 只在注册时加锁
+        Producer &producer()
+        {
+            auto &entries = producerCache()._entries;
+            for(auto &e : entries)
+            {
+                if(e.first == _id) return *e.second;
+            }
+            // 顺便丢掉已经析构的工作器的队列
+            for(size_t i = 0; i < entries.size(); )
+            {
+                if(entries[i].second->_closed.load(std::memory_order_acquire))
+                {
+                    entries[i] = entries.back();
+                    entries.pop_back();
+                }
+                else i++;
+            }
+            std::shared_ptr<Producer> p;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                p = std::make_shared<Producer>(_producer_count++);
+                _producers.push_back(p);
+                _producers_gauge.set(_producers.size());
+                _producers_version.fetch_add(1, std::memory_order_release);
+            }
+            entries.emplace_back(_id, p);
+            return *p;
+        }
+        // 有序模式的写入: stamp为0时先等到队列有空间, 再公布下界、打时间戳入队
+        // 调用方已经公布下界时等待空间期间继续持有, 队列中更早的记录不受影响, 工作线程仍能腾出空间
+        void pushOrdered(const char *data, size_t len, const RecordMeta *meta, uint64_t stamp)
+        {
+            Producer &p = producer();
+            if(!p._queue.fits(len))
+            {
+                std::cout << "日志长度超过有序队列容量, 丢弃" << std::endl;
+                return;
+            }
+            if(!p._queue.writeAble(len))
+            {
+                uint64_t start = monoNanos();
+                while(!p._queue.writeAble(len))
+                {
+                    _cond_consumer.notify_one();
+                    std::this_thread::yield();
+                }
+                _producer_wait.record(monoNanos() - start);
+            }
+            StampedRecord header;
+            header._seq = p._seq++;
+            header._len = (uint32_t)len;
+            header._min_time = meta != nullptr ? meta->_min_time : 0;
+            header._max_time = meta != nullptr ? meta->_max_time : 0;
+            header._levels = meta != nullptr ? meta->_levels : 0;
+            bool was_empty = p._queue.empty();
+            // 工作线程看到下界后不会输出时间戳不小于它的记录, 下界必须在打时间戳之前公布
+            beginStamp();
+            header._ts = stamp != 0 ? stamp : monoNanos();
+            p._queue.push(header, data);
+            endStamp();
+            if(was_empty && _ordered_idle.load(std::memory_order_acquire)) _cond_consumer.notify_one();
+        }
+        // 有序模式的工作线程: 水位线以下的记录已经不会再有更早的, 按(时间戳, 生产者, 序号)归并后落地
+        // 水位线 = min(当前时间, 各个正在入队的生产者公布的下界), 超过重排窗口的下界不再等待
+        void orderedEntry()
+        {
+            struct Head
+            {
+                uint64_t _ts;
+                uint32_t _id;
+                uint64_t _seq;
+                size_t _idx;
+                bool operator>(const Head &o) const
+                {
+                    return _ts != o._ts ? _ts > o._ts : (_id != o._id ? _id > o._id : _seq > o._seq);
+                }
+            };
+            std::vector<std::shared_ptr<Producer>> producers;
+            uint64_t version = UINT64_MAX;
+            const uint64_t window = (uint64_t)ASYNC_REORDER_WINDOW_MS * 1000000;
+            while(1)
+            {
+                bool stopping = !_running;
+                // 线程退出不改版本号, 发现已经读完的遗弃队列时也重新获取
+                bool stale = version != _producers_version.load(std::memory_order_acquire);
+                for(size_t i = 0; i < producers.size() && !stale; i++)
+                {
+                    stale = producers[i]->_abandoned.load(std::memory_order_acquire)
+                         && producers[i]->_queue.peek(producers[i]->_peek) == nullptr;
+                }
+                if(stale) refreshProducers(producers, version);
+                uint64_t now = monoNanos();
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                uint64_t watermark = stopping ? UINT64_MAX : now;
+                for(auto &p : producers)
+                {
+                    uint64_t mark = p->_inflight.load(std::memory_order_seq_cst);
+                    if(mark != 0 && mark < watermark && now - mark < window) watermark = mark;
+                }
+                std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+                bool pending = false;
+                for(size_t i = 0; i < producers.size(); i++)
+                {
+                    const StampedRecord *r = producers[i]->_queue.peek(producers[i]->_peek);
+                    if(r == nullptr) continue;
+                    pending = true;
+                    if(r->_ts < watermark) heads.push(Head{ r->_ts, producers[i]->_id, r->_seq, i });
+                }
+                _slice.clear();
+                size_t bytes = 0;
+                bool emitted = !heads.empty();
+                RecordMeta meta;
+                while(!heads.empty())
+                {
+                    Head h = heads.top();
+                    heads.pop();
+                    Producer &p = *producers[h._idx];
+                    const StampedRecord *r = p._queue.peek(p._peek);
+                    if(h._ts < _last_emitted) _late.add();
+                    else _last_emitted = h._ts;
+                    struct iovec piece = { (void *)p._queue.payload(r), r->_len };
+                    _slice.push_back(piece);
+                    bytes += r->_len;
+                    RecordMeta rm;
+                    rm._min_time = r->_min_time;
+                    rm._max_time = r->_max_time;
+                    rm._levels = r->_levels;
+                    meta.merge(rm);
+                    p._peek = p._queue.next(p._peek, r);
+                    if(bytes >= ASYNC_SLICE_SIZE)
+                    {
+                        emitOrdered(producers, bytes, meta);
+                        bytes = 0;
+                        meta = RecordMeta();
+                    }
+                    r = p._queue.peek(p._peek);
+                    if(r != nullptr && r->_ts < watermark) heads.push(Head{ r->_ts, p._id, r->_seq, h._idx });
+                }
+                if(!_slice.empty()) emitOrdered(producers, bytes, meta);
+                if(emitted) continue;
+                if(stopping && !pending) return;
+                std::unique_lock<std::mutex> lock(_mutex);
+                if(pending)
+                {
+                    // 有记录在等正在入队的生产者, 很快就能输出
+                    _cond_consumer.wait_for(lock, std::chrono::microseconds(100));
+                    continue;
+                }
+                _ordered_idle.store(true, std::memory_order_seq_cst);
+                bool empty = true;
+                for(auto &p : producers) empty = empty && p->_queue.peek(p->_peek) == nullptr;
+                if(empty && _running && version == _producers_version.load(std::memory_order_acquire))
+                    _cond_consumer.wait_for(lock, std::chrono::milliseconds(5));
+                _ordered_idle.store(false, std::memory_order_relaxed);
+            }
+        }
+        // 落地归并好的一批, 然后把空间还给各个队列
+        void emitOrdered(const std::vector<std::shared_ptr<Producer>> &producers, size_t bytes, const RecordMeta &meta)
+        {
+            consume(_slice.data(), (int)_slice.size(), bytes, meta);
+            _slice.clear();
+            for(auto &p : producers) p->_queue.release(p->_peek);
+        }
+        // 重新取生产者列表, 回收线程已经退出且已经读完的队列
+        void refreshProducers(std::vector<std::shared_ptr<Producer>> &producers, uint64_t &version)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for(size_t i = 0; i < _producers.size(); )
+            {
+                Producer &p = *_producers[i];
+                if(p._abandoned.load(std::memory_order_acquire) && p._queue.peek(p._peek) == nullptr
+                   && p._inflight.load(std::memory_order_acquire) == 0)
+                {
+                    _producers.erase(_producers.begin() + i);
+                    _producers_version.fetch_add(1, std::memory_order_release);
+                }
+                else i++;
+            }
+            producers = _producers;
+            _producers_gauge.set(_producers.size());
+            version = _producers_version.load(std::memory_order_acquire);
+        }
+        // 哈希相同时再比较调用点和等级, 排除不同调用点的哈希碰撞
+        static bool sameRecord(const DedupKey &a, const DedupKey &b)
+        {
+            return a._hash == b._hash && a._line == b._line && a._level == b._level && a._file == b._file;
+        }
+        // 记录实际使用的通道: 紧急通道积压满时改走普通通道, 调用时持有锁
+        AsyncLane laneFor(AsyncLane lane, size_t len) const
+        {
+            if(lane == AsyncLane::URGENT && _urgent_producer.readAbleSize() + len > ASYNC_URGENT_LIMIT) return AsyncLane::NORMAL;
+            return lane;
+        }
+        // 写入一个通道, 定长模式下空间不够时等待, 调用时持有锁
+        void writeLocked(std::unique_lock<std::mutex> &lock, const char *data, size_t len, AsyncLane lane,
+                         const RecordMeta *meta)
+        {
+            if(lane != laneFor(lane, len))
+            {
+                _urgent_overflow.add();
+                lane = AsyncLane::NORMAL;
+            }
+            if(lane == AsyncLane::URGENT)
+            {
+                if(_urgent_producer.empty()) _urgent_since = monoNanos();
+                _urgent_producer.writeAndPush(data, len);
+                if(meta != nullptr) _urgent_meta.merge(*meta);
+                _urgent_pending.store(true, std::memory_order_release);
+            }
+            else if(_is_safe == AsyncType::AsyncSafe)
+            {
+                if(len > _ring.capacity())
+                {
+                    std::cout << "日志长度超过异步缓冲区容量, 丢弃" << std::endl;
+                    return;
+                }
+                if(len > _ring.writeAbleSize())
+                {
+                    // 缓冲区满, 统计生产者被阻塞的时间
+                    uint64_t start = monoNanos();
+                    _cond_producer.wait(lock, [&](){ return len <= _ring.writeAbleSize(); });
+                    _producer_wait.record(monoNanos() - start);
+                }
+                _ring.writeAndPush(data, len);
+                if(meta != nullptr) _normal_meta.merge(*meta);
+                _queued_bytes.set(_ring.readAbleSize());
+            }
+            else
+            {
+                _buffer_producer.writeAndPush(data, len);
+                if(meta != nullptr) _normal_meta.merge(*meta);
+                _queued_bytes.set(_buffer_producer.readAbleSize());
+            }
+            _cond_consumer.notify_one();
+        }
+        // 工作线程在段超时或停止时写出汇总, 定长模式空间不够时留到下次, 工作线程不能等待自己
+        void flushRepeatsLocked(std::unique_lock<std::mutex> &lock)
+        {
+            if(_dup_count > 0)
+            {
+                util::ThreadBuffer summary;
+                _dedup_hook(_dup_key, _dup_count, _dup_last - _dup_start, summary.str());
+                const std::string &text = summary.str();
+                if(laneFor(_dup_lane, text.size()) == AsyncLane::NORMAL && _is_safe == AsyncType::AsyncSafe
+                   && text.size() > _ring.writeAbleSize()) return;
+                writeLocked(lock, text.data(), text.size(), _dup_lane, &_dup_meta);
+            }
+            _dup_active = false;
+            _dup_count = 0;
+        }
         void threadEntry()
+        {
+            // 工作线程自己的备用信号栈, 在落地代码中栈溢出时崩溃处理仍能执行
+            if(CrashHandler::installed()) CrashHandler::installThread();
+            if(_is_safe == AsyncType::AsyncSafe) ringEntry();
+            else if(_is_safe == AsyncType::AsyncOrdered) orderedEntry();
+            else swapEntry();
+        }
+        // 等待数据, 返回false表示已经停止且两个通道都没有数据
+        // 有折叠中的重复记录时最多等到段超时, 超时后写出汇总
+        bool waitForData(std::unique_lock<std::mutex> &lock, const std::function<size_t()> &readable)
+        {
+            auto ready = [&](){ return readable() != 0 || !_urgent_producer.empty(); };
+            while(1)
+            {
+                if(_dup_count > 0 && (!_running || monoNanos() - _dup_start >= _dedup_window)) flushRepeatsLocked(lock);
+                if(!_running || ready()) break;
+                if(_dup_count > 0)
+                {
+                    uint64_t elapsed = monoNanos() - _dup_start;
+                    uint64_t left = elapsed < _dedup_window ? _dedup_window - elapsed : 0;
+                    _cond_consumer.wait_for(lock, std::chrono::nanoseconds(left));
+                }
+                else
+                {
+                    _cond_consumer.wait(lock);
+                }
+            }
+            if(!_running && !ready()) return false;
+            if(_probe && _running && _urgent_producer.empty() && _probe())
+            {
+                // 受阻时凑大批次, 不超过缓冲区一半, 定长缓冲区的生产者不会因此阻塞; 紧急数据到达时立即结束
+                _cond_consumer.wait_for(lock, std::chrono::milliseconds(ASYNC_PRESSURE_LINGER_MS), [&](){
+                    return !_running || readable() >= BUFFER_DEFAULT_SIZE / 2 || !_urgent_producer.empty();
+                });
+            }
+            return true;
+        }
+        // 落地一个批次并统计
+        void consume(const struct iovec *iov, int cnt, size_t len, const RecordMeta &meta)
+        {
+            _swaps.add();
+            _batch_bytes.add(len);
+            uint64_t start = monoNanos();
+            _callback(iov, cnt, meta);
+            _batch_latency.record(monoNanos() - start);
+        }
+        // 落地紧急通道中的全部数据
+        void drainUrgent()
+        {
+            uint64_t queued;
+            RecordMeta meta;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _urgent_pending.store(false, std::memory_order_relaxed);
+                if(_urgent_producer.empty()) return;
+                _urgent_consumer.swap(_urgent_producer);
+                _urgent_held.store(true, std::memory_order_release);
+                queued = _urgent_since;
+                _urgent_since = 0;
+                meta = _urgent_meta;
+                _urgent_meta = RecordMeta();
+            }
+            if(_urgent_iov.size() < _urgent_consumer.chunkCount()) _urgent_iov.resize(_urgent_consumer.chunkCount());
+            int cnt = _urgent_consumer.readSpans(_urgent_iov.data(), (int)_urgent_iov.size());
+            consume(_urgent_iov.data(), cnt, _urgent_consumer.readAbleSize(), meta);
+            _urgent_bytes.add(_urgent_consumer.readAbleSize());
+            // 已经全部写出, 先撤销标记再归还块, 块归还后可能被释放
+            _urgent_held.store(false, std::memory_order_release);
+            _urgent_consumer.reset();
+            if(_urgent_hook) _urgent_hook();
+            if(queued != 0) _urgent_latency.record(monoNanos() - queued);
+        }
+        // 普通批次按片落地, 片尽量在换行处结束, 片间有紧急数据时先落地紧急通道
+        // 每片都带上整个批次的元数据; done: 每片写完后调用, 参数为该片字节数
+        void consumeSliced(const struct iovec *iov, int cnt, const RecordMeta &meta, const std::function<void(size_t)> &done)
+        {
+            int i = 0;
+            size_t off = 0;
+            while(i < cnt)
+            {
+                _slice.clear();
+                size_t n = 0;
+                int last_idx = i;
+                size_t last_off = off;
+                while(i < cnt && n < ASYNC_SLICE_SIZE)
+                {
+                    size_t take = std::min(iov[i].iov_len - off, (size_t)ASYNC_SLICE_SIZE - n);
+                    struct iovec piece = { (char *)iov[i].iov_base + off, take };
+                    _slice.push_back(piece);
+                    last_idx = i;
+                    last_off = off;
+                    n += take;
+                    off += take;
+                    if(off == iov[i].iov_len)
+                    {
+                        i++;
+                        off = 0;
+                    }
+                }
+                struct iovec &tail = _slice.back();
+                if(i < cnt && tail.iov_len > 0)
+                {
+                    // 片中最后一个换行之后的部分留给下一片, 记录不会被紧急数据隔开
+                    const char *nl = (const char *)memrchr(tail.iov_base, '\n', tail.iov_len);
+                    if(nl != nullptr)
+                    {
+                        size_t keep = nl + 1 - (const char *)tail.iov_base;
+                        n -= tail.iov_len - keep;
+                        tail.iov_len = keep;
+                        i = last_idx;
+                        off = last_off + keep;
+                        if(off == iov[i].iov_len)
+                        {
+                            i++;
+                            off = 0;
+                        }
+                    }
+                }
+                bool boundary = tail.iov_len > 0 && ((const char *)tail.iov_base)[tail.iov_len - 1] == '\n';
+                consume(_slice.data(), (int)_slice.size(), n, meta);
+                if(done) done(n);
+                if(boundary && _urgent_pending.load(std::memory_order_acquire)) drainUrgent();
+            }
+        }
+        // 定长模式: 取出可读区域后解锁落地, 每片写完就移动读位置把空间还给生产者, 不拷贝也不搬移
+        void ringEntry()
+        {
+            while(1)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if(!waitForData(lock, [this](){ return _ring.readAbleSize(); })) return;
+                }
+                drainUrgent();
+                struct iovec iov[2];
+                int cnt;
+                RecordMeta meta;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    cnt = _ring.readSpans(iov);
+                    meta = _normal_meta;
+                    _normal_meta = RecordMeta();
+                }
+                // 生产者只会写可读区域之后的空间, 这里在锁外读取是安全的
+                consumeSliced(iov, cnt, meta, [this](size_t n){
+                    {
+                        std::unique_lock<std::mutex> lock(_mutex);
+                        _ring.moveReadBack(n);
+                        _queued_bytes.set(_ring.readAbleSize());
+                    }
+                    _cond_producer.notify_all();
+                });
+            }
+        }
+        // 不定长模式: 交换双缓冲区
+        void swapEntry()
         {
             // 走到这里代表第一次进入和消费完_buffer_consumer，缓冲区都是没有数据的
+            RecordMeta meta;
             while(1)
             {
                 // lock的声明周期随 {}
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
-                    if(!_running && _buffer_producer.empty()) return;
-                    _cond_consumer.wait(lock, [&](){
-                        return !_running || !_buffer_producer.empty();
-                    });
+                    if(!waitForData(lock, [this](){ return _buffer_producer.readAbleSize(); })) return;
                     _buffer_consumer.swap(_buffer_producer);
+                    _consumer_held.store(true, std::memory_order_release);
+                    _queued_bytes.set(0);
+                    meta = _normal_meta;
+                    _normal_meta = RecordMeta();
                 }
-                // 交换缓冲区后唤醒生产者线程
-                _cond_producer.notify_all();
-                _callback(_buffer_consumer);
+                drainUrgent();
+                if(_iov.size() < _buffer_consumer.chunkCount()) _iov.resize(_buffer_consumer.chunkCount());
+                int cnt = _buffer_consumer.readSpans(_iov.data(), (int)_iov.size());
+                consumeSliced(_iov.data(), cnt, meta, std::function<void(size_t)>());
+                _consumer_held.store(false, std::memory_order_release);
                 _buffer_consumer.reset();
             }
         }
+        // 信号处理函数中使用, 栈上的iovec分批写出
+        static void crashDumpChunks(int fd, const ChunkBuffer &buffer)
+        {
+            struct iovec iov[16];
+            size_t first = 0;
+            while(first < buffer.chunkCount())
+            {
+                int cnt = buffer.readSpans(iov, 16, first);
+                if(cnt == 0) break;
+                util::File::writevAll(fd, iov, cnt);
+                first += cnt;
+            }
+        }
     private:
+        uint64_t _id; // 进程内唯一, 生产者线程用它查找自己的队列
+        // 有序模式的生产者队列, 增删由_mutex保护; 工作线程按版本号判断是否需要重新获取
+        std::vector<std::shared_ptr<Producer>> _producers;
+        uint32_t _producer_count;
+        std::atomic<uint64_t> _producers_version;
+        std::atomic<bool> _ordered_idle; // 工作线程即将等待, 生产者写入空队列时需要唤醒
+        uint64_t _last_emitted;          // 已经输出的最大时间戳
+        Counter _producers_gauge;
+        Counter _late;
         // 双缓冲区机制减少锁竞争
-        Buffer _buffer_producer; // 生产者缓冲区
-        Buffer _buffer_consumer; // 消费者缓冲区
-        std::thread _thread; // 异步工作线程
+        ChunkPool _pool; // 不定长模式的块池, 先于两个缓冲区构造
+        ChunkBuffer _buffer_producer; // 生产者缓冲区
+        ChunkBuffer _buffer_consumer; // 消费者缓冲区
+        ChunkBuffer _urgent_producer; // 紧急通道
+        ChunkBuffer _urgent_consumer;
+        std::vector<struct iovec> _iov; // 工作线程复用的段数组
+        std::vector<struct iovec> _urgent_iov;
+        std::vector<struct iovec> _slice;
+        uint64_t _urgent_since; // 紧急通道中最早一条数据的入队时间
+        RecordMeta _normal_meta; // 生产者缓冲区中数据的元数据, 由_mutex保护
+        RecordMeta _urgent_meta;
+        RingBuffer _ring; // 定长模式使用的环形缓冲区
         std::atomic<bool> _running; // 是否工作
+        // 消费者缓冲区从交换起到全部写出为止持有未落地的数据, 包括片间和先落地紧急通道的时候
+        std::atomic<bool> _consumer_held;
+        std::atomic<bool> _urgent_held; // 紧急批次从交换起到写出为止
+        std::atomic<bool> _urgent_pending; // 紧急通道有数据, 工作线程片间无锁检查
         Functor _callback; // 日志落地回调
+        PressureProbe _probe; // 落地方向是否受阻
+        UrgentHook _urgent_hook; // 紧急通道落地后的回调
+        // 连续重复记录的折叠状态, 由_mutex保护
+        uint64_t _dedup_window;  // 纳秒, 0表示不折叠
+        DedupHook _dedup_hook;
+        bool _dup_active;        // _dup_key是否有效
+        DedupKey _dup_key;       // 当前段的记录标识
+        uint64_t _dup_count;     // 当前段被折叠的条数
+        uint64_t _dup_start;     // 当前段第一条记录的时间
+        uint64_t _dup_last;      // 当前段最后一条记录的时间
+        AsyncLane _dup_lane;
+        RecordMeta _dup_meta;    // 当前段被折叠的记录的元数据
+        // 统计指标
+        Counter _queued_bytes; // 生产者缓冲区中的字节数
+        Counter _swaps;
+        Counter _batch_bytes;
+        LatencyHistogram _producer_wait;
+        LatencyHistogram _batch_latency;
+        Counter _urgent_bytes;
+        LatencyHistogram _urgent_latency;
+        Counter _dedup_suppressed;
+        Counter _urgent_overflow;
         std::mutex _mutex; 
         std::condition_variable _cond_producer;
         std::condition_variable _cond_consumer;
         AsyncType _is_safe;
+        std::thread _thread; // 异步工作线程, 最后初始化, 保证线程启动时其他成员已经就绪
     };
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <initializer_list>
+/*
+    线程私有的诊断上下文(MDC)
+        1. 在请求入口把请求id、租户等放进当前线程的上下文, 之后这个线程打出的每条日志都可以带上它们
+           MDC::Scope scope({ { "req", req_id }, { "tenant", tenant } });
+        2. 格式化器通过 %X{key} 输出一个值, %X 以 key=value 形式输出全部; JSON和logfmt格式化器把上下文作为字段输出
+        3. 整个上下文按输出方式(logfmt/JSON)渲染后缓存在线程上下文中, 每种方式一份, 与格式化器的个数无关
+           上下文变化时才重新生成, 平时每条日志只拷贝一次缓存的字符串; %X{key} 直接拷贝值
+        4. 日志在调用线程上格式化, 因此异步日志器同样可用; 工作线程中生成的汇总行不带上下文
+           跨线程格式化的记录(LogMsg::_thread为空, 如飞行记录器输出的历史)不输出上下文
+*/
+namespace logSys
+{
+    class MDC
+    {
+    public:
+        using Entries = std::vector<std::pair<std::string, std::string>>;
+        // 整个上下文的渲染方式
+        enum class Style
+        {
+            LOGFMT,
+            JSON,
+            COUNT
+        };
+        // 设置key的值, 值没变时不使缓存失效
+        static void put(const std::string &key, const std::string &value)
+        {
+            Context &ctx = context();
+            for(auto &e : ctx._entries)
+            {
+                if(e.first != key) continue;
+                if(e.second == value) return;
+                e.second = value;
+                ctx._version++;
+                return;
+            }
+            ctx._entries.emplace_back(key, value);
+            ctx._version++;
+        }
+        static void remove(const std::string &key)
+        {
+            Context &ctx = context();
+            for(auto it = ctx._entries.begin(); it != ctx._entries.end(); ++it)
+            {
+                if(it->first != key) continue;
+                ctx._entries.erase(it);
+                ctx._version++;
+                return;
+            }
+        }
+        static void clear()
+        {
+            Context &ctx = context();
+            if(ctx._entries.empty()) return;
+            ctx._entries.clear();
+            ctx._version++;
+        }
+        // 没有key时返回nullptr, 指针在上下文下次变化前有效
+        static const std::string *get(const std::string &key)
+        {
+            for(auto &e : context()._entries)
+            {
+                if(e.first == key) return &e.second;
+            }
+            return nullptr;
+        }
+        static const Entries &entries() { return context()._entries; }
+        // style方式的渲染结果, 上下文变化后第一次使用时调用render(out, entries)重新生成
+        // 同一方式的所有调用方必须使用同一个render
+        template<typename Render>
+        static const std::string &rendered(Style style, Render render)
+        {
+            Context &ctx = context();
+            Rendered &slot = ctx._rendered[(int)style];
+            if(slot._version != ctx._version)
+            {
+                slot._text.clear();
+                render(slot._text, ctx._entries);
+                slot._version = ctx._version;
+            }
+            return slot._text;
+        }
+        // 作用域守卫: 构造时设置, 析构时恢复为之前的值(之前没有则删除)
+        class Scope
+        {
+        public:
+            Scope(const std::string &key, const std::string &value)
+            {
+                set(key, value);
+            }
+            Scope(std::initializer_list<std::pair<std::string, std::string>> kvs)
+            {
+                for(auto &kv : kvs) set(kv.first, kv.second);
+            }
+            ~Scope()
+            {
+                // 逆序恢复, 同一个key设置多次时回到最早的值
+                for(auto it = _saved.rbegin(); it != _saved.rend(); ++it)
+                {
+                    if(it->_existed) put(it->_key, it->_value);
+                    else remove(it->_key);
+                }
+            }
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+        private:
+            struct Saved
+            {
+                std::string _key;
+                std::string _value;
+                bool _existed;
+            };
+            void set(const std::string &key, const std::string &value)
+            {
+                const std::string *old = get(key);
+                _saved.push_back(Saved{ key, old != nullptr ? *old : std::string(), old != nullptr });
+                put(key, value);
+            }
+            std::vector<Saved> _saved;
+        };
+    private:
+        struct Rendered
+        {
+            Rendered() :_version(0) {}
+            uint64_t _version; // 生成时上下文的版本, 0表示还没有生成
+            std::string _text;
+        };
+        struct Context
+        {
+            Context() :_version(1) {}
+            Entries _entries;           // 按第一次设置的顺序
+            uint64_t _version;          // 每次变化加一
+            Rendered _rendered[(int)Style::COUNT];
+        };
+        static Context &context()
+        {
+            static thread_local Context ctx;
+            return ctx;
+        }
+    };
+}
@@ -3,32 +3,100 @@
 */
 #include "level.hpp"
 #include "util.hpp"
+#include "metrics.hpp"
 #include <iostream>
 #include <string>
 #include <thread>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
 
 namespace logSys
 {
+    // 结构化日志字段: 只保存类型和值, 由格式化器直接编码, 字符串不拷贝
+    // 字段只在一次日志调用内有效
+    struct LogField
+    {
+        enum class Type
+        {
+            INT,
+            UINT,
+            DOUBLE,
+            BOOL,
+            STRING
+        };
+        template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+        LogField(const char *key, T value)
+        :_key(key), _type(Type::INT), _str(nullptr), _len(0)
+        { _value._i = value; }
+        template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+                                                     && !std::is_same<T, bool>::value, int>::type = 0>
+        LogField(const char *key, T value)
+        :_key(key), _type(Type::UINT), _str(nullptr), _len(0)
+        { _value._u = value; }
+        template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+        LogField(const char *key, T value)
+        :_key(key), _type(Type::DOUBLE), _str(nullptr), _len(0)
+        { _value._d = value; }
+        LogField(const char *key, bool value)
+        :_key(key), _type(Type::BOOL), _str(nullptr), _len(0)
+        { _value._b = value; }
+        LogField(const char *key, const char *value)
+        :_key(key), _type(Type::STRING), _str(value), _len(strlen(value))
+        {}
+        LogField(const char *key, const std::string &value)
+        :_key(key), _type(Type::STRING), _str(value.c_str()), _len(value.size())
+        {}
+        const char *_key;
+        Type _type;
+        union
+        {
+            int64_t _i;
+            uint64_t _u;
+            double _d;
+            bool _b;
+        } _value;
+        const char *_str; // 字符串值, 指向调用者的数据
+        size_t _len;
+    };
+
+    // 日志消息: 只保存指针和长度, 可以按位拷贝
+    // 文件名指向__FILE__字面量, 日志器名指向Logger持有的字符串, 消息内容由调用者在格式化完成前保持有效
     struct LogMsg
     {
         time_t _ctime;              // 日志创建时间戳
+        uint64_t _mono;             // 创建时的单调时钟纳秒数, 有序异步日志器按它排序
         LogLevel::Level _level;     // 日志等级
-        std::thread::id _pid;       // 日志线程id
+        pid_t _tid;                 // 日志线程的内核线程id
+        const util::ThreadInfo *_thread; // 创建日志的线程身份, 只在该线程内有效, 跨线程使用时为空
         size_t _line;               // 日志行号
-        std::string _file;          // 日志所在文件
-        std::string _name;        // 日志器名称
-        std::string _payload;       // 日志信息
-        LogMsg(LogLevel::Level level, size_t line, 
-               const std::string &file,
-               const std::string &name,
-               const std::string &payload)
+        const char *_file;          // 日志所在文件
+        const char *_name;          // 日志器名称
+        const char *_payload;       // 日志信息
+        size_t _payload_len;
+        const LogField *_fields;    // 结构化字段
+        size_t _field_count;
+        LogMsg(LogLevel::Level level, size_t line,
+               const char *file,
+               const char *name,
+               const char *payload,
+               size_t payload_len)
         :_ctime(util::Date::now())
+        ,_mono(monoNanos())
         ,_level(level)
-        ,_pid(std::this_thread::get_id())
+        ,_tid(util::Thread::tid())
+        ,_thread(&util::Thread::current())
         ,_line(line)
         ,_file(file)
         ,_name(name)
         ,_payload(payload)
+        ,_payload_len(payload_len)
+        ,_fields(nullptr)
+        ,_field_count(0)
+        {}
+        LogMsg(LogLevel::Level level, size_t line, const char *file, const char *name, const char *payload)
+        :LogMsg(level, line, file, name, payload, strlen(payload))
         {}
     };
+    static_assert(std::is_trivially_copyable<LogMsg>::value, "LogMsg必须可以按位拷贝");
 }
\ No newline at end of file
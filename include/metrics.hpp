@@ -0,0 +1,261 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <utility>
+#include <chrono>
+/*
+    日志系统自身的统计指标
+        1. 计数器: 单个原子变量, 只做relaxed加法
+        2. 延迟直方图: 按2的幂分桶, 记录只需几次原子加
+        3. 快照: 把各处的计数器和直方图收集到一起, 可以查询或输出为Prometheus文本格式
+*/
+namespace logSys
+{
+    class Counter
+    {
+    public:
+        Counter() :_value(0) {}
+        void add(uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+        void set(uint64_t n) { _value.store(n, std::memory_order_relaxed); }
+        uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+    private:
+        std::atomic<uint64_t> _value;
+    };
+    // 计时辅助, 返回单调时钟纳秒数
+    inline uint64_t monoNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    class LatencyHistogram
+    {
+    public:
+        static const size_t BUCKETS = 40; // 第i个桶记录 [2^(i-1), 2^i) 纳秒, 最后一个桶兜底
+        LatencyHistogram()
+        :_count(0), _sum(0), _max(0)
+        {
+            for(auto &b : _buckets) b.store(0, std::memory_order_relaxed);
+        }
+        void record(uint64_t ns)
+        {
+            size_t idx = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+            if(idx >= BUCKETS) idx = BUCKETS - 1;
+            _buckets[idx].fetch_add(1, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+            _sum.fetch_add(ns, std::memory_order_relaxed);
+            uint64_t old = _max.load(std::memory_order_relaxed);
+            while(ns > old && !_max.compare_exchange_weak(old, ns, std::memory_order_relaxed));
+        }
+        uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+        uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+        uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+        uint64_t bucket(size_t idx) const { return _buckets[idx].load(std::memory_order_relaxed); }
+        // 桶的上界(纳秒)
+        static uint64_t bucketBound(size_t idx) { return idx == 0 ? 0 : (1ULL << idx) - 1; }
+        // 百分位数, 返回所在桶的上界, p取值(0, 1]
+        uint64_t percentile(double p) const
+        {
+            uint64_t total = count();
+            if(total == 0) return 0;
+            uint64_t target = (uint64_t)(total * p);
+            if(target == 0) target = 1;
+            uint64_t acc = 0;
+            for(size_t i = 0; i < BUCKETS; i++)
+            {
+                acc += bucket(i);
+                if(acc >= target) return bucketBound(i) < max() ? bucketBound(i) : max();
+            }
+            return max();
+        }
+        // 打印非空桶
+        void print(std::ostream &os, const std::string &title) const
+        {
+            uint64_t total = count();
+            os << title << ": 次数 " << total;
+            if(total == 0)
+            {
+                os << std::endl;
+                return;
+            }
+            os << " 平均 " << sum() / total << "ns p50 " << percentile(0.5)
+               << "ns p99 " << percentile(0.99) << "ns 最大 " << max() << "ns" << std::endl;
+            for(size_t i = 0; i < BUCKETS; i++)
+            {
+                uint64_t n = bucket(i);
+                if(n == 0) continue;
+                os << "  <= " << bucketBound(i) << "ns: " << n << std::endl;
+            }
+        }
+    private:
+        std::atomic<uint64_t> _buckets[BUCKETS];
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _sum;
+        std::atomic<uint64_t> _max;
+    };
+
+    // 指标快照: 收集时复制数值, 之后的查询和输出不再访问原子变量
+    class MetricsSnapshot
+    {
+    public:
+        using Labels = std::vector<std::pair<std::string, std::string>>;
+        enum class Type
+        {
+            COUNTER,
+            GAUGE,
+            HISTOGRAM
+        };
+        struct Sample
+        {
+            Type _type;
+            std::string _name;
+            std::string _help;
+            Labels _labels;
+            double _value;                 // 计数器/仪表的值
+            std::vector<uint64_t> _buckets; // 直方图各桶的次数(非累计), 与LatencyHistogram分桶一致
+            uint64_t _count;
+            uint64_t _sum;                 // 纳秒
+        };
+        void counter(const std::string &name, const std::string &help, const Labels &labels, uint64_t value)
+        {
+            add(Type::COUNTER, name, help, labels, (double)value);
+        }
+        void gauge(const std::string &name, const std::string &help, const Labels &labels, double value)
+        {
+            add(Type::GAUGE, name, help, labels, value);
+        }
+        void histogram(const std::string &name, const std::string &help, const Labels &labels, const LatencyHistogram &hist)
+        {
+            Sample &s = add(Type::HISTOGRAM, name, help, labels, 0);
+            s._buckets.resize(LatencyHistogram::BUCKETS);
+            for(size_t i = 0; i < LatencyHistogram::BUCKETS; i++) s._buckets[i] = hist.bucket(i);
+            s._count = hist.count();
+            s._sum = hist.sum();
+        }
+        const std::vector<Sample> &samples() const { return _samples; }
+        // 按名字和标签查找, 找不到返回nullptr
+        const Sample *find(const std::string &name, const Labels &labels = Labels()) const
+        {
+            for(auto &s : _samples)
+            {
+                if(s._name == name && s._labels == labels) return &s;
+            }
+            return nullptr;
+        }
+        // Prometheus文本格式, 直方图单位为秒
+        std::string toPrometheus() const
+        {
+            std::ostringstream os;
+            os.precision(15);
+            std::vector<bool> done(_samples.size(), false);
+            for(size_t i = 0; i < _samples.size(); i++)
+            {
+                if(done[i]) continue;
+                const Sample &head = _samples[i];
+                os << "# HELP " << head._name << " " << head._help << "\n";
+                os << "# TYPE " << head._name << " " << typeName(head._type) << "\n";
+                // 同名指标必须连续输出
+                for(size_t j = i; j < _samples.size(); j++)
+                {
+                    if(done[j] || _samples[j]._name != head._name) continue;
+                    done[j] = true;
+                    writeSample(os, _samples[j]);
+                }
+            }
+            return os.str();
+        }
+    private:
+        Sample &add(Type type, const std::string &name, const std::string &help, const Labels &labels, double value)
+        {
+            _samples.push_back(Sample());
+            Sample &s = _samples.back();
+            s._type = type;
+            s._name = name;
+            s._help = help;
+            s._labels = labels;
+            s._value = value;
+            s._count = 0;
+            s._sum = 0;
+            return s;
+        }
+        static const char *typeName(Type type)
+        {
+            switch(type)
+            {
+            case Type::COUNTER: return "counter";
+            case Type::GAUGE: return "gauge";
+            case Type::HISTOGRAM: return "histogram";
+            }
+            return "untyped";
+        }
+        // 输出标签, extra为直方图的le标签
+        static void writeLabels(std::ostream &os, const Labels &labels, const std::string &extra = "")
+        {
+            if(labels.empty() && extra.empty()) return;
+            os << "{";
+            bool first = true;
+            for(auto &kv : labels)
+            {
+                if(!first) os << ",";
+                first = false;
+                os << kv.first << "=\"";
+                for(char c : kv.second)
+                {
+                    if(c == '\\' || c == '"') os << '\\' << c;
+                    else if(c == '\n') os << "\\n";
+                    else os << c;
+                }
+                os << "\"";
+            }
+            if(!extra.empty()) os << (first ? "" : ",") << extra;
+            os << "}";
+        }
+        static void writeSample(std::ostream &os, const Sample &s)
+        {
+            if(s._type != Type::HISTOGRAM)
+            {
+                os << s._name;
+                writeLabels(os, s._labels);
+                if(s._type == Type::COUNTER) os << " " << (uint64_t)s._value << "\n";
+                else os << " " << s._value << "\n";
+                return;
+            }
+            // 只输出到最后一个非空桶, 其余由+Inf覆盖
+            size_t last = 0;
+            for(size_t i = 0; i < s._buckets.size(); i++)
+            {
+                if(s._buckets[i] != 0) last = i;
+            }
+            // 各桶和总数不是同一时刻读到的, +Inf取两者较大值保证单调
+            uint64_t total = s._count;
+            uint64_t acc = 0;
+            for(size_t i = 0; i < s._buckets.size(); i++) acc += s._buckets[i];
+            if(acc > total) total = acc;
+            acc = 0;
+            for(size_t i = 0; i <= last && i < s._buckets.size(); i++)
+            {
+                acc += s._buckets[i];
+                std::ostringstream le;
+                le.precision(15);
+                le << "le=\"" << LatencyHistogram::bucketBound(i) / 1e9 << "\"";
+                os << s._name << "_bucket";
+                writeLabels(os, s._labels, le.str());
+                os << " " << acc << "\n";
+            }
+            os << s._name << "_bucket";
+            writeLabels(os, s._labels, "le=\"+Inf\"");
+            os << " " << total << "\n";
+            os << s._name << "_sum";
+            writeLabels(os, s._labels);
+            os << " " << s._sum / 1e9 << "\n";
+            os << s._name << "_count";
+            writeLabels(os, s._labels);
+            os << " " << total << "\n";
+        }
+    private:
+        std::vector<Sample> _samples;
+    };
+}
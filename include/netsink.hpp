@@ -0,0 +1,544 @@
+#pragma once
+#include "sink.hpp"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+/*
+    网络日志落地类
+        1. TCP: 整批数据(包括工作器交来的多段iovec)一次sendmsg发出, 对端不可用时写入磁盘溢出文件, 恢复后按顺序补发
+        2. UDP: 每行一个数据报, 用sendmmsg一次发出整批
+        3. 所有socket操作都是非阻塞的, 断线按指数退避重连, 不会卡住写入线程
+        4. 对端不可用或发送受阻时backpressured()返回true, 由异步工作器延迟下一批以攒更大的批次
+        5. 只按整行发送和溢出: 被切开的一行剩余部分只在同一个连接上接着发, 连接断开则丢弃这一行的剩余部分;
+           溢出文件满时丢弃放不下的整行
+        6. 溢出文件开头8字节记录已补发到的位置, 重启后从这里继续; 进程在补发途中退出时最多重发一批
+    注意: 没有应用层确认, 每批发送前会检查对端是否已关闭; 但发送之后才断开时, 已进入内核发送缓冲区的数据可能丢失
+*/
+namespace logSys
+{
+    enum class NetProto
+    {
+        TCP,
+        UDP
+    };
+    class NetSink : public LogSink
+    {
+    public:
+        using ptr = std::shared_ptr<NetSink>;
+        static const size_t UDP_MAX_DATAGRAM = 60000; // 单个数据报上限, 超长的行被切开
+        // spill_path为空时不使用溢出文件, 对端不可用期间的数据直接丢弃
+        NetSink(const std::string &host, uint16_t port, NetProto proto = NetProto::TCP,
+                const std::string &spill_path = "", size_t spill_max = 64 * 1024 * 1024)
+        :_host(host), _port(port), _proto(proto), _fd(-1), _state(State::DISCONNECTED),
+        _addr_len(0), _backoff_ms(MIN_BACKOFF_MS), _next_retry(std::chrono::steady_clock::now()),
+        _spill_fd(-1), _spill_max(spill_max), _spill_read(0), _spill_write(0)
+        {
+            resolve();
+            if(!spill_path.empty() && proto == NetProto::TCP)
+            {
+                util::File::createDirectory(util::File::path(spill_path));
+                _spill_fd = open(spill_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+                assert(_spill_fd >= 0);
+                // 上次运行没有发出去的数据在连上后补发
+                loadSpill();
+                _spill_backlog.set(_spill_write - _spill_read);
+            }
+            connect();
+        }
+        ~NetSink()
+        {
+            if(_fd >= 0) close(_fd);
+            if(_spill_fd >= 0) close(_spill_fd);
+        }
+        void log(const char* data, size_t len) override
+        {
+            struct iovec iov = { (void *)data, len };
+            log(&iov, 1);
+        }
+        // 批次由整行组成, 但一行可能跨越两段(环形缓冲区回绕)
+        void log(const struct iovec *iov, int cnt) override
+        {
+            if(_proto == NetProto::UDP)
+            {
+                // 按行切分数据报需要连续的内存, 多段时由基类拼接后再调用单段的log
+                if(cnt == 1) sendDatagrams((const char *)iov[0].iov_base, iov[0].iov_len);
+                else LogSink::log(iov, cnt);
+                return;
+            }
+            size_t len = 0;
+            for(int i = 0; i < cnt; i++) len += iov[i].iov_len;
+            if(!ensureConnected() || !flushTail() || !drainSpill())
+            {
+                spill(iov, cnt);
+            }
+            else
+            {
+                size_t sent = sendStream(iov, cnt);
+                if(sent < len) keepUnsent(iov, cnt, sent);
+            }
+            _spill_backlog.set(_spill_write - _spill_read);
+        }
+        bool backpressured() const override
+        {
+            return _state != State::CONNECTED || _spill_read != _spill_write || !_tail.empty();
+        }
+        // 因为没有溢出空间而丢弃的字节数
+        uint64_t dropped() const { return _dropped.value(); }
+        bool connected() const { return _state == State::CONNECTED; }
+        std::string describe() const override
+        {
+            return std::string(_proto == NetProto::TCP ? "tcp://" : "udp://") + _host + ":" + std::to_string(_port);
+        }
+        void collectMetrics(MetricsSnapshot &snap, const MetricsSnapshot::Labels &labels) const override
+        {
+            LogSink::collectMetrics(snap, labels);
+            snap.counter("logsys_sink_dropped_bytes_total", "Bytes dropped by the sink", labels, _dropped.value());
+            snap.gauge("logsys_sink_spill_bytes", "Bytes waiting in the spill file", labels, (double)_spill_backlog.value());
+        }
+    private:
+        enum class State
+        {
+            DISCONNECTED,
+            CONNECTING,
+            CONNECTED
+        };
+        static const int MIN_BACKOFF_MS = 100;
+        static const int MAX_BACKOFF_MS = 30 * 1000;
+        static const size_t SPILL_CHUNK = 64 * 1024; // 每次补发的块大小
+        static const size_t SPILL_BUDGET = 1024 * 1024; // 每批最多补发的字节数, 避免长时间占用写入线程
+        static const size_t SPILL_HEADER = 8; // 溢出文件开头保存已补发到的位置, 数据从这之后开始
+        static const int IOV_BATCH = 64; // 每次sendmsg最多的iovec段数
+
+        void resolve()
+        {
+            struct addrinfo hints, *res = nullptr;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = _proto == NetProto::TCP ? SOCK_STREAM : SOCK_DGRAM;
+            std::string port = std::to_string(_port);
+            if(getaddrinfo(_host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr)
+            {
+                std::cout << "解析日志服务器地址失败: " << _host << std::endl;
+                return;
+            }
+            memcpy(&_addr, res->ai_addr, res->ai_addrlen);
+            _addr_len = res->ai_addrlen;
+            freeaddrinfo(res);
+        }
+        // 发起非阻塞连接
+        void connect()
+        {
+            if(_addr_len == 0)
+            {
+                resolve();
+                if(_addr_len == 0)
+                {
+                    scheduleRetry();
+                    return;
+                }
+            }
+            int type = _proto == NetProto::TCP ? SOCK_STREAM : SOCK_DGRAM;
+            _fd = socket(_addr.ss_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(_fd < 0)
+            {
+                scheduleRetry();
+                return;
+            }
+            if(_proto == NetProto::TCP)
+            {
+                int one = 1;
+                setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            if(::connect(_fd, (struct sockaddr *)&_addr, _addr_len) == 0)
+            {
+                onConnected();
+            }
+            else if(errno == EINPROGRESS)
+            {
+                _state = State::CONNECTING;
+            }
+            else
+            {
+                disconnect();
+            }
+        }
+        void onConnected()
+        {
+            _state = State::CONNECTED;
+            _backoff_ms = MIN_BACKOFF_MS;
+        }
+        void disconnect()
+        {
+            // 被切开的那一行在新连接上发不完整, 丢弃剩余部分
+            _dropped.add(_tail.size());
+            _tail.clear();
+            if(_fd >= 0) close(_fd);
+            _fd = -1;
+            _state = State::DISCONNECTED;
+            scheduleRetry();
+        }
+        void scheduleRetry()
+        {
+            _next_retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(_backoff_ms);
+            _backoff_ms = _backoff_ms * 2 > MAX_BACKOFF_MS ? MAX_BACKOFF_MS : _backoff_ms * 2;
+        }
+        // 推进连接状态, 已连接返回true, 不会阻塞
+        bool ensureConnected()
+        {
+            if(_state == State::DISCONNECTED)
+            {
+                if(std::chrono::steady_clock::now() < _next_retry) return false;
+                connect();
+            }
+            if(_state == State::CONNECTING)
+            {
+                struct pollfd pfd = { _fd, POLLOUT, 0 };
+                if(poll(&pfd, 1, 0) <= 0) return false;
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if(getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+                {
+                    disconnect();
+                    return false;
+                }
+                onConnected();
+            }
+            else if(_state == State::CONNECTED && peerClosed())
+            {
+                // 对端已关闭: 本批写入溢出文件, 而不是发进一个已经断开的连接里丢掉
+                disconnect();
+                return false;
+            }
+            return _state == State::CONNECTED;
+        }
+        // 日志服务器不会发数据过来, 连接可读或挂断只可能是对端已关闭或出错
+        bool peerClosed()
+        {
+            struct pollfd pfd = { _fd, POLLIN | POLLRDHUP, 0 };
+            if(poll(&pfd, 1, 0) <= 0) return false;
+            return (pfd.revents & (POLLIN | POLLRDHUP | POLLHUP | POLLERR)) != 0;
+        }
+        // 尽量发送, 返回已发送字节数; 连接出错时断开
+        size_t sendStream(const struct iovec *iov, int cnt)
+        {
+            size_t sent = 0;
+            size_t off = 0; // 在iov[idx]中已发送的字节数
+            int idx = 0;
+            while(idx < cnt)
+            {
+                if(off == iov[idx].iov_len)
+                {
+                    idx++;
+                    off = 0;
+                    continue;
+                }
+                struct iovec vec[IOV_BATCH];
+                int n = 0;
+                vec[n].iov_base = (char *)iov[idx].iov_base + off;
+                vec[n++].iov_len = iov[idx].iov_len - off;
+                for(int i = idx + 1; i < cnt && n < IOV_BATCH; i++) vec[n++] = iov[i];
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = vec;
+                msg.msg_iovlen = n;
+                ssize_t ret = sendmsg(_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if(ret < 0)
+                {
+                    if(errno == EINTR) continue;
+                    if(errno != EAGAIN && errno != EWOULDBLOCK) disconnect();
+                    break;
+                }
+                sent += ret;
+                size_t adv = ret;
+                while(adv > 0)
+                {
+                    size_t left = iov[idx].iov_len - off;
+                    if(adv < left)
+                    {
+                        off += adv;
+                        break;
+                    }
+                    adv -= left;
+                    idx++;
+                    off = 0;
+                }
+            }
+            return sent;
+        }
+        size_t sendStream(const char *data, size_t len)
+        {
+            struct iovec iov = { (void *)data, len };
+            return sendStream(&iov, 1);
+        }
+        // rest为刚才没有发出的数据, boundary表示它从一行的开头开始
+        // 不是整行时, 被切开那一行的剩余部分留在_tail中由同一个连接接着发(连接已断开则丢弃), 之后的整行写入溢出文件
+        void keepRest(const char *rest, size_t len, bool boundary)
+        {
+            size_t cut = 0;
+            if(!boundary)
+            {
+                const char *nl = (const char *)memchr(rest, '\n', len);
+                cut = nl != nullptr ? nl - rest + 1 : len;
+                if(_state == State::CONNECTED) _tail.assign(rest, cut);
+                else _dropped.add(cut);
+            }
+            spill(rest + cut, len - cut);
+        }
+        // 批次只发出了前sent字节
+        void keepUnsent(const struct iovec *iov, int cnt, size_t sent)
+        {
+            util::ThreadBuffer buf;
+            std::string &rest = buf.str();
+            bool boundary = true;
+            size_t skip = sent;
+            for(int i = 0; i < cnt; i++)
+            {
+                const char *p = (const char *)iov[i].iov_base;
+                size_t n = iov[i].iov_len;
+                if(skip >= n)
+                {
+                    if(n > 0) boundary = p[n - 1] == '\n';
+                    skip -= n;
+                    continue;
+                }
+                if(skip > 0) boundary = p[skip - 1] == '\n';
+                rest.append(p + skip, n - skip);
+                skip = 0;
+            }
+            keepRest(rest.data(), rest.size(), boundary);
+        }
+        // 先发完上一批被切开的那一行, 发完且仍然连着返回true
+        bool flushTail()
+        {
+            if(!_tail.empty())
+            {
+                size_t sent = sendStream(_tail.data(), _tail.size());
+                _tail.erase(0, sent);
+            }
+            return _tail.empty() && _state == State::CONNECTED;
+        }
+        // 先补发溢出文件中的旧数据, 全部发完且仍然连着返回true
+        bool drainSpill()
+        {
+            if(_spill_read == _spill_write) return true;
+            size_t budget = SPILL_BUDGET;
+            if(_spill_buf.empty()) _spill_buf.resize((size_t)SPILL_CHUNK);
+            while(_spill_read < _spill_write && budget > 0)
+            {
+                size_t want = _spill_write - _spill_read;
+                if(want > SPILL_CHUNK) want = SPILL_CHUNK;
+                ssize_t n = pread(_spill_fd, &_spill_buf[0], want, SPILL_HEADER + _spill_read);
+                if(n <= 0)
+                {
+                    // 溢出文件损坏, 放弃剩余数据
+                    _dropped.add(_spill_write - _spill_read);
+                    _spill_read = _spill_write;
+                    break;
+                }
+                // 每块只含整行, 单行超过块大小时才整块发出
+                if(_spill_read + n < _spill_write)
+                {
+                    const char *nl = (const char *)memrchr(&_spill_buf[0], '\n', n);
+                    if(nl != nullptr) n = nl - &_spill_buf[0] + 1;
+                }
+                size_t sent = sendStream(&_spill_buf[0], n);
+                _spill_read += sent;
+                budget = budget > sent ? budget - sent : 0;
+                if(sent < (size_t)n)
+                {
+                    if(sent > 0 && _spill_buf[sent - 1] != '\n')
+                    {
+                        // 被切开那一行的剩余部分移到_tail, 补发位置停在整行的边界上
+                        const char *rest = &_spill_buf[sent];
+                        const char *nl = (const char *)memchr(rest, '\n', n - sent);
+                        size_t cut = nl != nullptr ? nl - rest + 1 : n - sent;
+                        if(_state == State::CONNECTED) _tail.assign(rest, cut);
+                        else _dropped.add(cut);
+                        _spill_read += cut;
+                    }
+                    break;
+                }
+            }
+            if(_spill_read < _spill_write)
+            {
+                saveSpillRead();
+                return false;
+            }
+            // 全部补发完毕, 清空文件重新开始
+            resetSpill();
+            return _tail.empty() && _state == State::CONNECTED;
+        }
+        void spill(const struct iovec *iov, int cnt)
+        {
+            if(cnt == 1)
+            {
+                spill((const char *)iov[0].iov_base, iov[0].iov_len);
+                return;
+            }
+            util::ThreadBuffer buf;
+            for(int i = 0; i < cnt; i++) buf.str().append((const char *)iov[i].iov_base, iov[i].iov_len);
+            spill(buf.str().data(), buf.str().size());
+        }
+        // data由整行组成, 只写入放得下的整行, 其余丢弃并计数
+        void spill(const char *data, size_t len)
+        {
+            if(len == 0) return;
+            if(_spill_fd < 0)
+            {
+                _dropped.add(len);
+                return;
+            }
+            size_t room = _spill_max > _spill_write ? _spill_max - _spill_write : 0;
+            size_t keep = len;
+            if(keep > room)
+            {
+                const char *nl = room > 0 ? (const char *)memrchr(data, '\n', room) : nullptr;
+                keep = nl != nullptr ? nl - data + 1 : 0;
+            }
+            size_t done = 0;
+            while(done < keep)
+            {
+                ssize_t n = pwrite(_spill_fd, data + done, keep - done, SPILL_HEADER + _spill_write + done);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) break;
+                done += n;
+            }
+            if(done < keep)
+            {
+                // 写入出错: 退回到最后一个整行, 后面写了一半的数据之后会被覆盖
+                const char *nl = done > 0 ? (const char *)memrchr(data, '\n', done) : nullptr;
+                done = nl != nullptr ? nl - data + 1 : 0;
+            }
+            _spill_write += done;
+            _dropped.add(len - done);
+        }
+        // 读出上次运行留下的补发位置; 文件末尾写了一半的行(上次写溢出文件时崩溃)不补发
+        void loadSpill()
+        {
+            struct stat st;
+            uint64_t read_pos = 0;
+            if(fstat(_spill_fd, &st) != 0 || (size_t)st.st_size < SPILL_HEADER ||
+               pread(_spill_fd, &read_pos, sizeof(read_pos), 0) != (ssize_t)sizeof(read_pos))
+            {
+                resetSpill();
+                return;
+            }
+            _spill_write = st.st_size - SPILL_HEADER;
+            // 位置不可信时从头补发, 宁可重复也不丢
+            _spill_read = read_pos <= _spill_write ? read_pos : 0;
+            if(_spill_read == _spill_write) return;
+            size_t want = _spill_write - _spill_read;
+            if(want > SPILL_CHUNK) want = SPILL_CHUNK;
+            std::vector<char> buf(want);
+            ssize_t n = pread(_spill_fd, &buf[0], want, SPILL_HEADER + _spill_write - want);
+            if(n != (ssize_t)want) return;
+            const char *nl = (const char *)memrchr(&buf[0], '\n', want);
+            if(nl != nullptr) _spill_write = _spill_write - want + (nl - &buf[0] + 1);
+        }
+        void saveSpillRead()
+        {
+            uint64_t read_pos = _spill_read;
+            if(pwrite(_spill_fd, &read_pos, sizeof(read_pos), 0) != (ssize_t)sizeof(read_pos))
+            {
+                std::cout << "更新溢出文件补发位置失败" << std::endl;
+            }
+        }
+        void resetSpill()
+        {
+            _spill_read = _spill_write = 0;
+            if(ftruncate(_spill_fd, SPILL_HEADER) != 0)
+            {
+                std::cout << "清空溢出文件失败" << std::endl;
+            }
+            saveSpillRead();
+        }
+        // UDP: 按行切分, 每行一个数据报, 一次sendmmsg发出多个
+        void sendDatagrams(const char *data, size_t len)
+        {
+            if(_fd < 0)
+            {
+                if(std::chrono::steady_clock::now() < _next_retry)
+                {
+                    _dropped.add(len);
+                    return;
+                }
+                connect();
+                if(_fd < 0)
+                {
+                    _dropped.add(len);
+                    return;
+                }
+                _state = State::CONNECTED;
+            }
+            const size_t BATCH = 64;
+            struct mmsghdr msgs[BATCH];
+            struct iovec iovs[BATCH];
+            while(len > 0)
+            {
+                size_t count = 0, bytes = 0;
+                const char *p = data;
+                size_t left = len;
+                while(left > 0 && count < BATCH)
+                {
+                    size_t n = left;
+                    if(n > UDP_MAX_DATAGRAM) n = UDP_MAX_DATAGRAM;
+                    const char *nl = (const char *)memchr(p, '\n', n);
+                    if(nl != nullptr) n = nl - p + 1;
+                    iovs[count].iov_base = (void *)p;
+                    iovs[count].iov_len = n;
+                    memset(&msgs[count], 0, sizeof(msgs[count]));
+                    msgs[count].msg_hdr.msg_iov = &iovs[count];
+                    msgs[count].msg_hdr.msg_iovlen = 1;
+                    count++;
+                    p += n;
+                    left -= n;
+                }
+                int sent = sendmmsg(_fd, msgs, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if(sent < 0)
+                {
+                    if(errno == EINTR) continue;
+                    // 对端端口不可达等错误只影响本批, 丢弃后继续
+                    sent = 0;
+                }
+                for(int i = 0; i < sent; i++) bytes += iovs[i].iov_len;
+                if(sent < (int)count)
+                {
+                    // 发送缓冲区满: 丢弃剩余数据, 不阻塞写入线程
+                    _dropped.add(len - bytes);
+                    return;
+                }
+                data += bytes;
+                len -= bytes;
+            }
+        }
+    private:
+        std::string _host;
+        uint16_t _port;
+        NetProto _proto;
+        int _fd;
+        State _state;
+        struct sockaddr_storage _addr;
+        socklen_t _addr_len;
+        int _backoff_ms; // 当前重连间隔
+        std::chrono::steady_clock::time_point _next_retry;
+        int _spill_fd; // 溢出文件
+        size_t _spill_max;
+        size_t _spill_read;  // 已补发到的位置
+        size_t _spill_write; // 已写入到的位置
+        std::vector<char> _spill_buf; // 补发时的读缓冲
+        std::string _tail; // 被切开那一行还没发出的部分, 只能在当前连接上发
+        Counter _dropped;
+        Counter _spill_backlog; // 溢出文件中待补发的字节数, 供指标读取
+    };
+}
@@ -0,0 +1,362 @@
+#pragma once
+#include "level.hpp"
+#include "message.hpp"
+#include "formatter.hpp"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+/*
+    飞行记录器
+        1. 低于日志器输出等级的日志不落地, 只把原始参数写入内存环形缓冲区, 不经过格式化器
+        2. 出现触发等级(默认ERROR)以上的日志时, 把环中还没输出过的记录格式化后放在这条日志前面一起落地
+        3. 写入无锁: 原子递增领取槽位, 每个槽位用序号做顺序锁, 读者发现槽位正在写或被覆盖就跳过
+        4. printf风格的记录延迟格式化: 写入时只按格式串取出参数, 格式串和字符串参数拷贝进槽位(指针可能失效),
+           输出时再逐个转换格式化; 位置参数、%n、宽字符、long double或参数过多时退回写入时格式化
+*/
+namespace logSys
+{
+    class FlightRecorder
+    {
+    public:
+        using ptr = std::shared_ptr<FlightRecorder>;
+        static const size_t PAYLOAD_SIZE = 200; // 单条记录消息的最大长度, 超出截断
+        // slots: 环中保留的记录条数, 向上取整为2的幂
+        // trigger: 达到该等级时输出环中的记录; record: 低于该等级的日志不记录
+        FlightRecorder(size_t slots = 1024,
+                       LogLevel::Level trigger = LogLevel::Level::ERROR,
+                       LogLevel::Level record = LogLevel::Level::DEBUG)
+        :_trigger(trigger), _record(record), _slots(roundUp(slots)), _mask(_slots.size() - 1),
+        _head(0), _dumped(0)
+        {}
+        LogLevel::Level triggerLevel() const { return _trigger; }
+        bool shouldRecord(LogLevel::Level level) const { return level >= _record; }
+        static const size_t MAX_ARGS = 8; // 延迟格式化最多保存的参数个数('*'宽度和精度也算)
+        // 记录一条日志, 只取出参数不格式化, 不分配内存
+        void record(LogLevel::Level level, const char *file, size_t line, const char *fmt, va_list al)
+        {
+            uint64_t ticket;
+            Slot &slot = acquire(level, file, line, ticket);
+            va_list args;
+            va_copy(args, al);
+            slot._lazy = capture(slot, fmt, args);
+            va_end(args);
+            if(!slot._lazy)
+            {
+                int n = vsnprintf(slot._payload, PAYLOAD_SIZE, fmt, al);
+                slot._len = n < 0 ? 0 : (n < (int)PAYLOAD_SIZE ? n : PAYLOAD_SIZE - 1);
+            }
+            slot._seq.store(ticket * 2 + 2, std::memory_order_release);
+        }
+        // 记录已经格式化好的消息
+        void record(LogLevel::Level level, const char *file, size_t line, const char *msg, size_t len)
+        {
+            uint64_t ticket;
+            Slot &slot = acquire(level, file, line, ticket);
+            slot._lazy = false;
+            slot._len = len < PAYLOAD_SIZE ? len : PAYLOAD_SIZE - 1;
+            memcpy(slot._payload, msg, slot._len);
+            slot._seq.store(ticket * 2 + 2, std::memory_order_release);
+        }
+        void record(LogLevel::Level level, const char *file, size_t line, const char *msg)
+        {
+            record(level, file, line, msg, strlen(msg));
+        }
+        // 记录序号区间[first, second)
+        using Range = std::pair<uint64_t, uint64_t>;
+        // 领取上次输出之后的记录, 之后的触发不会再输出它们
+        Range claim()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            uint64_t head = _head.load(std::memory_order_acquire);
+            uint64_t begin = head > _slots.size() ? head - _slots.size() : 0;
+            if(begin < _dumped) begin = _dumped;
+            _dumped = head;
+            return Range(begin, head);
+        }
+        // 把上次输出之后的记录格式化追加到out, 只在触发时调用
+        void dump(Formatter &formatter, const char *logger_name, std::string &out)
+        {
+            dump(claim(), formatter, logger_name, out);
+        }
+        // 把区间内仍然有效的记录格式化追加到out, 低于min_level的记录跳过
+        // 同一区间可以用不同的格式化器输出多次
+        void dump(const Range &range, Formatter &formatter, const char *logger_name, std::string &out,
+                  LogLevel::Level min_level = LogLevel::Level::UNKNOWN)
+        {
+            uint64_t head = _head.load(std::memory_order_acquire);
+            uint64_t begin = range.first;
+            if(head > _slots.size() && begin < head - _slots.size()) begin = head - _slots.size();
+            for(uint64_t ticket = begin; ticket < range.second; ticket++)
+            {
+                Slot &slot = _slots[ticket & _mask];
+                uint64_t seq = slot._seq.load(std::memory_order_acquire);
+                if(seq != ticket * 2 + 2) continue; // 正在写或已经被新记录覆盖
+                time_t ctime = slot._ctime;
+                LogLevel::Level level = slot._level;
+                pid_t tid = slot._tid;
+                const char *file = slot._file;
+                size_t line = slot._line;
+                size_t len = slot._len;
+                bool lazy = slot._lazy;
+                Arg args[MAX_ARGS];
+                memcpy(args, slot._args, sizeof(args));
+                char payload[PAYLOAD_SIZE];
+                memcpy(payload, slot._payload, len);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(slot._seq.load(std::memory_order_relaxed) != seq) continue;
+                if(level < min_level) continue;
+                char text[PAYLOAD_SIZE];
+                if(lazy) len = render(payload, args, text);
+                LogMsg msg(level, line, file, logger_name, lazy ? text : payload, len);
+                msg._ctime = ctime;
+                msg._tid = tid;
+                msg._thread = nullptr; // 记录可能来自已经退出的线程
+                formatter.format(out, msg);
+            }
+        }
+    private:
+        static size_t roundUp(size_t n)
+        {
+            size_t cap = 2;
+            while(cap < n) cap <<= 1;
+            return cap;
+        }
+        // 延迟格式化保存的一个参数; 整数统一扩展为64位, 字符串保存在槽位消息区中的位置
+        union Arg
+        {
+            long long _i;
+            unsigned long long _u;
+            double _d;
+            const void *_p;
+            size_t _off;
+        };
+        // 一个printf转换说明, 各部分是格式串中的区间
+        struct Spec
+        {
+            const char *_flags, *_width, *_prec; // 标志、宽度、精度(不含'.')的起始位置
+            size_t _flags_len, _width_len, _prec_len;
+            bool _star_width, _star_prec, _has_prec;
+            char _length; // 长度修饰: H=hh, h, l, L=ll, j, z, t, 0表示没有
+            char _conv;
+            const char *_end; // 转换字符之后
+        };
+        struct Slot
+        {
+            Slot() :_seq(0), _ctime(0), _level(LogLevel::Level::UNKNOWN), _file(""), _line(0), _len(0), _lazy(false) {}
+            std::atomic<uint64_t> _seq; // 奇数: 正在写; 偶数: 第(seq/2-1)条记录已写完
+            time_t _ctime;
+            LogLevel::Level _level;
+            pid_t _tid;
+            const char *_file; // __FILE__ 字面量, 不拷贝
+            size_t _line;
+            size_t _len;
+            bool _lazy; // true: _payload中是格式串和字符串参数, 参数在_args中, 输出时才格式化
+            Arg _args[MAX_ARGS];
+            char _payload[PAYLOAD_SIZE];
+        };
+        // 解析从'%'开始的转换说明, 不支持延迟格式化的写法返回false
+        static bool parseSpec(const char *p, Spec &spec)
+        {
+            memset(&spec, 0, sizeof(spec));
+            p++;
+            if(*p == '%')
+            {
+                spec._conv = '%';
+                spec._end = p + 1;
+                return true;
+            }
+            spec._flags = p;
+            while(*p != '\0' && strchr("-+ #0", *p) != nullptr) p++;
+            spec._flags_len = p - spec._flags;
+            spec._width = p;
+            if(*p == '*')
+            {
+                spec._star_width = true;
+                p++;
+            }
+            else while(*p >= '0' && *p <= '9') p++;
+            spec._width_len = p - spec._width;
+            if(*p == '.')
+            {
+                spec._has_prec = true;
+                spec._prec = ++p;
+                if(*p == '*')
+                {
+                    spec._star_prec = true;
+                    p++;
+                }
+                else while(*p >= '0' && *p <= '9') p++;
+                spec._prec_len = p - spec._prec;
+            }
+            if((p[0] == 'h' || p[0] == 'l') && p[1] == p[0])
+            {
+                spec._length = p[0] == 'h' ? 'H' : 'L';
+                p += 2;
+            }
+            else if(*p == 'h' || *p == 'l' || *p == 'j' || *p == 'z' || *p == 't') spec._length = *p++;
+            spec._conv = *p;
+            spec._end = p + 1;
+            // 位置参数的'$'、%n、long double和宽字符都落在这里
+            if(*p == '\0' || strchr("diouxXcfFeEgGaAps", *p) == nullptr) return false;
+            if(strchr("cfFeEgGaAps", *p) != nullptr && spec._length != 0 && !(spec._length == 'l' && strchr("fFeEgGaA", *p) != nullptr)) return false;
+            return true;
+        }
+        static bool isInteger(char conv) { return strchr("diouxX", conv) != nullptr; }
+        // 按格式串取出参数, 格式串和字符串参数拷贝进消息区; 遇到不支持的写法返回false
+        static bool capture(Slot &slot, const char *fmt, va_list al)
+        {
+            size_t used = strlen(fmt) + 1;
+            if(used > PAYLOAD_SIZE) return false;
+            memcpy(slot._payload, fmt, used);
+            size_t argc = 0;
+            for(const char *p = fmt; *p != '\0'; p++)
+            {
+                if(*p != '%') continue;
+                Spec spec;
+                if(!parseSpec(p, spec)) return false;
+                p = spec._end - 1;
+                if(spec._conv == '%') continue;
+                if(argc + spec._star_width + spec._star_prec + 1 > MAX_ARGS) return false;
+                if(spec._star_width) slot._args[argc++]._i = va_arg(al, int);
+                long long prec = -1;
+                if(spec._star_prec) prec = slot._args[argc++]._i = va_arg(al, int);
+                else if(spec._has_prec) prec = atoi(spec._prec);
+                Arg &arg = slot._args[argc++];
+                switch(spec._conv)
+                {
+                    case 'd': case 'i':
+                        switch(spec._length)
+                        {
+                            case 'H': arg._i = (signed char)va_arg(al, int); break;
+                            case 'h': arg._i = (short)va_arg(al, int); break;
+                            case 'l': arg._i = va_arg(al, long); break;
+                            case 'L': arg._i = va_arg(al, long long); break;
+                            case 'j': arg._i = va_arg(al, intmax_t); break;
+                            case 'z': arg._i = va_arg(al, ssize_t); break;
+                            case 't': arg._i = va_arg(al, ptrdiff_t); break;
+                            default: arg._i = va_arg(al, int); break;
+                        }
+                        break;
+                    case 'o': case 'u': case 'x': case 'X':
+                        switch(spec._length)
+                        {
+                            case 'H': arg._u = (unsigned char)va_arg(al, unsigned); break;
+                            case 'h': arg._u = (unsigned short)va_arg(al, unsigned); break;
+                            case 'l': arg._u = va_arg(al, unsigned long); break;
+                            case 'L': arg._u = va_arg(al, unsigned long long); break;
+                            case 'j': arg._u = va_arg(al, uintmax_t); break;
+                            case 'z': arg._u = va_arg(al, size_t); break;
+                            case 't': arg._u = (unsigned long long)va_arg(al, ptrdiff_t); break;
+                            default: arg._u = va_arg(al, unsigned); break;
+                        }
+                        break;
+                    case 'c': arg._i = va_arg(al, int); break;
+                    case 'p': arg._p = va_arg(al, void *); break;
+                    case 's':
+                    {
+                        const char *str = va_arg(al, const char *);
+                        if(str == nullptr) str = "(null)";
+                        size_t room = PAYLOAD_SIZE - used - 1;
+                        size_t n;
+                        if(prec >= 0 && (size_t)prec <= room) n = strnlen(str, prec);
+                        else
+                        {
+                            // 放不下整个字符串时退回写入时格式化, 保证截断位置与直接格式化一致
+                            n = strnlen(str, room);
+                            if(n == room && str[n] != '\0') return false;
+                        }
+                        memcpy(slot._payload + used, str, n);
+                        slot._payload[used + n] = '\0';
+                        arg._off = used;
+                        used += n + 1;
+                        break;
+                    }
+                    default: arg._d = va_arg(al, double); break;
+                }
+            }
+            slot._len = used;
+            return true;
+        }
+        // 用捕获的参数格式化延迟记录, 逐个转换调用snprintf: '*'换成捕获的数值, 整数统一按64位输出
+        // 输出截断到PAYLOAD_SIZE - 1, 返回长度
+        static size_t render(const char *payload, const Arg *args, char *text)
+        {
+            size_t n = 0, argc = 0;
+            for(const char *p = payload; *p != '\0' && n < PAYLOAD_SIZE - 1; )
+            {
+                if(*p != '%')
+                {
+                    text[n++] = *p++;
+                    continue;
+                }
+                Spec spec;
+                parseSpec(p, spec);
+                p = spec._end;
+                if(spec._conv == '%')
+                {
+                    text[n++] = '%';
+                    continue;
+                }
+                std::string conv = "%";
+                conv.append(spec._flags, spec._flags_len);
+                if(spec._star_width) conv += std::to_string(args[argc++]._i);
+                else conv.append(spec._width, spec._width_len);
+                if(spec._star_prec)
+                {
+                    long long prec = args[argc++]._i;
+                    if(prec >= 0) conv += "." + std::to_string(prec);
+                }
+                else if(spec._has_prec)
+                {
+                    conv += '.';
+                    conv.append(spec._prec, spec._prec_len);
+                }
+                if(isInteger(spec._conv)) conv += "ll";
+                conv += spec._conv;
+                const Arg &arg = args[argc++];
+                int ret;
+                switch(spec._conv)
+                {
+                    case 'd': case 'i': ret = snprintf(text + n, PAYLOAD_SIZE - n, conv.c_str(), arg._i); break;
+                    case 'o': case 'u': case 'x': case 'X': ret = snprintf(text + n, PAYLOAD_SIZE - n, conv.c_str(), arg._u); break;
+                    case 'c': ret = snprintf(text + n, PAYLOAD_SIZE - n, conv.c_str(), (int)arg._i); break;
+                    case 'p': ret = snprintf(text + n, PAYLOAD_SIZE - n, conv.c_str(), arg._p); break;
+                    case 's': ret = snprintf(text + n, PAYLOAD_SIZE - n, conv.c_str(), payload + arg._off); break;
+                    default: ret = snprintf(text + n, PAYLOAD_SIZE - n, conv.c_str(), arg._d); break;
+                }
+                if(ret > 0) n += (size_t)ret < PAYLOAD_SIZE - n ? ret : PAYLOAD_SIZE - n - 1;
+            }
+            return n;
+        }
+        // 领取槽位并填写元数据, 调用者写完消息后把序号置为偶数
+        Slot &acquire(LogLevel::Level level, const char *file, size_t line, uint64_t &ticket)
+        {
+            ticket = _head.fetch_add(1, std::memory_order_relaxed);
+            Slot &slot = _slots[ticket & _mask];
+            slot._seq.store(ticket * 2 + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot._ctime = util::Date::now();
+            slot._level = level;
+            slot._tid = util::Thread::tid();
+            slot._file = file;
+            slot._line = line;
+            return slot;
+        }
+    private:
+        LogLevel::Level _trigger;
+        LogLevel::Level _record;
+        std::vector<Slot> _slots;
+        size_t _mask;
+        std::atomic<uint64_t> _head; // 下一条记录的序号
+        uint64_t _dumped;            // 已经输出到的序号
+        std::mutex _mutex;           // 只保护输出, 写入不加锁
+    };
+}
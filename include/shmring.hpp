@@ -0,0 +1,360 @@
+#pragma once
+#include "sink.hpp"
+#include <atomic>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <new>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+/*
+    共享内存环形缓冲区
+        1. 日志进程把格式化好的数据写入POSIX共享内存, 由独立的收集进程(logsys-collector)落盘
+        2. 多个线程可以同时写入: 原子CAS预留空间, 写完数据后再提交记录头
+        3. 读写游标都保存在共享内存中, 写入进程崩溃后收集进程仍能读出已经提交的记录
+        4. 收集方读取和写入方接管(修复上一个写入进程的残缺记录)互斥: 共享内存中的锁字保存持有者的pid,
+           持有者已经退出时可以抢占; 接管时先在锁内换成新的写入进程, 收集方看到写入进程存活就不再修复
+    记录格式: [4字节 状态|长度][4字节 保留][数据], 按8字节对齐, 记录不跨越缓冲区末尾
+*/
+namespace logSys
+{
+    class ShmRing
+    {
+    public:
+        using ptr = std::shared_ptr<ShmRing>;
+        static const uint64_t MAGIC = 0x474e4952534f4cULL; // "LOSRING"
+        static const uint32_t COMMITTED = 0x80000000u; // 记录已提交
+        static const uint32_t PADDING = 0x40000000u;   // 填充到缓冲区末尾的空记录
+        static const uint32_t DISCARD = 0x20000000u;   // 写入进程崩溃留下的残缺记录
+        static const uint32_t LEN_MASK = 0x1fffffffu;
+        static const size_t RECORD_HEADER = 8;
+        static const int INIT_WAIT_MS = 1000; // 接管时等待其他进程完成初始化的最长时间
+
+        struct Header
+        {
+            std::atomic<uint64_t> _magic; // 初始化完成后最后写入
+            uint64_t _capacity; // 数据区大小, 2的幂
+            std::atomic<uint64_t> _reserve_pos; // 写入方已预留到的位置
+            std::atomic<uint64_t> _read_pos;    // 收集方已读到的位置
+            std::atomic<uint64_t> _dropped;     // 空间不足丢弃的字节数
+            std::atomic<int32_t> _producer_pid; // 写入进程
+            std::atomic<int32_t> _lock_pid;     // 持有读取/修复锁的进程, 0表示空闲
+            char _pad[64 - 8];
+        };
+
+        ~ShmRing()
+        {
+            if(_base != nullptr) munmap(_base, _map_size);
+        }
+        // 写入方: 创建或接管共享内存, capacity向上取整为2的幂
+        static ptr create(const std::string &name, size_t capacity)
+        {
+            size_t cap = 4096;
+            while(cap < capacity) cap <<= 1;
+            // 只有创建共享内存的进程初始化, 同时启动的其他进程等它写入MAGIC
+            // 等不到时是创建者在初始化前崩溃留下的, 删除后重新创建一次
+            int fd = -1;
+            for(int retry = 0; retry < 2; retry++)
+            {
+                fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+                if(fd >= 0) break;
+                if(errno != EEXIST) return nullptr;
+                ptr ring = open(name);
+                if(ring) return ring;
+                shm_unlink(name.c_str());
+            }
+            if(fd < 0) return nullptr;
+            if(ftruncate(fd, sizeof(Header) + cap) != 0)
+            {
+                close(fd);
+                shm_unlink(name.c_str());
+                return nullptr;
+            }
+            ptr ring = map(fd, sizeof(Header) + cap);
+            if(!ring) return nullptr;
+            Header *h = ring->_header;
+            new (&h->_reserve_pos) std::atomic<uint64_t>(0);
+            new (&h->_read_pos) std::atomic<uint64_t>(0);
+            new (&h->_dropped) std::atomic<uint64_t>(0);
+            new (&h->_producer_pid) std::atomic<int32_t>(getpid());
+            new (&h->_lock_pid) std::atomic<int32_t>(0);
+            h->_capacity = cap;
+            ring->_capacity = cap;
+            new (&h->_magic) std::atomic<uint64_t>(0);
+            h->_magic.store(MAGIC, std::memory_order_release);
+            return ring;
+        }
+        // 收集方: 打开已经存在的共享内存, 还在初始化时返回空
+        static ptr attach(const std::string &name)
+        {
+            int fd = shm_open(name.c_str(), O_RDWR, 0);
+            if(fd < 0) return nullptr;
+            struct stat st;
+            if(fstat(fd, &st) != 0 || (size_t)st.st_size <= sizeof(Header))
+            {
+                close(fd);
+                return nullptr;
+            }
+            ptr ring = map(fd, st.st_size);
+            if(!ring || ring->_header->_magic.load(std::memory_order_acquire) != MAGIC) return nullptr;
+            ring->_capacity = ring->_header->_capacity;
+            return ring;
+        }
+        // 写入一条记录, 空间不足返回false, 可以被多个线程同时调用
+        bool write(const char *data, size_t len)
+        {
+            if(len == 0) return true;
+            size_t rec = RECORD_HEADER + align(len);
+            if(len > LEN_MASK || rec > _capacity / 2) return false;
+            Header *h = _header;
+            uint64_t pos = h->_reserve_pos.load(std::memory_order_relaxed);
+            uint64_t pad;
+            do
+            {
+                uint64_t tail = _capacity - (pos & (_capacity - 1));
+                pad = rec > tail ? tail : 0;
+                if(pos + pad + rec - h->_read_pos.load(std::memory_order_acquire) > _capacity)
+                {
+                    return false;
+                }
+            } while(!h->_reserve_pos.compare_exchange_weak(pos, pos + pad + rec, std::memory_order_acq_rel));
+            if(pad > 0) recordAt(pos)->store(COMMITTED | PADDING | (uint32_t)(pad - RECORD_HEADER), std::memory_order_release);
+            pos += pad;
+            std::atomic<uint32_t> *rh = recordAt(pos);
+            // 先写长度, 写入进程在提交前崩溃时收集方仍然能跳过这条记录
+            // 数据不能被编译器提前到长度之前: 没有长度的记录内容必须还是0, 修复时靠它找到下一条记录
+            rh->store((uint32_t)len, std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            memcpy(dataAt(pos), data, len);
+            rh->store(COMMITTED | (uint32_t)len, std::memory_order_release);
+            return true;
+        }
+        void addDropped(size_t len) { _header->_dropped.fetch_add(len, std::memory_order_relaxed); }
+        uint64_t dropped() const { return _header->_dropped.load(std::memory_order_relaxed); }
+        // 读出所有已提交的连续记录, 返回读出的字节数; 单个收集方调用
+        // func: void(const char *data, size_t len)
+        // 写入方正在接管时本次不读, 返回0
+        template<typename Func>
+        size_t drain(Func func)
+        {
+            if(!lock(false)) return 0;
+            Header *h = _header;
+            uint64_t pos = h->_read_pos.load(std::memory_order_relaxed);
+            uint64_t end = h->_reserve_pos.load(std::memory_order_acquire);
+            size_t total = 0;
+            bool recovered = false;
+            while(pos < end)
+            {
+                uint32_t v = recordAt(pos)->load(std::memory_order_acquire);
+                if(!(v & COMMITTED))
+                {
+                    // 记录还在写; 写入进程已经不在了则修复后重试一次
+                    if(recovered || alive(h->_producer_pid.load())) break;
+                    recover();
+                    recovered = true;
+                    end = h->_reserve_pos.load(std::memory_order_acquire);
+                    continue;
+                }
+                uint32_t len = v & LEN_MASK;
+                size_t rec = RECORD_HEADER + align(len);
+                if(!(v & (PADDING | DISCARD)))
+                {
+                    func(dataAt(pos), (size_t)len);
+                    total += len;
+                }
+                // 清零后才能被写入方复用, 保证未预留的空间总是0
+                clear(pos, rec);
+                pos += rec;
+                h->_read_pos.store(pos, std::memory_order_release);
+            }
+            unlock();
+            return total;
+        }
+        // 写入进程是否还在运行
+        bool producerAlive() const
+        {
+            int32_t pid = _header->_producer_pid.load();
+            return pid != 0 && alive(pid);
+        }
+        uint64_t capacity() const { return _capacity; }
+        bool empty() const
+        {
+            return _header->_read_pos.load() == _header->_reserve_pos.load();
+        }
+    private:
+        ShmRing() :_base(nullptr), _header(nullptr), _map_size(0), _capacity(0) {}
+        static ptr map(int fd, size_t size)
+        {
+            void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if(base == MAP_FAILED) return nullptr;
+            ptr ring(new ShmRing());
+            ring->_base = (char *)base;
+            ring->_header = (Header *)base;
+            ring->_map_size = size;
+            return ring;
+        }
+        // 写入方: 接管已经存在的共享内存, 等待创建者初始化完成
+        static ptr open(const std::string &name)
+        {
+            for(int i = 0; i < INIT_WAIT_MS; i++)
+            {
+                ptr ring = attach(name);
+                if(ring)
+                {
+                    ring->takeOver();
+                    return ring;
+                }
+                usleep(1000);
+            }
+            return nullptr;
+        }
+        // 在锁内换成当前进程写入; 上一个写入进程已经退出时先修复它没有提交的记录
+        void takeOver()
+        {
+            lock(true);
+            int32_t old = _header->_producer_pid.load();
+            if(old != 0 && !alive(old)) recover();
+            _header->_producer_pid.store(getpid());
+            unlock();
+        }
+        // 取得读取/修复锁, wait为false时被占用立即返回false; 持有者已经退出时抢占
+        bool lock(bool wait)
+        {
+            std::atomic<int32_t> &word = _header->_lock_pid;
+            int32_t self = getpid();
+            while(true)
+            {
+                int32_t holder = 0;
+                if(word.compare_exchange_strong(holder, self)) return true;
+                if(holder != 0 && !alive(holder) && word.compare_exchange_strong(holder, self)) return true;
+                if(!wait) return false;
+                std::this_thread::yield();
+            }
+        }
+        void unlock() { _header->_lock_pid.store(0, std::memory_order_release); }
+        static size_t align(size_t len) { return (len + 7) & ~(size_t)7; }
+        static bool alive(int32_t pid) { return kill(pid, 0) == 0 || errno == EPERM; }
+        std::atomic<uint32_t> *recordAt(uint64_t pos)
+        {
+            return (std::atomic<uint32_t> *)(_base + sizeof(Header) + (pos & (_capacity - 1)));
+        }
+        char *dataAt(uint64_t pos) { return (char *)recordAt(pos) + RECORD_HEADER; }
+        void clear(uint64_t pos, size_t rec)
+        {
+            std::atomic<uint32_t> *rh = recordAt(pos);
+            memset((char *)rh + sizeof(uint32_t), 0, rec - sizeof(uint32_t));
+            rh->store(0, std::memory_order_relaxed);
+        }
+        // 从pos之后找下一个非0的记录头, 返回与pos的距离, 找不到返回limit
+        // 预留了但还没写长度的记录内容也是0, 第一个非0的记录头就是后面一条记录的开始
+        uint64_t nextHeader(uint64_t pos, uint64_t limit)
+        {
+            uint64_t off = RECORD_HEADER;
+            while(off < limit && recordAt(pos + off)->load() == 0) off += RECORD_HEADER;
+            return off < limit ? off : limit;
+        }
+        // 写入进程崩溃后修复没有提交的记录, 都标记为残缺记录跳过:
+        // 已写长度的只跳过这一条, 长度未知的跳到下一个记录头, 后面已经提交的记录照常读出
+        void recover()
+        {
+            Header *h = _header;
+            uint64_t pos = h->_read_pos.load();
+            uint64_t end = h->_reserve_pos.load();
+            while(pos < end)
+            {
+                std::atomic<uint32_t> *rh = recordAt(pos);
+                uint32_t v = rh->load();
+                uint32_t len = v & LEN_MASK;
+                uint64_t tail = _capacity - (pos & (_capacity - 1));
+                if(!(v & COMMITTED))
+                {
+                    // 记录不跨越末尾, 跨越末尾时分两段处理
+                    uint64_t limit = end - pos < tail ? end - pos : tail;
+                    uint64_t span = RECORD_HEADER + align(len);
+                    if(len == 0) span = nextHeader(pos, limit);
+                    else if(span > limit) span = limit;
+                    rh->store(COMMITTED | DISCARD | (uint32_t)(span - RECORD_HEADER));
+                    pos += span;
+                    continue;
+                }
+                pos += RECORD_HEADER + align(len);
+            }
+        }
+    private:
+        char *_base;
+        Header *_header;
+        size_t _map_size;
+        uint64_t _capacity;
+    };
+
+    // 共享内存落地类: 日志进程只做内存拷贝, 文件I/O交给logsys-collector
+    class ShmRingSink : public LogSink
+    {
+    public:
+        using ptr = std::shared_ptr<ShmRingSink>;
+        // name: 共享内存名, 如 /logsys-app; capacity: 环形缓冲区大小
+        // max_wait_us: 缓冲区满时最多等待收集方的时间, 超时丢弃并计数
+        ShmRingSink(const std::string &name, size_t capacity = 16 * 1024 * 1024, size_t max_wait_us = 1000)
+        :_name(name), _max_wait_us(max_wait_us)
+        {
+            _ring = ShmRing::create(name, capacity);
+            assert(_ring.get() != nullptr);
+        }
+        // 批量数据按换行切成不超过容量一半的块, 多个线程同时写入时只会在行边界交错
+        void log(const char* data, size_t len) override
+        {
+            size_t max_chunk = ringChunk();
+            while(len > 0)
+            {
+                size_t n = len;
+                if(n > max_chunk)
+                {
+                    n = max_chunk;
+                    const char *nl = (const char *)memrchr(data, '\n', n);
+                    if(nl != nullptr) n = nl - data + 1;
+                }
+                write(data, n);
+                data += n;
+                len -= n;
+            }
+        }
+        uint64_t dropped() const { return _ring->dropped(); }
+        bool threadSafe() const override { return true; }
+        std::string describe() const override { return "shm:" + _name; }
+        void collectMetrics(MetricsSnapshot &snap, const MetricsSnapshot::Labels &labels) const override
+        {
+            LogSink::collectMetrics(snap, labels);
+            snap.counter("logsys_sink_dropped_bytes_total", "Bytes dropped by the sink", labels, _ring->dropped());
+        }
+    private:
+        // 单条记录的上限, 不超过64KB且至少能同时放下四条
+        size_t ringChunk() const
+        {
+            size_t chunk = _ring->capacity() / 4 - ShmRing::RECORD_HEADER;
+            return chunk < 64 * 1024 ? chunk : 64 * 1024;
+        }
+        void write(const char *data, size_t len)
+        {
+            if(_ring->write(data, len)) return;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(_max_wait_us);
+            while(std::chrono::steady_clock::now() < deadline)
+            {
+                std::this_thread::yield();
+                if(_ring->write(data, len)) return;
+            }
+            _ring->addDropped(len);
+        }
+    private:
+        std::string _name;
+        ShmRing::ptr _ring;
+        size_t _max_wait_us;
+    };
+}
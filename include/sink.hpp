@@ -1,15 +1,34 @@
 #pragma once
 #include "util.hpp"
+#include "level.hpp"
+#include "archiver.hpp"
+#include "metrics.hpp"
+#include "index.hpp"
+#include "crash.hpp"
 #include <fstream>
 #include <sstream>
 #include <memory>
 #include <cassert>
 #include <iomanip>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 /*
     日志落地类
         1. 标准输出
-        2. 文件
-        3. 滚动文件
+        2. 控制台(直接写fd 1/2)
+        3. 文件
+        4. 大小滚动文件
+        5. 时间滚动文件
+        6. 空落地(丢弃数据, 性能测试用)
 */
 namespace logSys
 {
@@ -17,8 +36,107 @@ namespace logSys
     {
     public:
         using ptr = std::shared_ptr<LogSink>;
+        LogSink() = default;
         virtual ~LogSink() = default;
         virtual void log(const char* data, size_t len) = 0;
+        // 带等级的写入, 单条记录时日志器会传入等级, 异步批次为UNKNOWN; 默认忽略等级
+        virtual void log(const char* data, size_t len, LogLevel::Level /*level*/) { log(data, len); }
+        // 把落地方向自己缓冲的数据写出
+        virtual void flush() {}
+        // 写出并持久化到存储设备, 默认只flush
+        virtual void sync() { flush(); }
+        // 多段数据作为一个批次写入(如环形缓冲区回绕后的两段), 默认拼接成一段再调用log
+        // 能直接写文件描述符的落地方向重写为一次writev
+        virtual void log(const struct iovec *iov, int cnt)
+        {
+            if(cnt == 1)
+            {
+                log((const char *)iov[0].iov_base, iov[0].iov_len);
+                return;
+            }
+            util::ThreadBuffer buf;
+            for(int i = 0; i < cnt; i++) buf.str().append((const char *)iov[i].iov_base, iov[i].iov_len);
+            log(buf.str().data(), buf.str().size());
+        }
+        // 带统计的写入, 日志器通过它调用log
+        // 不能并发调用log的落地方向在这里加自己的锁, 日志器之间不再共用一把大锁
+        // meta为这段数据的时间和等级, 写完后在同一把锁内交给index
+        void write(const char* data, size_t len, LogLevel::Level level = LogLevel::Level::UNKNOWN,
+                   const RecordMeta *meta = nullptr)
+        {
+            uint64_t start = monoNanos();
+            if(threadSafe())
+            {
+                prepare(meta);
+                log(data, len, level);
+                index(meta, len);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                prepare(meta);
+                log(data, len, level);
+                index(meta, len);
+            }
+            account(len, start);
+        }
+        void write(const struct iovec *iov, int cnt, const RecordMeta *meta = nullptr)
+        {
+            uint64_t start = monoNanos();
+            size_t len = 0;
+            for(int i = 0; i < cnt; i++) len += iov[i].iov_len;
+            if(threadSafe())
+            {
+                prepare(meta);
+                log(iov, cnt);
+                index(meta, len);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                prepare(meta);
+                log(iov, cnt);
+                index(meta, len);
+            }
+            account(len, start);
+        }
+        // log能否被多个线程同时调用, 返回false时由write串行化
+        virtual bool threadSafe() const { return false; }
+        // 指标中用来区分落地方向的名字
+        virtual std::string describe() const { return "sink"; }
+        // 收集指标, 子类可以追加自己的指标; labels由调用方给出, 至少包含 sink=describe()
+        // 多个落地方向的名字相同时调用方追加区分的标签, 子类的指标必须使用同一组labels
+        virtual void collectMetrics(MetricsSnapshot &snap, const MetricsSnapshot::Labels &labels) const
+        {
+            snap.counter("logsys_sink_writes_total", "Number of sink writes (one per record or batch)", labels, _writes.value());
+            snap.counter("logsys_sink_bytes_total", "Bytes handed to the sink", labels, _bytes.value());
+            snap.histogram("logsys_sink_write_seconds", "Time spent in a single sink write", labels, _write_latency);
+        }
+        // 崩溃时直接write(2)的目标文件描述符, 没有则返回-1
+        // 会在信号处理函数中调用, 实现不能加锁或分配内存
+        virtual int crashFd() const { return -1; }
+        // 崩溃时把落地方向自己缓冲的数据写到crashFd, 同样在信号处理函数中调用
+        // 异步日志器在写出工作器中的数据之前调用它, 保证旧数据在前; 可能被调用多次
+        virtual void crashFlush() {}
+        // 落地方向暂时写不动(如对端断开)时返回true, 异步工作器据此攒更大的批次而不是频繁调用
+        virtual bool backpressured() const { return false; }
+    protected:
+        // 即将写入的数据的元数据(可能为空), 在log之前、同一把锁内调用; 按记录时间决策的落地方向重写
+        virtual void prepare(const RecordMeta * /*meta*/) {}
+        // 刚写入的len字节的元数据(可能为空), 维护索引的落地方向重写; 与log在同一把锁内调用
+        virtual void index(const RecordMeta * /*meta*/, size_t /*len*/) {}
+    private:
+        void account(size_t len, uint64_t start)
+        {
+            _write_latency.record(monoNanos() - start);
+            _writes.add();
+            _bytes.add(len);
+        }
+    private:
+        std::mutex _mutex; // 串行化非线程安全落地方向的写入
+        Counter _writes;
+        Counter _bytes;
+        LatencyHistogram _write_latency;
     };
     // 标准输出日志落地类
     class StdoutSink : public LogSink
@@ -29,85 +147,569 @@ namespace logSys
         {
             std::cout.write(data, len);
         }
+        int crashFd() const override { return STDOUT_FILENO; }
+        std::string describe() const override { return "stdout"; }
+    };
+    // 空日志落地类: 丢弃所有数据, 用于性能测试中扣除落地本身的开销
+    class NullSink : public LogSink
+    {
+    public:
+        using ptr = std::shared_ptr<NullSink>;
+        void log(const char* /*data*/, size_t /*len*/) override {}
+        void log(const struct iovec * /*iov*/, int /*cnt*/) override {}
+        bool threadSafe() const override { return true; }
+        std::string describe() const override { return "null"; }
+    };
+    // 控制台颜色
+    enum class ColorMode
+    {
+        AUTO,   // 终端且没有设置NO_COLOR时上色
+        ALWAYS,
+        NEVER
+    };
+    // 所有非终端ConsoleSink共用的刷新线程: 缓冲区由空变为非空时登记, 到期后写出, 没有登记时不唤醒
+    // 加锁顺序为先刷新线程后落地方向, 落地方向持有自己的锁时不能调用schedule
+    // 有意不释放: 进程退出时其他静态对象中的落地方向析构仍会调用cancel
+    class ConsoleFlusher
+    {
+    public:
+        static ConsoleFlusher &instance()
+        {
+            static ConsoleFlusher *flusher = new ConsoleFlusher();
+            return *flusher;
+        }
+        // 登记一次刷新, 已经登记过的保持原来的到期时间
+        void schedule(LogSink *sink, size_t interval_ms)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval_ms);
+            if(!_pending.insert(std::make_pair(sink, deadline)).second) return;
+            if(!_thread.joinable()) _thread = std::thread(&ConsoleFlusher::run, this);
+            _cond.notify_one();
+        }
+        // 返回后该落地方向不会再被刷新, 析构前调用
+        void cancel(LogSink *sink)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending.erase(sink);
+        }
+    private:
+        ConsoleFlusher() {}
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while(true)
+            {
+                if(_pending.empty())
+                {
+                    _cond.wait(lock);
+                    continue;
+                }
+                auto now = std::chrono::steady_clock::now();
+                auto next = _pending.begin()->second;
+                for(auto &entry : _pending)
+                {
+                    if(entry.second < next) next = entry.second;
+                }
+                if(now < next)
+                {
+                    _cond.wait_until(lock, next);
+                    continue;
+                }
+                for(auto it = _pending.begin(); it != _pending.end();)
+                {
+                    if(it->second > now)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    it->first->flush();
+                    it = _pending.erase(it);
+                }
+            }
+        }
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::unordered_map<LogSink *, std::chrono::steady_clock::time_point> _pending; // 等待刷新的落地方向和到期时间
+        std::thread _thread;
+    };
+    // 控制台日志落地类: 不经过iostream, 直接write/writev到标准输出或标准错误
+    // 终端: 每条记录立即写出; 管道/文件: 先进缓冲区, 满了、WARNING以上或超过刷新间隔时写出
+    class ConsoleSink : public LogSink
+    {
+    public:
+        using ptr = std::shared_ptr<ConsoleSink>;
+        static const size_t BUFFER_SIZE = 64 * 1024;
+        ConsoleSink(int fd = STDOUT_FILENO, ColorMode color = ColorMode::AUTO, size_t flush_interval_ms = 100)
+        :_fd(fd), _tty(isatty(fd) == 1), _buffered(false), _flush_interval_ms(flush_interval_ms), _crash_flushed(false)
+        {
+            bool colored = color == ColorMode::ALWAYS;
+            if(color == ColorMode::AUTO)
+            {
+                const char *term = getenv("TERM");
+                colored = _tty && getenv("NO_COLOR") == nullptr && !(term != nullptr && strcmp(term, "dumb") == 0);
+            }
+            if(colored)
+            {
+                _prefix[(int)LogLevel::Level::DEBUG] = "\033[36m";
+                _prefix[(int)LogLevel::Level::INFO] = "\033[32m";
+                _prefix[(int)LogLevel::Level::WARNING] = "\033[33m";
+                _prefix[(int)LogLevel::Level::ERROR] = "\033[31m";
+                _prefix[(int)LogLevel::Level::FATAL] = "\033[1;35m";
+                _reset = "\033[0m";
+            }
+            // 同步日志器没有工作器, 崩溃时由落地方向自己写出缓冲区; 崩溃注册表满时不缓冲, 每条直接写出
+            if(!_tty && CrashHandler::add(this, &ConsoleSink::crashEntry))
+            {
+                _buffered = true;
+                _buffer.reserve(BUFFER_SIZE);
+            }
+        }
+        ~ConsoleSink()
+        {
+            if(!_buffered) return;
+            CrashHandler::remove(this);
+            ConsoleFlusher::instance().cancel(this);
+            std::lock_guard<std::mutex> lock(_mutex);
+            flushLocked();
+        }
+        void log(const char* data, size_t len) override
+        {
+            log(data, len, LogLevel::Level::UNKNOWN);
+        }
+        void log(const char* data, size_t len, LogLevel::Level level) override
+        {
+            const std::string &prefix = _prefix[(int)level];
+            // 颜色结束符放在行尾换行之前
+            size_t body = len;
+            if(!prefix.empty() && body > 0 && data[body - 1] == '\n') body--;
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(!_buffered)
+            {
+                if(prefix.empty())
+                {
+                    util::File::writeAll(_fd, data, len);
+                    return;
+                }
+                struct iovec iov[4] = {
+                    { (void *)prefix.data(), prefix.size() },
+                    { (void *)data, body },
+                    { (void *)(_reset.data()), _reset.size() },
+                    { (void *)"\n", 1 }
+                };
+                util::File::writevAll(_fd, iov, body < len ? 4 : 3);
+                return;
+            }
+            if(_buffer.size() + len + prefix.size() + _reset.size() + 1 > BUFFER_SIZE)
+            {
+                if(prefix.empty() && len >= BUFFER_SIZE)
+                {
+                    // 大批次(通常来自异步日志器)和缓冲区一起用一次writev写出, 不再拷贝
+                    struct iovec iov[2] = { { (void *)_buffer.data(), _buffer.size() }, { (void *)data, len } };
+                    util::File::writevAll(_fd, iov, 2);
+                    _buffer.clear();
+                    return;
+                }
+                flushLocked();
+            }
+            bool first = _buffer.empty();
+            if(prefix.empty())
+            {
+                _buffer.append(data, len);
+            }
+            else
+            {
+                _buffer += prefix;
+                _buffer.append(data, body);
+                _buffer += _reset;
+                if(body < len) _buffer += '\n';
+            }
+            if(level >= LogLevel::Level::WARNING)
+            {
+                flushLocked();
+                return;
+            }
+            // 管道中的数据不能无限期留在缓冲区, 由共用的刷新线程到期写出
+            lock.unlock();
+            if(first) ConsoleFlusher::instance().schedule(this, _flush_interval_ms);
+        }
+        // 异步批次不上色, 先写出缓冲区中的数据保持顺序, 批次本身一次writev写出
+        void log(const struct iovec *iov, int cnt) override
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            flushLocked();
+            util::File::writevAll(_fd, iov, cnt);
+        }
+        void flush() override
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            flushLocked();
+        }
+        bool threadSafe() const override { return true; }
+        int crashFd() const override { return _fd; }
+        // 不加锁直接写出缓冲区, 崩溃时其他线程可能正在追加, 只能尽力而为; 多次调用只写一次
+        void crashFlush() override
+        {
+            if(!_buffered || _crash_flushed.exchange(true)) return;
+            util::File::writeAll(_fd, _buffer.data(), _buffer.size());
+        }
+        std::string describe() const override { return _fd == STDERR_FILENO ? "stderr" : "stdout"; }
+    private:
+        static void crashEntry(void *ctx) { static_cast<ConsoleSink *>(ctx)->crashFlush(); }
+        void flushLocked()
+        {
+            if(_buffer.empty()) return;
+            util::File::writeAll(_fd, _buffer.data(), _buffer.size());
+            _buffer.clear();
+        }
+    private:
+        int _fd;
+        bool _tty;
+        std::string _prefix[(int)LogLevel::Level::OFF + 1]; // 每个等级的颜色前缀, 不上色时为空
+        std::string _reset;
+        bool _buffered;      // 非终端且已注册崩溃写出时先进缓冲区
+        size_t _flush_interval_ms;
+        std::string _buffer; // 非终端时的批量缓冲区
+        std::mutex _mutex;
+        std::atomic<bool> _crash_flushed; // 崩溃时缓冲区已经写出
+    };
+    // 文件写入方式
+    enum class FileWriteMode
+    {
+        APPEND, // O_APPEND; 短写时会续写剩余部分, 两次write之间可能插入其他线程的数据, 写入由基类加锁串行化
+        PWRITE  // 原子递增文件偏移预留区间, 各线程pwrite自己的区间, 不需要加锁; 文件不能被其他进程同时追加
     };
     // 文件日志落地类
     class FileSink : public LogSink
     {
     public:
         using ptr = std::shared_ptr<FileSink>;
-        FileSink(const std::string &pathname)
-        :_pathname(pathname)
+        // indexed: 维护 pathname.idx 旁路索引, 开启后写入由基类串行化
+        FileSink(const std::string &pathname, FileWriteMode mode = FileWriteMode::APPEND, bool indexed = false)
+        :_pathname(pathname), _mode(mode), _crash_fd(-1), _offset(0), _failed(false)
         {
             // 1.创建目录
             util::File::createDirectory(util::File::path(_pathname));
-            // 2.创建文件句柄
-            _ofs.open(_pathname, std::ios::binary | std::ios::app);
-            assert(_ofs.good());
+            // 2.创建文件句柄, 直接写文件描述符, 进程崩溃时不会有数据留在用户态缓冲区
+            int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+            _fd = open(_pathname.c_str(), _mode == FileWriteMode::APPEND ? flags | O_APPEND : flags, 0644);
+            assert(_fd >= 0);
+            if(_mode == FileWriteMode::PWRITE)
+            {
+                // 从文件末尾开始预留; 崩溃处理用单独的追加句柄, 不会覆盖已写区间
+                struct stat st;
+                if(fstat(_fd, &st) == 0) _offset = st.st_size;
+                _crash_fd = open(_pathname.c_str(), flags | O_APPEND, 0644);
+            }
+            if(indexed)
+            {
+                struct stat st;
+                _index.reset(new IndexWriter());
+                _index->open(_pathname, fstat(_fd, &st) == 0 ? st.st_size : 0);
+            }
+        }
+        ~FileSink()
+        {
+            if(_fd >= 0) close(_fd);
+            if(_crash_fd >= 0) close(_crash_fd);
         }
         void log(const char* data, size_t len) override
         {
-            _ofs.write(data, len);
-            if(!_ofs.good())
+            bool ok;
+            if(_mode == FileWriteMode::PWRITE)
+            {
+                off_t offset = (off_t)_offset.fetch_add(len, std::memory_order_relaxed);
+                ok = util::File::pwriteAll(_fd, data, len, offset);
+            }
+            else
+            {
+                ok = util::File::writeAll(_fd, data, len);
+            }
+            if(!ok)
+            {
+                std::cout << "write to file failed!" << std::endl;
+            }
+            if(_index) _failed = !ok;
+        }
+        void log(const struct iovec *iov, int cnt) override
+        {
+            bool ok = true;
+            if(_mode == FileWriteMode::PWRITE)
+            {
+                size_t len = 0;
+                for(int i = 0; i < cnt; i++) len += iov[i].iov_len;
+                off_t offset = (off_t)_offset.fetch_add(len, std::memory_order_relaxed);
+                for(int i = 0; i < cnt && ok; i++)
+                {
+                    ok = util::File::pwriteAll(_fd, (const char *)iov[i].iov_base, iov[i].iov_len, offset);
+                    offset += iov[i].iov_len;
+                }
+            }
+            else
+            {
+                ok = util::File::writevAll(_fd, iov, cnt);
+            }
+            if(!ok)
             {
                 std::cout << "write to file failed!" << std::endl;
             }
+            if(_index) _failed = !ok;
+        }
+        void sync() override { fdatasync(_fd); }
+        // 只有PWRITE模式各线程写互不重叠的区间; 索引需要和写入同序, 开启后也要加锁
+        bool threadSafe() const override { return _mode == FileWriteMode::PWRITE && !_index; }
+        int crashFd() const override { return _mode == FileWriteMode::PWRITE ? _crash_fd : _fd; }
+        std::string describe() const override { return "file:" + _pathname; }
+    protected:
+        // 写入失败时文件可能只写了一部分, 索引按文件实际的末尾重新对齐
+        void index(const RecordMeta *meta, size_t len) override
+        {
+            if(!_index) return;
+            if(_failed)
+            {
+                _index->resync(endOffset());
+                return;
+            }
+            _index->add(meta != nullptr ? *meta : RecordMeta(), len);
+        }
+    private:
+        // 下一次写入的位置: PWRITE模式下失败的区间也已经预留
+        uint64_t endOffset() const
+        {
+            if(_mode == FileWriteMode::PWRITE) return _offset.load(std::memory_order_relaxed);
+            struct stat st;
+            return fstat(_fd, &st) == 0 ? st.st_size : 0;
         }
     private:
         std::string _pathname;
-        std::ofstream _ofs; // 文件句柄，避免多次打开关闭
+        FileWriteMode _mode;
+        int _fd; // 文件句柄，避免多次打开关闭
+        int _crash_fd; // PWRITE模式下崩溃处理使用的追加句柄
+        std::atomic<uint64_t> _offset; // PWRITE模式下下一个可预留的偏移
+        std::unique_ptr<IndexWriter> _index; // 旁路索引, 未开启时为空
+        bool _failed; // 开启索引时最近一次写入是否失败, 由基类的锁保护
     };
-    // 大小滚动文件日志落地类
-    class RollBySizeSink : public LogSink
+    // 滚动文件日志落地基类: 负责分段的打开、关闭和命名
+    // 下一个分段由归档器在后台预先打开, 滚动时只交换文件描述符, 关闭和归档也交给后台
+    class RollFileSink : public LogSink
     {
     public:
-        using ptr = std::shared_ptr<RollBySizeSink>;
-        RollBySizeSink(const std::string &basename, size_t max_size)
-        :_basename(basename), _max_size(max_size), _cur_size(0)
+        using ptr = std::shared_ptr<RollFileSink>;
+        ~RollFileSink()
         {
-            util::File::createDirectory(util::File::path(_basename));  
+            if(_fd < 0) return;
+            // 释放预留但没有用到的磁盘块
+            struct stat st;
+            if(fstat(_fd, &st) == 0) ftruncate(_fd, st.st_size);
+            close(_fd);
         }
         void log(const char* data, size_t len) override
         {
-            initLogFile();
-            _ofs.write(data, len);
-            if(!_ofs.good())
+            rollIfNeeded();
+            _failed = !util::File::writeAll(_fd, data, len);
+            if(_failed)
             {
                 std::cout << "write to rollfile failed\n"; 
                 return;
             }
-            _cur_size += len;
+            written(len);
         }
-    private:
-        // 文件未打开或写到最大值进行文件滚动
-        void initLogFile()
+        // 异步批次一次writev写入当前分段; 只在批次之前检查滚动, 一个批次不会被拆到两个分段
+        void log(const struct iovec *iov, int cnt) override
         {
-            if(!_ofs.is_open() || _cur_size >= _max_size)
+            rollIfNeeded();
+            _failed = !util::File::writevAll(_fd, iov, cnt);
+            if(_failed)
             {
-                _ofs.close();
-                std::string pathname = createNewFile();
-                _ofs.open(pathname, std::ios::binary | std::ios::app);
-                assert(_ofs.is_open());
-                _cur_size = 0;
+                std::cout << "write to rollfile failed\n"; 
+                return;
             }
+            size_t len = 0;
+            for(int i = 0; i < cnt; i++) len += iov[i].iov_len;
+            written(len);
         }
-        // 根据时间和计数器创建文件名
-        std::string createNewFile()
+        // 滚动耗时统计
+        const LatencyHistogram &rollLatency() const { return _roll_latency; }
+        int crashFd() const override { return _fd.load(std::memory_order_relaxed); }
+        void sync() override { fdatasync(_fd.load(std::memory_order_relaxed)); }
+        std::string describe() const override { return "roll:" + _basename; }
+        void collectMetrics(MetricsSnapshot &snap, const MetricsSnapshot::Labels &labels) const override
+        {
+            LogSink::collectMetrics(snap, labels);
+            snap.histogram("logsys_sink_roll_seconds", "Time spent switching to a new segment", labels, _roll_latency);
+        }
+    protected:
+        RollFileSink(const std::string &basename, const RetentionPolicy &policy, size_t prealloc = 0, bool indexed = false)
+        :_basename(basename), _fd(-1), _count(0), _index(indexed ? new IndexWriter() : nullptr), _failed(false)
+        {
+            util::File::createDirectory(util::File::path(_basename));
+            _archiver = std::make_shared<SegmentArchiver>(_basename, policy, prealloc);
+            _archiver->prepare();
+        }
+        // 写入前检查是否需要滚动, 需要时调用rollOver
+        virtual void rollIfNeeded() = 0;
+        // 成功写入len字节之后调用
+        virtual void written(size_t /*len*/) {}
+        // 关闭当前分段并打开新分段, t为新分段命名使用的时间
+        void rollOver(time_t t)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::string pathname = createNewFile(t);
+            SegmentArchiver::Prepared next;
+            // 旧分段的尾块随之写出, 每个分段一个索引文件; 在投递重命名之前创建, 重名时归档器一起改名
+            if(_index) _index->open(pathname, 0);
+            if(_archiver->takePrepared(next))
+            {
+                _archiver->rename(next._pathname, pathname);
+            }
+            else
+            {
+                // 后台还没准备好, 退化为同步打开
+                next._fd = open(pathname.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                assert(next._fd >= 0);
+            }
+            if(_fd >= 0) _archiver->submit(_fd, _pathname);
+            bool first = _pathname.empty();
+            _fd = next._fd;
+            _pathname.swap(pathname);
+            _archiver->prepare();
+            // 第一次打开文件时接管上次运行遗留的分段
+            if(first) _archiver->scan(_pathname);
+            _roll_latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        // 根据时间和计数器创建文件名, 计数器避免同一时刻滚动多个文件导致文件名一样
+        std::string createNewFile(time_t t)
         {
-            time_t t = util::Date::now();
             struct std::tm tl;
             localtime_r(&t, &tl);
             char buffer[64] = { 0 };
-            strftime(buffer, 63, "%Y-%m-%d %H:%M:%S", &tl);
+            strftime(buffer, 63, "%Y%m%d%H%M%S", &tl);
             std::string pathname = _basename + buffer + "-" + std::to_string(_count++);
-            pathname += ".log";  
+            pathname += ".log";
             return pathname;
         }
-    private:
+        // 写入失败时按分段实际的长度重新对齐索引
+        void index(const RecordMeta *meta, size_t len) override
+        {
+            if(!_index) return;
+            if(_failed)
+            {
+                struct stat st;
+                _index->resync(fstat(_fd, &st) == 0 ? st.st_size : 0);
+                return;
+            }
+            _index->add(meta != nullptr ? *meta : RecordMeta(), len);
+        }
+    protected:
         std::string _basename;
-        std::ofstream _ofs;
+        std::string _pathname; // 当前分段文件名
+        std::atomic<int> _fd; // 当前分段文件描述符, 崩溃处理会从其他线程读取
+        size_t _count; // 文件计数
+        SegmentArchiver::ptr _archiver; // 后台预创建和归档分段
+        LatencyHistogram _roll_latency;
+        std::unique_ptr<IndexWriter> _index; // 当前分段的旁路索引, 未开启时为空
+        bool _failed; // 最近一次写入是否失败, 写入已由基类串行化
+    };
+
+    // 大小滚动文件日志落地类
+    class RollBySizeSink : public RollFileSink
+    {
+    public:
+        using ptr = std::shared_ptr<RollBySizeSink>;
+        // preallocate: 预创建分段时按max_size预留磁盘空间
+        // indexed: 每个分段维护 分段名.idx 旁路索引
+        RollBySizeSink(const std::string &basename, size_t max_size,
+                       const RetentionPolicy &policy = RetentionPolicy(), bool preallocate = false,
+                       bool indexed = false)
+        :RollFileSink(basename, policy, preallocate ? max_size : 0, indexed), _max_size(max_size), _cur_size(0)
+        {}
+    protected:
+        // 文件未打开或写到最大值进行文件滚动
+        void rollIfNeeded() override
+        {
+            if(_fd < 0 || _cur_size >= _max_size)
+            {
+                rollOver(util::Date::now());
+                _cur_size = 0;
+            }
+        }
+        void written(size_t len) override { _cur_size += len; }
+    private:
         size_t _max_size; 
         size_t _cur_size; // 当前文件大小，避免重复获取
-        int _count; // 文件计数，避免同一时刻滚动多个文件导致文件名一样
+    };
+
+    // 通过枚举时间段，避免让用户自己计算
+    enum class TimeGap
+    {
+        SECOND_GAP,
+        MINUTE_GAP,
+        HOUR_GAP,
+        DAY_GAP
+    };
+    // 时间滚动文件日志落地类, 按本地时间的整点/零点切分
+    class RollByTimeSink : public RollFileSink
+    {
+    public:
+        using ptr = std::shared_ptr<RollByTimeSink>;
+        RollByTimeSink(const std::string &basename, TimeGap gap,
+                       const RetentionPolicy &policy = RetentionPolicy(), bool indexed = false)
+        :RollFileSink(basename, policy, 0, indexed), _gap(gap), _next_roll(0), _batch_time(0)
+        {}
+    protected:
+        // 日志器给出的元数据带有这段数据中最新记录的创建时间, 直接用它判断滚动, 不再读时钟
+        void prepare(const RecordMeta *meta) override
+        {
+            _batch_time = meta != nullptr && !meta->empty() ? meta->_max_time : 0;
+        }
+        void rollIfNeeded() override
+        {
+            // 边界每个周期只计算一次, 平时只做一次整数比较; 没有经过write直接调用log时才读时钟
+            time_t now = _batch_time;
+            _batch_time = 0;
+            if(now == 0) now = util::Date::now();
+            if(now >= _next_roll)
+            {
+                rollOver(periodStart(now));
+                _next_roll = nextBoundary(now);
+            }
+        }
+    private:
+        // 当前周期的起始时间, 用于文件命名
+        time_t periodStart(time_t now)
+        {
+            struct std::tm tl;
+            localtime_r(&now, &tl);
+            switch(_gap)
+            {
+                case TimeGap::SECOND_GAP: return now;
+                case TimeGap::MINUTE_GAP: tl.tm_sec = 0; break;
+                case TimeGap::HOUR_GAP: tl.tm_sec = tl.tm_min = 0; break;
+                case TimeGap::DAY_GAP: tl.tm_sec = tl.tm_min = tl.tm_hour = 0; break;
+            }
+            tl.tm_isdst = -1;
+            return mktime(&tl);
+        }
+        // 下一个周期的起始时间, 交给mktime处理跨月和夏令时
+        time_t nextBoundary(time_t now)
+        {
+            struct std::tm tl;
+            localtime_r(&now, &tl);
+            switch(_gap)
+            {
+                case TimeGap::SECOND_GAP: return now + 1;
+                case TimeGap::MINUTE_GAP: tl.tm_sec = 0; tl.tm_min += 1; break;
+                case TimeGap::HOUR_GAP: tl.tm_sec = tl.tm_min = 0; tl.tm_hour += 1; break;
+                case TimeGap::DAY_GAP: tl.tm_sec = tl.tm_min = tl.tm_hour = 0; tl.tm_mday += 1; break;
+            }
+            tl.tm_isdst = -1;
+            return mktime(&tl);
+        }
+    private:
+        TimeGap _gap;
+        time_t _next_roll; // 下一次滚动的时间点
+        time_t _batch_time; // prepare给出的记录时间, 用过一次后清零
     };
 
     // 日志落地工厂模式
@@ -0,0 +1,46 @@
+#pragma once
+#include "logger.hpp"
+#include "fmt.hpp"
+/*
+    流式日志接口
+        LOG_INFO(logger) << "user " << uid << " login, cost " << cost << "ms";
+        1. 临时的LogStream对象把各个操作数按类型编码进线程私有的缓冲区, 析构时提交整条日志
+        2. 等级未开启时整条语句被跳过, 右侧的操作数不会求值
+        3. 编码规则与{}格式化一致, 自定义类型同样通过特化FormatTraits支持
+*/
+namespace logSys
+{
+    class LogStream
+    {
+    public:
+        LogStream(Logger &logger, LogLevel::Level level, const char *file, size_t line)
+        :_logger(logger), _level(level), _file(file), _line(line), _start(monoNanos())
+        {}
+        ~LogStream()
+        {
+            std::string &payload = _buf.str();
+            _logger.commit(_level, _file, _line, payload.data(), payload.size(), _start);
+        }
+        LogStream(const LogStream &) = delete;
+        LogStream &operator=(const LogStream &) = delete;
+        template<typename T>
+        LogStream &operator<<(const T &value)
+        {
+            util::Format::appendValue(_buf.str(), value);
+            return *this;
+        }
+    private:
+        Logger &_logger;
+        LogLevel::Level _level;
+        const char *_file;
+        size_t _line;
+        uint64_t _start;
+        util::ThreadBuffer _buf;
+    };
+    // 把流式表达式的结果转为void, 使其可以放进条件表达式的一侧
+    // &的优先级低于<<, 整条<<链先求值
+    struct LogStreamVoidify
+    {
+        void operator&(const LogStream &) {}
+    };
+}
@@ -4,15 +4,43 @@
     2. 判断文件或目录是否存在
     3. 获取文件所在目录
     4. 创建目录
+    5. 向文件描述符完整写入数据
+    6. 线程身份(内核线程id和线程名)
+    7. 线程私有的可复用字符串缓冲区
 */
 #include <iostream>
 #include <string>
+#include <cstdint>
 #include <sys/stat.h>
 #include <ctime>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <climits>
+#include <pthread.h>
+#include <sys/syscall.h>
 namespace logSys
 {
     namespace util
     {
+        // 路径中文件名的起始位置, 配合std::integral_constant在编译期求值
+        constexpr size_t basenameOffset(const char *path, size_t i = 0, size_t last = 0)
+        {
+            return path[i] == '\0' ? last
+                 : basenameOffset(path, i + 1, (path[i] == '/' || path[i] == '\\') ? i + 1 : last);
+        }
+        // FNV-1a哈希, seed可以传入上一段的结果把多段数据串起来
+        inline uint64_t fnv1a(const void *data, size_t len, uint64_t seed = 14695981039346656037ULL)
+        {
+            const unsigned char *p = static_cast<const unsigned char *>(data);
+            uint64_t h = seed;
+            for(size_t i = 0; i < len; i++)
+            {
+                h ^= p[i];
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
         class Date
         {
         public:
@@ -39,6 +67,67 @@ namespace logSys
                 else return pathname.substr(0, pos + 1);
             }
 
+            // 处理被信号打断和部分写入, 写完全部数据返回true
+            static bool writeAll(int fd, const char *data, size_t len)
+            {
+                while(len > 0)
+                {
+                    ssize_t ret = ::write(fd, data, len);
+                    if(ret < 0)
+                    {
+                        if(errno == EINTR) continue;
+                        return false;
+                    }
+                    data += ret;
+                    len -= ret;
+                }
+                return true;
+            }
+            // 多段数据用writev一起写出, 处理部分写入
+            static bool writevAll(int fd, const struct iovec *iov, int cnt)
+            {
+                while(cnt > 0)
+                {
+                    ssize_t ret = ::writev(fd, iov, cnt < IOV_MAX ? cnt : IOV_MAX);
+                    if(ret < 0)
+                    {
+                        if(errno == EINTR) continue;
+                        return false;
+                    }
+                    while(cnt > 0 && (size_t)ret >= iov->iov_len)
+                    {
+                        ret -= iov->iov_len;
+                        iov++;
+                        cnt--;
+                    }
+                    if(cnt > 0 && ret > 0)
+                    {
+                        // 只写了一部分的那一段用write补齐
+                        if(!writeAll(fd, (const char *)iov->iov_base + ret, iov->iov_len - ret)) return false;
+                        iov++;
+                        cnt--;
+                    }
+                }
+                return true;
+            }
+            // 写到指定偏移, 不改变文件位置
+            static bool pwriteAll(int fd, const char *data, size_t len, off_t offset)
+            {
+                while(len > 0)
+                {
+                    ssize_t ret = ::pwrite(fd, data, len, offset);
+                    if(ret < 0)
+                    {
+                        if(errno == EINTR) continue;
+                        return false;
+                    }
+                    data += ret;
+                    len -= ret;
+                    offset += ret;
+                }
+                return true;
+            }
+
             static void createDirectory(const std::string &pathname)
             {
                 if(pathname.empty()) return;
@@ -74,5 +163,78 @@ namespace logSys
                 
             }
         };
+
+        // 线程身份, 字符串在线程第一次使用时生成一次
+        struct ThreadInfo
+        {
+            pid_t _tid;           // 内核线程id, 与top/perf显示的一致
+            std::string _tid_str;
+            std::string _name;    // 线程名, 没有设置时为内核中的线程名
+        };
+        class Thread
+        {
+        public:
+            static const ThreadInfo &current() { return info(); }
+            static pid_t tid() { return info()._tid; }
+            // 设置当前线程名, 同时设置内核线程名(最多15个字符)
+            static void setName(const std::string &name)
+            {
+                info()._name = name;
+                pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+            }
+        private:
+            static ThreadInfo &info()
+            {
+                static thread_local ThreadInfo ti = create();
+                return ti;
+            }
+            static ThreadInfo create()
+            {
+                ThreadInfo ti;
+                ti._tid = (pid_t)syscall(SYS_gettid);
+                ti._tid_str = std::to_string(ti._tid);
+                char name[16] = { 0 };
+                if(pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) ti._name = name;
+                return ti;
+            }
+        };
+
+        // 线程私有的字符串缓冲区, 复用容量避免每条日志分配
+        // 同一线程嵌套使用(如落地方向内部再打日志)时按层取用, 超出层数退化为临时字符串
+        class ThreadBuffer
+        {
+        public:
+            ThreadBuffer()
+            :_depth(depth())
+            {
+                _str = _depth < POOL_SIZE ? &pool()[_depth] : &_local;
+                _str->clear();
+                depth()++;
+            }
+            ~ThreadBuffer()
+            {
+                depth()--;
+                if(_str->capacity() > SHRINK_SIZE)
+                    std::string().swap(*_str);
+            }
+            ThreadBuffer(const ThreadBuffer &) = delete;
+            ThreadBuffer &operator=(const ThreadBuffer &) = delete;
+            std::string &str() { return *_str; }
+        private:
+            enum { POOL_SIZE = 8, SHRINK_SIZE = 64 * 1024 };
+            static std::string *pool()
+            {
+                static thread_local std::string strs[POOL_SIZE];
+                return strs;
+            }
+            static size_t &depth()
+            {
+                static thread_local size_t d = 0;
+                return d;
+            }
+            size_t _depth;
+            std::string *_str;
+            std::string _local;
+        };
     }
-}
\ No newline at end of file
+}
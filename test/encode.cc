@@ -0,0 +1,147 @@
+#include "encode.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+/*
+    encode-test: 把编码函数的输出和简单的参考实现对照
+        1. dtoa: 随机和边界上的double, 输出能还原出同一个值, 且不长于snprintf("%.17g")
+        2. JSON转义和单行转义: 随机内容、长度和对齐(覆盖SIMD的整块和尾部), 与逐字节的参考转义一致
+    失败时输出原因并以非0退出
+*/
+namespace
+{
+    void check(bool ok, const std::string &what)
+    {
+        if(ok) return;
+        std::cout << "FAIL: " << what << std::endl;
+        exit(1);
+    }
+    // 有效数字的个数, 不计符号、小数点、首尾的0和指数部分
+    size_t digitCount(const std::string &s)
+    {
+        std::string digits;
+        for(char c : s)
+        {
+            if(c == 'e' || c == 'E') break;
+            if(c >= '0' && c <= '9') digits += c;
+        }
+        size_t first = digits.find_first_not_of('0');
+        if(first == std::string::npos) return 0;
+        return digits.find_last_not_of('0') - first + 1;
+    }
+    void checkDouble(double value)
+    {
+        char buf[64];
+        size_t len = logSys::util::Number::dtoa(value, buf);
+        std::string text(buf, len);
+        snprintf(buf, sizeof(buf), "%.17g", value);
+        std::string ref = buf;
+        double back = strtod(text.c_str(), nullptr);
+        check(memcmp(&back, &value, sizeof(value)) == 0, "dtoa: " + text + " does not round-trip " + ref);
+        check(digitCount(text) <= digitCount(ref), "dtoa: " + text + " longer than " + ref);
+    }
+    void testDtoa()
+    {
+        const double fixed[] = { 0.0, -0.0, 1.0, -1.0, 0.1, 0.2, 0.3, 1.5, 100.0, 1e21, 1e22, 1e-7, 123456789012345678.0,
+                                 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308, 9007199254740993.0, 0.1 + 0.2 };
+        for(double v : fixed) checkDouble(v);
+        std::mt19937_64 rng(42);
+        for(int i = 0; i < 200000; i++)
+        {
+            uint64_t bits = rng();
+            double v;
+            memcpy(&v, &bits, sizeof(v));
+            if(!std::isfinite(v)) continue;
+            checkDouble(v);
+        }
+        for(int i = 0; i < 100000; i++)
+        {
+            // 常见量级的数值
+            checkDouble((double)(rng() % 2000000) / 1000.0);
+        }
+        std::cout << "dtoa: round-trips and is no longer than %.17g" << std::endl;
+    }
+
+    // 逐字节的参考实现
+    std::string refJson(const std::string &s)
+    {
+        std::string out;
+        char buf[8];
+        for(unsigned char c : s)
+        {
+            switch(c)
+            {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                default:
+                    if(c < 0x20)
+                    {
+                        snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out += buf;
+                    }
+                    else out += (char)c;
+            }
+        }
+        return out;
+    }
+    std::string refLine(const std::string &s)
+    {
+        std::string out;
+        char buf[8];
+        for(unsigned char c : s)
+        {
+            if(c == '\\') out += "\\\\";
+            else if(c == '\n') out += "\\n";
+            else if(c == '\r') out += "\\r";
+            else if((c < 0x20 && c != '\t') || c == 0x7f)
+            {
+                snprintf(buf, sizeof(buf), "\\x%02x", c);
+                out += buf;
+            }
+            else out += (char)c;
+        }
+        return out;
+    }
+    void testEscape()
+    {
+        std::mt19937 rng(7);
+        std::string storage(512, '\0');
+        for(int i = 0; i < 100000; i++)
+        {
+            // 长度跨过16和32字节的整块, 起点错开对齐
+            size_t len = rng() % 100, offset = rng() % 32;
+            int density = rng() % 4; // 0: 没有特殊字节, 越大越密
+            for(size_t k = 0; k < len; k++)
+            {
+                unsigned char c = 'a' + rng() % 26;
+                if(density > 0 && rng() % (64 >> (density * 2)) == 0) c = rng() % 256;
+                storage[offset + k] = (char)c;
+            }
+            std::string text = storage.substr(offset, len);
+            std::string json;
+            logSys::util::Escape::appendJson(json, &storage[offset], len);
+            check(json == refJson(text), "escape: json mismatch for case " + std::to_string(i));
+            std::ostringstream line;
+            logSys::util::Escape::writeLine(line, &storage[offset], len);
+            check(line.str() == refLine(text), "escape: line mismatch for case " + std::to_string(i));
+        }
+        std::cout << "escape: " << logSys::util::Escape::simdName() << " matches the byte-wise reference" << std::endl;
+    }
+}
+int main()
+{
+    testDtoa();
+    testEscape();
+    std::cout << "encode-test: OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "sink.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+/*
+    index-test: 验证文件落地的旁路索引在写入失败后重新对齐
+        1. 用RLIMIT_FSIZE让一次写入只写出一部分, 之后放开限制继续写入
+        2. 每个条目从记录开头开始、只包含完整的记录, 条目的时间和等级覆盖其中每条记录
+        3. 写了一半的残片不属于任何条目, 查询时作为空洞返回
+        4. 按时间区间和等级查询, 命中的每条记录都在返回的区间内, 且窄区间的查询确实跳过了数据
+    失败时输出原因并以非0退出
+*/
+namespace
+{
+    void check(bool ok, const std::string &what)
+    {
+        if(ok) return;
+        std::cout << "FAIL: " << what << std::endl;
+        exit(1);
+    }
+    // 写入成功的一条记录
+    struct Record
+    {
+        uint64_t _offset;
+        uint64_t _length;
+        time_t _time;
+        logSys::LogLevel::Level _level;
+    };
+    const time_t BASE_TIME = 1000000;
+
+    uint64_t fileSize(const std::string &path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+    }
+    bool inRanges(const std::vector<logSys::LogIndex::Range> &ranges, uint64_t offset, uint64_t length)
+    {
+        for(auto &r : ranges)
+        {
+            if(offset >= r._offset && (r._length == UINT64_MAX || offset + length <= r._offset + r._length)) return true;
+        }
+        return false;
+    }
+    void checkQuery(const std::string &path, const std::vector<Record> &records, uint64_t frag_start, uint64_t frag_end,
+                    time_t from, time_t to, uint32_t mask, bool selective)
+    {
+        auto ranges = logSys::LogIndex::query(path, from, to, mask);
+        size_t hits = 0;
+        for(auto &r : records)
+        {
+            if(r._time < from || r._time > to || (logSys::RecordMeta::levelBit(r._level) & mask) == 0) continue;
+            check(inRanges(ranges, r._offset, r._length), "query: record at " + std::to_string(r._offset) + " not in ranges");
+            hits++;
+        }
+        check(inRanges(ranges, frag_start, frag_end - frag_start), "query: fragment hole not returned");
+        uint64_t scanned = 0;
+        for(auto &r : ranges) scanned += r._length == UINT64_MAX ? fileSize(path) - r._offset : r._length;
+        if(selective) check(scanned < fileSize(path) / 2, "query: scans " + std::to_string(scanned) + " bytes");
+        std::cout << "query [" << from - BASE_TIME << ", " << to - BASE_TIME << "]: " << hits << " records, "
+                  << ranges.size() << " ranges, " << scanned << " bytes to scan" << std::endl;
+    }
+}
+int main()
+{
+    const size_t COUNT = 12000;
+    const rlim_t LIMIT = 300000;
+    const std::string path = "./logdir/index-test.log";
+    unlink(path.c_str());
+    unlink(logSys::IndexWriter::pathFor(path).c_str());
+
+    std::vector<Record> records;
+    uint64_t frag_start = 0, frag_end = 0;
+    {
+        auto sink = std::make_shared<logSys::FileSink>(path, logSys::FileWriteMode::APPEND, true);
+        // 超过文件大小限制时写入返回EFBIG而不是收到信号
+        signal(SIGXFSZ, SIG_IGN);
+        struct rlimit old_limit, limit;
+        getrlimit(RLIMIT_FSIZE, &old_limit);
+        limit = old_limit;
+        limit.rlim_cur = LIMIT;
+        check(setrlimit(RLIMIT_FSIZE, &limit) == 0, "setrlimit failed");
+        uint64_t expect = 0;
+        for(size_t i = 0; i < COUNT; i++)
+        {
+            Record r;
+            r._offset = expect;
+            r._time = BASE_TIME + i / 50;
+            r._level = i % 97 == 0 ? logSys::LogLevel::Level::ERROR : (logSys::LogLevel::Level)((int)logSys::LogLevel::Level::DEBUG + i % 3);
+            std::string rec = "@" + std::to_string(r._time) + " " + logSys::LogLevel::toString(r._level) + " payload "
+                            + std::to_string(i) + " " + std::string(i % 40, 'x') + "\n";
+            r._length = rec.size();
+            logSys::RecordMeta meta;
+            meta.add(r._time, r._level);
+            sink->write(rec.c_str(), rec.size(), r._level, &meta);
+            uint64_t size = fileSize(path);
+            if(size == expect + rec.size())
+            {
+                records.push_back(r);
+                expect = size;
+                continue;
+            }
+            // 只写出了一部分, 放开限制继续写入
+            check(frag_end == 0 && size > expect && size < expect + rec.size(), "unexpected file size " + std::to_string(size));
+            frag_start = expect;
+            frag_end = expect = size;
+            check(setrlimit(RLIMIT_FSIZE, &old_limit) == 0, "restoring rlimit failed");
+        }
+        check(frag_end != 0, "no partial write happened");
+    }
+    std::cout << "wrote " << records.size() << " records, fragment at [" << frag_start << ", " << frag_end << ")" << std::endl;
+
+    std::vector<logSys::IndexEntry> entries;
+    check(logSys::LogIndex::load(path, entries) && !entries.empty(), "index not loaded");
+    size_t r = 0;
+    uint64_t cursor = 0;
+    for(auto &e : entries)
+    {
+        std::string where = "entry at " + std::to_string(e._offset);
+        check(e._offset >= cursor, where + " overlaps the previous one");
+        check(e._offset + e._length <= frag_start || e._offset >= frag_end, where + " covers the fragment");
+        while(r < records.size() && records[r]._offset < e._offset) r++;
+        check(r < records.size() && records[r]._offset == e._offset, where + " does not start at a record");
+        uint64_t end = e._offset + e._length;
+        for(; r < records.size() && records[r]._offset < end; r++)
+        {
+            const Record &rec = records[r];
+            check(rec._offset + rec._length <= end, where + " ends inside a record");
+            check(rec._time >= e._min_time && rec._time <= e._max_time, where + " time range misses a record");
+            check((e._levels & logSys::RecordMeta::levelBit(rec._level)) != 0, where + " levels miss a record");
+        }
+        cursor = end;
+    }
+    check(r == records.size(), "records after the last entry");
+    std::cout << entries.size() << " entries align with whole records" << std::endl;
+
+    checkQuery(path, records, frag_start, frag_end, BASE_TIME, BASE_TIME + COUNT / 50, ~0u, false);
+    checkQuery(path, records, frag_start, frag_end, BASE_TIME + 10, BASE_TIME + 12, ~0u, true);
+    checkQuery(path, records, frag_start, frag_end, BASE_TIME + 100, BASE_TIME + 140,
+               logSys::RecordMeta::atLeast(logSys::LogLevel::Level::ERROR), false);
+    // 残片所在时间附近的查询
+    time_t frag_time = BASE_TIME;
+    for(auto &rec : records) if(rec._offset >= frag_end) { frag_time = rec._time; break; }
+    checkQuery(path, records, frag_start, frag_end, frag_time - 1, frag_time + 1, ~0u, true);
+
+    unlink(path.c_str());
+    unlink(logSys::IndexWriter::pathFor(path).c_str());
+    std::cout << "index-test: OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "looper.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+/*
+    looper-test: 验证环形缓冲区和异步工作器
+        1. RingBuffer: 不同长度的写入和读取反复回绕, 可读区域最多两段, 读出的内容与写入一致
+        2. AsyncLooper: 多个生产者写入的数据量超过环的容量, 每个生产者的记录都完整且按顺序落地
+        3. 紧急通道: 工作线程阻塞期间排队的紧急记录先于已排队的普通记录落地, 并调用紧急回调
+        4. 重复折叠: 新的一段和段超时都写出汇总, 折叠条数和首末记录的时间跨度正确
+    失败时输出原因并以非0退出
+*/
+namespace
+{
+    void check(bool ok, const std::string &what)
+    {
+        if(ok) return;
+        std::cout << "FAIL: " << what << std::endl;
+        exit(1);
+    }
+    // 第i个字节的内容, 用来检查读出的数据
+    char pattern(size_t i) { return (char)('a' + i % 23); }
+
+    void testRingBuffer()
+    {
+        logSys::RingBuffer ring(1000);
+        check(ring.capacity() == 1024, "ring: capacity not rounded up to a power of two");
+        size_t written = 0, read = 0, wrapped = 0;
+        char buf[1024];
+        for(size_t round = 0; round < 10000; round++)
+        {
+            size_t len = (round * 37) % 300 + 1;
+            if(len <= ring.writeAbleSize())
+            {
+                for(size_t i = 0; i < len; i++) buf[i] = pattern(written + i);
+                ring.writeAndPush(buf, len);
+                written += len;
+            }
+            if(round % 3 == 0) continue;
+            struct iovec iov[2];
+            int cnt = ring.readSpans(iov);
+            check(cnt >= 0 && cnt <= 2, "ring: span count " + std::to_string(cnt));
+            size_t got = 0;
+            for(int k = 0; k < cnt; k++)
+            {
+                const char *data = (const char *)iov[k].iov_base;
+                for(size_t i = 0; i < iov[k].iov_len; i++)
+                {
+                    check(data[i] == pattern(read + got + i), "ring: wrong byte at " + std::to_string(read + got + i));
+                }
+                got += iov[k].iov_len;
+            }
+            check(got == ring.readAbleSize(), "ring: spans do not cover the readable size");
+            if(cnt == 2) wrapped++;
+            // 只释放一部分, 让读写位置在缓冲区中错开
+            size_t release = got / 2 + (round % 2 ? got - got / 2 : 0);
+            ring.moveReadBack(release);
+            read += release;
+        }
+        check(wrapped > 0, "ring: readable region never wrapped");
+        std::cout << "ring: " << written << " bytes, " << wrapped << " wrapped reads" << std::endl;
+    }
+
+    // 多个生产者同时写入, 检查每个生产者的记录完整且有序
+    void testLooper(logSys::AsyncType type, const std::string &name)
+    {
+        const size_t PRODUCERS = 4, COUNT = 100000;
+        std::string out;
+        size_t batches = 0, wrapped = 0;
+        {
+            logSys::AsyncLooper looper([&](const struct iovec *iov, int cnt, const logSys::RecordMeta &){
+                for(int i = 0; i < cnt; i++) out.append((const char *)iov[i].iov_base, iov[i].iov_len);
+                batches++;
+                if(cnt > 1) wrapped++;
+            }, type);
+            std::vector<std::thread> threads;
+            for(size_t p = 0; p < PRODUCERS; p++)
+            {
+                threads.emplace_back([&looper, p](){
+                    for(size_t i = 0; i < COUNT; i++)
+                    {
+                        std::string rec = "p" + std::to_string(p) + " " + std::to_string(i) + "\n";
+                        looper.push(rec.c_str(), rec.size());
+                    }
+                });
+            }
+            for(auto &t : threads) t.join();
+        }
+        std::vector<size_t> next(PRODUCERS, 0);
+        size_t pos = 0, lines = 0;
+        while(pos < out.size())
+        {
+            size_t end = out.find('\n', pos);
+            check(end != std::string::npos, name + ": torn last record");
+            std::string line = out.substr(pos, end - pos);
+            pos = end + 1;
+            size_t sp = line.find(' ');
+            check(line.size() > 1 && line[0] == 'p' && sp != std::string::npos, name + ": bad record " + line);
+            size_t p = strtoul(line.c_str() + 1, nullptr, 10), i = strtoul(line.c_str() + sp + 1, nullptr, 10);
+            check(p < PRODUCERS && i == next[p], name + ": record " + line + " out of order");
+            next[p]++;
+            lines++;
+        }
+        check(lines == PRODUCERS * COUNT, name + ": got " + std::to_string(lines) + " records");
+        std::cout << name << ": " << lines << " records in " << batches << " batches, "
+                  << wrapped << " gathered from two spans" << std::endl;
+    }
+
+    // 第一个批次落地时阻塞工作线程, 期间写入普通和紧急记录, 放行后紧急记录应排在前面
+    void testUrgent(logSys::AsyncType type, const std::string &name)
+    {
+        const size_t COUNT = 1000;
+        std::string out;
+        std::atomic<bool> started(false), release(false);
+        std::atomic<size_t> hooks(0);
+        {
+            logSys::AsyncLooper looper([&](const struct iovec *iov, int cnt, const logSys::RecordMeta &){
+                for(int i = 0; i < cnt; i++) out.append((const char *)iov[i].iov_base, iov[i].iov_len);
+                started = true;
+                while(!release) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }, type, logSys::AsyncLooper::PressureProbe(), [&](){ hooks++; });
+            looper.push("n0\n", 3);
+            while(!started) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            for(size_t i = 1; i <= COUNT; i++)
+            {
+                std::string rec = "n" + std::to_string(i) + "\n";
+                looper.push(rec.c_str(), rec.size());
+            }
+            looper.push("U\n", 2, logSys::AsyncLane::URGENT);
+            release = true;
+        }
+        size_t urgent = out.find("U\n"), first = out.find("n1\n"), last = out.find("n" + std::to_string(COUNT) + "\n");
+        check(out.compare(0, 3, "n0\n") == 0, name + ": first batch is not n0");
+        check(urgent != std::string::npos && first != std::string::npos && last != std::string::npos, name + ": records lost");
+        check(urgent < first, name + ": urgent record landed after queued normal records");
+        check(hooks.load() == 1, name + ": urgent hook called " + std::to_string(hooks.load()) + " times");
+        std::cout << name << ": urgent record landed before " << COUNT << " queued normal records" << std::endl;
+    }
+
+    // A重复4次后换成B, 由新的一段触发A的汇总; B重复2次后等过窗口, 由段超时写出汇总
+    void testDedup(logSys::AsyncType type, const std::string &name)
+    {
+        const uint64_t WINDOW_MS = 500, GAP_MS = 10;
+        std::string out;
+        {
+            logSys::AsyncLooper looper([&](const struct iovec *iov, int cnt, const logSys::RecordMeta &){
+                for(int i = 0; i < cnt; i++) out.append((const char *)iov[i].iov_base, iov[i].iov_len);
+            }, type);
+            looper.setDedup(WINDOW_MS * 1000000, [](const logSys::DedupKey &key, uint64_t count, uint64_t span, std::string &text){
+                text = "R" + std::to_string(key._line) + " " + std::to_string(count) + " " + std::to_string(span / 1000000) + "\n";
+            });
+            logSys::DedupKey a = { 1, logSys::LogLevel::Level::INFO, __FILE__, 10, 0 };
+            logSys::DedupKey b = { 2, logSys::LogLevel::Level::INFO, __FILE__, 20, 0 };
+            looper.push("A\n", 2, logSys::AsyncLane::NORMAL, &a);
+            for(int i = 0; i < 4; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(GAP_MS));
+                looper.push("A\n", 2, logSys::AsyncLane::NORMAL, &a);
+            }
+            looper.push("B\n", 2, logSys::AsyncLane::NORMAL, &b);
+            looper.push("B\n", 2, logSys::AsyncLane::NORMAL, &b);
+            looper.push("B\n", 2, logSys::AsyncLane::NORMAL, &b);
+            std::this_thread::sleep_for(std::chrono::milliseconds(WINDOW_MS + 200));
+            looper.push("B\n", 2, logSys::AsyncLane::NORMAL, &b);
+        }
+        std::vector<std::string> lines;
+        for(size_t pos = 0, end; (end = out.find('\n', pos)) != std::string::npos; pos = end + 1) lines.push_back(out.substr(pos, end - pos));
+        check(lines.size() == 5, name + ": got " + std::to_string(lines.size()) + " lines: " + out);
+        check(lines[0] == "A" && lines[2] == "B" && lines[4] == "B", name + ": unexpected records: " + out);
+        unsigned long line = 0, count = 0, span = 0;
+        check(sscanf(lines[1].c_str(), "R%lu %lu %lu", &line, &count, &span) == 3 && line == 10 && count == 4,
+              name + ": bad summary for A: " + lines[1]);
+        check(span >= 4 * GAP_MS && span < WINDOW_MS, name + ": span of A is " + std::to_string(span) + "ms");
+        check(sscanf(lines[3].c_str(), "R%lu %lu %lu", &line, &count, &span) == 3 && line == 20 && count == 2,
+              name + ": bad timeout summary for B: " + lines[3]);
+        check(span < WINDOW_MS, name + ": span of B is " + std::to_string(span) + "ms");
+        std::cout << name << ": " << lines[1] << " / " << lines[3] << std::endl;
+    }
+}
+int main()
+{
+    testRingBuffer();
+    testLooper(logSys::AsyncType::AsyncSafe, "safe");
+    testLooper(logSys::AsyncType::AsyncUnSafe, "unsafe");
+    testUrgent(logSys::AsyncType::AsyncSafe, "urgent-safe");
+    testUrgent(logSys::AsyncType::AsyncUnSafe, "urgent-unsafe");
+    testDedup(logSys::AsyncType::AsyncSafe, "dedup-safe");
+    testDedup(logSys::AsyncType::AsyncUnSafe, "dedup-unsafe");
+    std::cout << "looper-test: OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include "netsink.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+/*
+    netsink-test: 用本机回环上的接收端验证NetSink
+        1. TCP: 接收端读到一部分后断开并停止监听, 期间的日志进入溢出文件; 重新监听后按顺序补发, 不丢不重
+           批次交替以单段和两段iovec(一行跨越两段)写入
+        2. 溢出文件补发到一半时重建落地, 从记录的位置继续补发, 不重复
+        3. 溢出文件满时只保留整行
+        4. 发送缓冲区满时一行被切开, 之后连接断开: 新连接上收到的都是整行且连续
+        5. UDP: 一次写入多行, 经sendmmsg分批发出, 每行作为一个数据报完整到达
+    失败时输出原因并以非0退出
+*/
+namespace
+{
+    const int WAIT_MS = 10000; // 单个步骤的最长等待时间
+
+    void check(bool ok, const std::string &what)
+    {
+        if(ok) return;
+        std::cout << "FAIL: " << what << std::endl;
+        exit(1);
+    }
+    std::string record(size_t i) { return "rec " + std::to_string(i) + "\n"; }
+    // 检查lines是从first开始连续的记录
+    void checkSequence(const std::vector<std::string> &lines, size_t first, const std::string &what)
+    {
+        for(size_t i = 0; i < lines.size(); i++)
+        {
+            check(lines[i] == record(first + i), what + ": line " + std::to_string(i) + " is " + lines[i]);
+        }
+    }
+
+    // 在127.0.0.1上监听, port为0时由内核分配
+    int listenOn(int type, uint16_t &port)
+    {
+        int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+        check(fd >= 0, "socket");
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        check(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, "bind");
+        if(type == SOCK_STREAM) check(listen(fd, 4) == 0, "listen");
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (struct sockaddr *)&addr, &len);
+        port = ntohs(addr.sin_port);
+        return fd;
+    }
+
+    // TCP接收端: 依次接受连接并按行读取, 读满want行或读到last行后关闭; 连接结束时末尾不完整的行计入torn
+    class TcpServer
+    {
+    public:
+        TcpServer(int listen_fd, size_t want, const std::string &last = "")
+        :_listen_fd(listen_fd), _want(want), _last(last), _done(false), _count(0), _torn(0)
+        {
+            _thread = std::thread(&TcpServer::run, this);
+        }
+        size_t count() const { return _count; }
+        bool done() const { return _done; }
+        size_t torn() const { return _torn; }
+        std::vector<std::string> join()
+        {
+            _thread.join();
+            return _lines;
+        }
+    private:
+        void run()
+        {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(WAIT_MS);
+            while(!_done && std::chrono::steady_clock::now() < deadline)
+            {
+                struct pollfd pfd = { _listen_fd, POLLIN, 0 };
+                if(poll(&pfd, 1, 100) <= 0) continue;
+                int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if(fd < 0) continue;
+                readLines(fd);
+                close(fd);
+            }
+        }
+        void readLines(int fd)
+        {
+            std::string pending;
+            char buf[4096];
+            while(!_done)
+            {
+                struct pollfd pfd = { fd, POLLIN, 0 };
+                if(poll(&pfd, 1, WAIT_MS) <= 0) break;
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if(n <= 0) break;
+                pending.append(buf, n);
+                size_t pos;
+                while((pos = pending.find('\n')) != std::string::npos)
+                {
+                    _lines.push_back(pending.substr(0, pos + 1));
+                    pending.erase(0, pos + 1);
+                    if(_lines.size() >= _want || _lines.back() == _last) _done = true;
+                }
+                _count = _lines.size();
+            }
+            if(!pending.empty()) _torn++;
+        }
+        int _listen_fd;
+        size_t _want;
+        std::string _last;
+        std::atomic<bool> _done;
+        std::atomic<size_t> _count;
+        std::atomic<size_t> _torn;
+        std::vector<std::string> _lines;
+        std::thread _thread;
+    };
+
+    // 每次写入batch条记录, 模拟工作器交给落地的一批数据; 奇数批在一行中间切成两段iovec
+    void logRange(logSys::NetSink &sink, size_t begin, size_t end, size_t batch)
+    {
+        for(size_t n = 0; begin < end; n++)
+        {
+            std::string data;
+            for(size_t i = 0; i < batch && begin < end; i++) data += record(begin++);
+            if(n % 2 == 0 || data.size() < 2)
+            {
+                sink.log(data.c_str(), data.size());
+                continue;
+            }
+            size_t half = data.size() / 2;
+            if(data[half - 1] == '\n') half++;
+            struct iovec iov[2] = { { &data[0], half }, { &data[half], data.size() - half } };
+            sink.log(iov, 2);
+        }
+    }
+    // NetSink只在写入时推进连接和补发, 没有新日志时用空批次驱动, 直到接收端读够为止
+    void pump(logSys::NetSink &sink, const TcpServer &server, size_t want)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(WAIT_MS);
+        while(!server.done() && server.count() < want && std::chrono::steady_clock::now() < deadline)
+        {
+            sink.log("", 0);
+            usleep(5 * 1000);
+        }
+    }
+    // 等待连接建立或断开被发现
+    void waitConnected(logSys::NetSink &sink)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(WAIT_MS);
+        while(!sink.connected() && std::chrono::steady_clock::now() < deadline)
+        {
+            sink.log("", 0);
+            usleep(5 * 1000);
+        }
+        check(sink.connected(), "tcp: did not connect");
+    }
+
+    void testReconnect()
+    {
+        const size_t PHASE = 1000;
+        const std::string spill = "./logdir/netsink-test.spill";
+        unlink(spill.c_str());
+        uint16_t port = 0;
+        int lfd = listenOn(SOCK_STREAM, port);
+        std::vector<std::string> lines;
+        {
+            logSys::NetSink sink("127.0.0.1", port, logSys::NetProto::TCP, spill);
+            // 1. 正常发送, 接收端读完后断开
+            TcpServer first(lfd, PHASE);
+            logRange(sink, 0, PHASE, 10);
+            pump(sink, first, PHASE);
+            lines = first.join();
+            check(lines.size() == PHASE, "tcp: first connection got " + std::to_string(lines.size()) + " lines");
+            close(lfd);
+            // 2. 接收端不可用, 新日志进入溢出文件
+            logRange(sink, PHASE, 2 * PHASE, 10);
+            check(!sink.connected(), "tcp: peer close not detected");
+            check(sink.backpressured(), "tcp: not backpressured while peer is down");
+            // 3. 在同一端口重新监听, 补发溢出数据后继续发送新日志
+            lfd = listenOn(SOCK_STREAM, port);
+            TcpServer second(lfd, 2 * PHASE);
+            logRange(sink, 2 * PHASE, 3 * PHASE, 10);
+            pump(sink, second, 2 * PHASE);
+            std::vector<std::string> rest = second.join();
+            lines.insert(lines.end(), rest.begin(), rest.end());
+            close(lfd);
+            check(second.torn() == 0, "tcp: torn line");
+            check(sink.connected(), "tcp: did not reconnect");
+            check(!sink.backpressured(), "tcp: spill not drained");
+            check(sink.dropped() == 0, "tcp: dropped " + std::to_string(sink.dropped()) + " bytes");
+        }
+        check(lines.size() == 3 * PHASE, "tcp: got " + std::to_string(lines.size()) + " lines");
+        checkSequence(lines, 0, "tcp");
+        unlink(spill.c_str());
+        std::cout << "tcp: " << lines.size() << " lines in order across reconnect" << std::endl;
+    }
+
+    // 补发到一半时重建落地: 已经补发的部分不再重发
+    void testSpillResume()
+    {
+        const size_t COUNT = 150000; // 约1.7MB, 超过单批的补发上限, 一次写入补发不完
+        const std::string spill = "./logdir/netsink-resume.spill";
+        unlink(spill.c_str());
+        uint16_t port = 0;
+        int lfd = listenOn(SOCK_STREAM, port);
+        close(lfd); // 先让对端不可用
+        {
+            logSys::NetSink sink("127.0.0.1", port, logSys::NetProto::TCP, spill);
+            logRange(sink, 0, COUNT, 100);
+            check(!sink.connected() && sink.backpressured(), "resume: records were not spilled");
+        }
+        lfd = listenOn(SOCK_STREAM, port);
+        TcpServer server(lfd, COUNT);
+        {
+            logSys::NetSink sink("127.0.0.1", port, logSys::NetProto::TCP, spill);
+            waitConnected(sink);
+            check(server.count() < COUNT, "resume: spill drained in one call");
+        }
+        {
+            logSys::NetSink sink("127.0.0.1", port, logSys::NetProto::TCP, spill);
+            pump(sink, server, COUNT);
+            check(sink.dropped() == 0, "resume: dropped " + std::to_string(sink.dropped()) + " bytes");
+        }
+        std::vector<std::string> lines = server.join();
+        close(lfd);
+        check(lines.size() == COUNT, "resume: got " + std::to_string(lines.size()) + " lines");
+        check(server.torn() == 0, "resume: torn line");
+        checkSequence(lines, 0, "resume");
+        unlink(spill.c_str());
+        std::cout << "spill: " << lines.size() << " lines resumed across restart without duplicates" << std::endl;
+    }
+
+    // 溢出文件满: 只保留放得下的整行
+    void testSpillFull()
+    {
+        const size_t COUNT = 1000, SPILL_MAX = 1000;
+        const std::string spill = "./logdir/netsink-full.spill";
+        unlink(spill.c_str());
+        uint16_t port = 0;
+        int lfd = listenOn(SOCK_STREAM, port);
+        close(lfd);
+        logSys::NetSink sink("127.0.0.1", port, logSys::NetProto::TCP, spill, SPILL_MAX);
+        logRange(sink, 0, COUNT, 7);
+        size_t total = 0;
+        for(size_t i = 0; i < COUNT; i++) total += record(i).size();
+        lfd = listenOn(SOCK_STREAM, port);
+        size_t kept = 0, bytes = 0;
+        while(bytes + record(kept).size() <= SPILL_MAX) bytes += record(kept++).size();
+        TcpServer server(lfd, kept);
+        pump(sink, server, kept);
+        std::vector<std::string> lines = server.join();
+        close(lfd);
+        check(lines.size() == kept, "full: got " + std::to_string(lines.size()) + " lines, want " + std::to_string(kept));
+        checkSequence(lines, 0, "full");
+        check(sink.dropped() == total - bytes, "full: dropped " + std::to_string(sink.dropped()) + " bytes");
+        unlink(spill.c_str());
+        std::cout << "spill: full file kept " << kept << " whole lines" << std::endl;
+    }
+
+    // 对端不读, 发送缓冲区满时一行被切开; 断开重连后新连接上只有整行
+    void testTornLine()
+    {
+        const std::string spill = "./logdir/netsink-torn.spill";
+        unlink(spill.c_str());
+        uint16_t port = 0;
+        int lfd = listenOn(SOCK_STREAM, port);
+        logSys::NetSink sink("127.0.0.1", port, logSys::NetProto::TCP, spill);
+        waitConnected(sink);
+        int fd = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        check(fd >= 0, "torn: accept");
+        // 1. 对端不读, 写到发送受阻为止, 此时最后一行只发出了一部分
+        size_t next = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(WAIT_MS);
+        while(!sink.backpressured() && std::chrono::steady_clock::now() < deadline)
+        {
+            logRange(sink, next, next + 1000, 1000);
+            next += 1000;
+        }
+        check(sink.connected() && sink.backpressured(), "torn: send buffer never filled");
+        // 2. 对端不读就关闭, 内核缓冲区中的数据随连接丢失; 之后的日志进入溢出文件
+        close(fd);
+        close(lfd);
+        logRange(sink, next, next + 1000, 100);
+        next += 1000;
+        check(!sink.connected(), "torn: peer close not detected");
+        // 3. 重新监听, 新连接上收到的应是从某条记录开始的连续整行
+        lfd = listenOn(SOCK_STREAM, port);
+        TcpServer server(lfd, (size_t)-1, record(next));
+        logRange(sink, next, next + 1, 1);
+        pump(sink, server, (size_t)-1);
+        std::vector<std::string> lines = server.join();
+        close(lfd);
+        check(server.torn() == 0, "torn: torn line at end of connection");
+        check(!lines.empty() && lines.back() == record(next), "torn: last record not received");
+        size_t first = next + 1 - lines.size();
+        checkSequence(lines, first, "torn");
+        unlink(spill.c_str());
+        std::cout << "tcp: " << lines.size() << " whole lines after a torn send, from rec " << first << std::endl;
+    }
+
+    void testUdp()
+    {
+        const size_t COUNT = 300; // 大于sendmmsg的单批上限, 需要分多批发出
+        uint16_t port = 0;
+        int fd = listenOn(SOCK_DGRAM, port);
+        int rcvbuf = 4 * 1024 * 1024;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        logSys::NetSink sink("127.0.0.1", port, logSys::NetProto::UDP);
+        logRange(sink, 0, COUNT, COUNT);
+        check(sink.dropped() == 0, "udp: dropped " + std::to_string(sink.dropped()) + " bytes");
+        char buf[2048];
+        size_t got = 0;
+        while(got < COUNT)
+        {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            if(poll(&pfd, 1, WAIT_MS) <= 0) break;
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) break;
+            check(std::string(buf, n) == record(got), "udp: datagram " + std::to_string(got) + " is " + std::string(buf, n));
+            got++;
+        }
+        close(fd);
+        check(got == COUNT, "udp: got " + std::to_string(got) + " datagrams");
+        std::cout << "udp: " << got << " datagrams, one line each" << std::endl;
+    }
+}
+int main()
+{
+    testReconnect();
+    testSpillResume();
+    testSpillFull();
+    testTornLine();
+    testUdp();
+    std::cout << "netsink-test: OK" << std::endl;
+    return 0;
+}
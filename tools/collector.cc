@@ -0,0 +1,114 @@
+#include "shmring.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+/*
+    logsys-collector: 从一个或多个共享内存环形缓冲区读取日志并落盘
+    用法: logsys-collector [-i 空闲轮询间隔ms] 共享内存名=输出路径[:滚动大小] ...
+        logsys-collector /logsys-app=./logdir/app.log
+        logsys-collector /logsys-app=./logdir/app-:67108864
+    指定滚动大小时使用RollBySizeSink, 否则使用FileSink
+*/
+namespace
+{
+    volatile sig_atomic_t g_running = 1;
+    void onStop(int) { g_running = 0; }
+
+    struct Source
+    {
+        std::string _name;
+        logSys::ShmRing::ptr _ring;
+        logSys::LogSink::ptr _sink;
+        uint64_t _reported_dropped;
+    };
+
+    bool parseSource(const std::string &arg, Source &src)
+    {
+        auto eq = arg.find('=');
+        if(eq == std::string::npos || eq == 0 || eq + 1 == arg.size()) return false;
+        src._name = arg.substr(0, eq);
+        std::string out = arg.substr(eq + 1);
+        // 最后一个':'之后全是数字才是滚动大小, 否则属于路径本身
+        auto colon = out.rfind(':');
+        if(colon != std::string::npos && (colon + 1 == out.size()
+           || out.find_first_not_of("0123456789", colon + 1) != std::string::npos))
+        {
+            colon = std::string::npos;
+        }
+        if(colon != std::string::npos)
+        {
+            size_t max_size = strtoull(out.c_str() + colon + 1, nullptr, 10);
+            if(max_size == 0) return false;
+            src._sink = logSys::SinkFactory::create<logSys::RollBySizeSink>(out.substr(0, colon), max_size);
+        }
+        else
+        {
+            src._sink = logSys::SinkFactory::create<logSys::FileSink>(out);
+        }
+        src._reported_dropped = 0;
+        return true;
+    }
+
+    // 读空一个缓冲区, 返回读出的字节数
+    size_t drainSource(Source &src)
+    {
+        if(!src._ring)
+        {
+            // 写入进程可能还没启动
+            src._ring = logSys::ShmRing::attach(src._name);
+            if(!src._ring) return 0;
+            std::cout << "已连接共享内存: " << src._name << std::endl;
+        }
+        logSys::LogSink *sink = src._sink.get();
+        size_t n = src._ring->drain([sink](const char *data, size_t len){ sink->log(data, len); });
+        uint64_t dropped = src._ring->dropped();
+        if(dropped != src._reported_dropped)
+        {
+            std::cout << src._name << " 写入方因缓冲区满丢弃: " << dropped - src._reported_dropped << "字节" << std::endl;
+            src._reported_dropped = dropped;
+        }
+        return n;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    useconds_t idle_us = 1000;
+    std::vector<Source> sources;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "-i" && i + 1 < argc)
+        {
+            idle_us = (useconds_t)atoi(argv[++i]) * 1000;
+            continue;
+        }
+        Source src;
+        if(!parseSource(arg, src))
+        {
+            std::cout << "参数错误: " << arg << std::endl;
+            std::cout << "用法: " << argv[0] << " [-i 空闲轮询间隔ms] 共享内存名=输出路径[:滚动大小] ..." << std::endl;
+            return 1;
+        }
+        sources.push_back(src);
+    }
+    if(sources.empty())
+    {
+        std::cout << "用法: " << argv[0] << " [-i 空闲轮询间隔ms] 共享内存名=输出路径[:滚动大小] ..." << std::endl;
+        return 1;
+    }
+    signal(SIGINT, onStop);
+    signal(SIGTERM, onStop);
+    while(g_running)
+    {
+        size_t total = 0;
+        for(auto &src : sources) total += drainSource(src);
+        if(total == 0) usleep(idle_us);
+    }
+    // 退出前把已经提交的数据读完
+    for(auto &src : sources) drainSource(src);
+    return 0;
+}
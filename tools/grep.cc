@@ -0,0 +1,622 @@
+#include "formatter.hpp"
+#include "index.hpp"
+#include "gzip.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+/*
+    logsys-grep: 并行检索滚动日志分段
+    用法: logsys-grep [-l 最低等级] [-f 开始时间] [-t 结束时间] [-p 格式模式] [-j 线程数] [-c] [文本] 文件或目录 ...
+        logsys-grep -l ERROR -f "2024-01-02 15:04:00" -t "2024-01-02 15:05:00" timeout ./logdir
+        1. 目录下的 *.log 和 *.log.gz 都参与检索; 普通文件mmap后切成多块, 压缩分段流式解压并在换行处切块
+           所有块由线程池并行处理, 已领取还没输出的块不超过线程数的两倍
+        2. 文本按字节精确匹配, 先用SIMD同时比较首尾字符筛出候选位置, 再逐个确认
+        3. 等级和时间按格式模式(默认与Formatter相同)定位字段; 日期中缺少的年月日取文件的修改时间
+           无法按模式解析的行(多行消息的后续行)跟随上一行的结果
+        4. 有旁路索引(见index.hpp)时只检索可能命中等级和时间的块
+        输出按文件和块的顺序, 检索多个文件时行前加文件名
+*/
+namespace
+{
+    const size_t CHUNK_SIZE = 8 * 1024 * 1024; // 普通文件切块的大小
+    const size_t GZIP_BLOCK_SIZE = 4 * 1024 * 1024; // 压缩分段每次解压出的块大小
+
+    // 在[p, end)中查找needle, 找不到返回nullptr
+    const char *search(const char *p, const char *end, const std::string &needle)
+    {
+        size_t k = needle.size();
+        if(k == 0) return p;
+        if((size_t)(end - p) < k) return nullptr;
+        if(k == 1) return (const char *)memchr(p, needle[0], end - p);
+#ifdef __SSE2__
+        if(k > 1)
+        {
+            // 每次检查16个起点: 首字符和尾字符都相等的位置才做完整比较
+            const __m128i first = _mm_set1_epi8(needle[0]);
+            const __m128i last = _mm_set1_epi8(needle[k - 1]);
+            while(end - p >= (ptrdiff_t)(k + 15))
+            {
+                __m128i bf = _mm_loadu_si128((const __m128i *)p);
+                __m128i bl = _mm_loadu_si128((const __m128i *)(p + k - 1));
+                unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+                while(mask != 0)
+                {
+                    int bit = __builtin_ctz(mask);
+                    if(memcmp(p + bit + 1, needle.data() + 1, k - 2) == 0) return p + bit;
+                    mask &= mask - 1;
+                }
+                p += 16;
+            }
+        }
+#endif
+        return (const char *)memmem(p, end - p, needle.data(), k);
+    }
+
+    bool parseTime(const char *arg, time_t &t)
+    {
+        char *end = nullptr;
+        long long v = strtoll(arg, &end, 10);
+        if(end != arg && *end == '\0')
+        {
+            t = (time_t)v;
+            return true;
+        }
+        struct tm tl;
+        memset(&tl, 0, sizeof(tl));
+        const char *rest = strptime(arg, "%Y-%m-%d %H:%M:%S", &tl);
+        if(rest == nullptr || *rest != '\0') return false;
+        tl.tm_isdst = -1;
+        t = mktime(&tl);
+        return true;
+    }
+
+    bool parseLevel(const char *name, size_t len, logSys::LogLevel::Level &level)
+    {
+        static const char *names[] = { "", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL" };
+        for(int i = (int)logSys::LogLevel::Level::DEBUG; i <= (int)logSys::LogLevel::Level::FATAL; i++)
+        {
+            if(strlen(names[i]) == len && memcmp(names[i], name, len) == 0)
+            {
+                level = (logSys::LogLevel::Level)i;
+                return true;
+            }
+        }
+        return false;
+    }
+    bool parseLevel(const std::string &name, logSys::LogLevel::Level &level)
+    {
+        return parseLevel(name.data(), name.size(), level);
+    }
+
+    // 一行中定位到的字段, 指向行内, 没有定位到时长度为0
+    struct LineFields
+    {
+        const char *_level;
+        size_t _level_len;
+        const char *_date;
+        size_t _date_len;
+        const std::string *_date_format;
+    };
+    // 按格式模式把一行拆成字段, 只关心等级和时间
+    class LineLayout
+    {
+    public:
+        explicit LineLayout(const logSys::Formatter &formatter)
+        {
+            for(auto &item : formatter.layout())
+            {
+                if(item._key == "n") continue; // 行已经按换行切开
+                if(!item._key.empty() && item._key != "T")
+                {
+                    _tokens.push_back(item);
+                    if(item._key == "d" && item._value.empty()) _tokens.back()._value = "%H:%M:%S";
+                    continue;
+                }
+                std::string text = item._key.empty() ? item._value : "\t";
+                if(!_tokens.empty() && _tokens.back()._key.empty()) _tokens.back()._value += text;
+                else _tokens.push_back(logSys::Formatter::LayoutItem{ "", text });
+            }
+            // 等级和时间之后的部分不用解析
+            _needed = 0;
+            for(size_t i = 0; i < _tokens.size(); i++)
+            {
+                if(_tokens[i]._key == "p" || _tokens[i]._key == "d") _needed = i + 1;
+            }
+        }
+        // 取出等级和时间字段, 模式中没有或无法定位的字段为空
+        bool parse(const char *line, const char *end, LineFields &fields) const
+        {
+            fields._level_len = fields._date_len = 0;
+            const char *p = line;
+            for(size_t i = 0; i < _needed; i++)
+            {
+                const logSys::Formatter::LayoutItem &tok = _tokens[i];
+                if(tok._key.empty())
+                {
+                    size_t n = tok._value.size();
+                    if((size_t)(end - p) < n || memcmp(p, tok._value.data(), n) != 0) return false;
+                    p += n;
+                    continue;
+                }
+                // 字段到下一个原始字符串为止; 后面紧跟另一个字段时无法切分, 之后的字段不再定位
+                const char *q = end;
+                if(i + 1 < _tokens.size())
+                {
+                    if(!_tokens[i + 1]._key.empty()) return true;
+                    q = search(p, end, _tokens[i + 1]._value);
+                    if(q == nullptr) return false;
+                }
+                if(tok._key == "p")
+                {
+                    fields._level = p;
+                    fields._level_len = q - p;
+                }
+                else if(tok._key == "d")
+                {
+                    fields._date = p;
+                    fields._date_len = q - p;
+                    fields._date_format = &tok._value;
+                }
+                p = q;
+            }
+            return true;
+        }
+    private:
+        std::vector<logSys::Formatter::LayoutItem> _tokens; // 相邻的原始字符串已合并
+        size_t _needed; // 只解析前_needed个子项
+    };
+
+    struct Options
+    {
+        std::string _text;
+        bool _by_level;
+        logSys::LogLevel::Level _level;
+        bool _by_time;
+        time_t _from;
+        time_t _to;
+        bool _count;
+        bool _with_name;
+    };
+
+    // 一个文件: 普通文件mmap, 压缩分段流式解压; 分发任务时才打开
+    struct Source
+    {
+        Source() :_opened(false), _compressed(false), _data(nullptr), _size(0), _offset(0) {}
+        std::string _path;
+        bool _opened;
+        bool _compressed;
+        struct tm _date; // 日期字段缺少年月日时使用
+        const char *_data; // 普通文件的映射
+        size_t _size;
+        uint64_t _offset;  // 已经分发到的位置, 压缩分段为解压后的偏移
+        logSys::GzipReader _reader;
+        std::string _carry; // 压缩分段上一块末尾不完整的行
+        std::vector<logSys::LogIndex::Range> _ranges;
+    };
+
+    // 一个检索任务: 普通文件中的一段, 只处理行首落在[_begin, _end)中的行;
+    // 或压缩分段解压出的一块, 块在换行处切开, 从解压后的偏移_begin开始
+    struct Task
+    {
+        Task(Source *source, size_t begin, size_t end)
+        :_source(source), _begin(begin), _end(end), _last(false), _matches(0), _done(false)
+        {}
+        Source *_source;
+        size_t _begin;
+        size_t _end;
+        bool _last;         // 普通文件的最后一段, 输出后解除映射
+        std::string _block; // 压缩分段的数据
+        std::string _out;
+        uint64_t _matches;
+        bool _done;
+    };
+
+    class Searcher
+    {
+    public:
+        Searcher(const Options &opts, const logSys::Formatter &formatter)
+        :_opts(opts), _layout(formatter)
+        {}
+        void run(Task &task)
+        {
+            Source &src = *task._source;
+            const char *base = src._compressed ? task._block.data() : src._data;
+            size_t size = src._compressed ? task._block.size() : src._size;
+            // 索引区间是文件(解压后)偏移, 压缩块的数据从_begin开始
+            uint64_t shift = src._compressed ? task._begin : 0;
+            for(auto &r : src._ranges)
+            {
+                uint64_t rend = r._length == UINT64_MAX ? UINT64_MAX : r._offset + r._length;
+                uint64_t begin = std::max<uint64_t>(r._offset, task._begin);
+                uint64_t end = std::min<uint64_t>(rend, task._end);
+                if(begin < end) scan(task, base, size, begin - shift, std::min<uint64_t>(end - shift, size));
+            }
+        }
+    private:
+        // 处理base中行首在[begin, end)中的行, 行可以越过end
+        void scan(Task &task, const char *base, size_t size, size_t begin, size_t end)
+        {
+            const Source &src = *task._source;
+            const char *limit = base + size;
+            const char *p = base + begin;
+            if(begin >= end) return;
+            // 不在行首时跳到下一行, 这一行属于前一个任务
+            if(begin > 0 && base[begin - 1] != '\n')
+            {
+                const char *nl = (const char *)memchr(p, '\n', limit - p);
+                if(nl == nullptr) return;
+                p = nl + 1;
+            }
+            const char *stop = base + end;
+            // 最后一行可能越过end, 文本检索最远到这一行的行尾
+            const char *tail = (const char *)memchr(stop - 1, '\n', limit - (stop - 1));
+            const char *search_end = tail == nullptr ? limit : tail + 1;
+            bool keep = true; // 上一条能解析的行是否通过等级和时间过滤
+            DateCache cache;
+            while(p < stop)
+            {
+                if(!_opts._text.empty() && !_opts._by_level && !_opts._by_time)
+                {
+                    // 只按文本检索时直接跳到下一个命中
+                    const char *hit = search(p, search_end, _opts._text);
+                    if(hit == nullptr) return;
+                    const char *prev = (const char *)memrchr(p, '\n', hit - p);
+                    if(prev != nullptr) p = prev + 1;
+                    if(p >= stop) return;
+                }
+                const char *nl = (const char *)memchr(p, '\n', limit - p);
+                const char *line_end = nl == nullptr ? limit : nl;
+                keep = accept(src, p, line_end, keep, cache);
+                if(keep && (_opts._text.empty() || search(p, line_end, _opts._text) != nullptr))
+                {
+                    task._matches++;
+                    if(!_opts._count)
+                    {
+                        if(_opts._with_name)
+                        {
+                            task._out += src._path;
+                            task._out += ':';
+                        }
+                        task._out.append(p, line_end - p);
+                        task._out += '\n';
+                    }
+                }
+                p = line_end + 1;
+            }
+        }
+        // 相邻的行时间字段通常相同, 只在变化时重新解析
+        struct DateCache
+        {
+            DateCache() :_valid(false), _time(0) {}
+            bool _valid;
+            std::string _text;
+            time_t _time;
+        };
+        // 等级和时间过滤, 解析不了的行沿用上一行的结果
+        bool accept(const Source &src, const char *line, const char *end, bool previous, DateCache &cache) const
+        {
+            if(!_opts._by_level && !_opts._by_time) return true;
+            LineFields fields;
+            if(!_layout.parse(line, end, fields)) return previous;
+            if(_opts._by_level && fields._level_len > 0)
+            {
+                logSys::LogLevel::Level lv;
+                if(!parseLevel(fields._level, fields._level_len, lv) || lv < _opts._level) return false;
+            }
+            if(_opts._by_time && fields._date_len > 0)
+            {
+                if(cache._text.size() != fields._date_len || memcmp(cache._text.data(), fields._date, fields._date_len) != 0)
+                {
+                    cache._text.assign(fields._date, fields._date_len);
+                    struct tm tl = src._date;
+                    cache._valid = strptime(cache._text.c_str(), fields._date_format->c_str(), &tl) != nullptr;
+                    tl.tm_isdst = -1;
+                    if(cache._valid) cache._time = mktime(&tl);
+                }
+                if(cache._valid && (cache._time < _opts._from || cache._time > _opts._to)) return false;
+            }
+            return true;
+        }
+    private:
+        const Options &_opts;
+        LineLayout _layout;
+    };
+
+    bool isCompressed(const std::string &path)
+    {
+        return path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+    }
+    bool isSegment(const std::string &name)
+    {
+        return (name.size() > 4 && name.compare(name.size() - 4, 4, ".log") == 0)
+            || (name.size() > 7 && name.compare(name.size() - 7, 7, ".log.gz") == 0);
+    }
+    // 目录展开为其中的分段, 按文件名排序
+    void collect(const std::string &path, std::vector<std::string> &files)
+    {
+        struct stat st;
+        if(stat(path.c_str(), &st) != 0)
+        {
+            std::cerr << "无法访问: " << path << std::endl;
+            return;
+        }
+        if(!S_ISDIR(st.st_mode))
+        {
+            files.push_back(path);
+            return;
+        }
+        std::vector<std::string> found;
+        DIR *dir = opendir(path.c_str());
+        if(dir == nullptr) return;
+        struct dirent *ent;
+        while((ent = readdir(dir)) != nullptr)
+        {
+            std::string name = ent->d_name;
+            if(isSegment(name)) found.push_back(path + (path.back() == '/' ? "" : "/") + name);
+        }
+        closedir(dir);
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    // 按文件顺序生成任务, 调用者串行化; 压缩分段在这里解压出下一块, 与其他线程检索上一块并行
+    class Dispatcher
+    {
+    public:
+        Dispatcher(const Options &opts, std::vector<Source> &sources)
+        :_opts(opts), _sources(sources), _cur(0)
+        {}
+        // 没有任务时返回nullptr
+        std::unique_ptr<Task> next()
+        {
+            while(_cur < _sources.size())
+            {
+                Source &src = _sources[_cur];
+                if(!src._opened && !open(src))
+                {
+                    _cur++;
+                    continue;
+                }
+                std::unique_ptr<Task> task = src._compressed ? nextBlock(src) : nextChunk(src);
+                if(task) return task;
+                _cur++;
+            }
+            return std::unique_ptr<Task>();
+        }
+    private:
+        bool open(Source &src)
+        {
+            src._opened = true;
+            struct stat st;
+            if(stat(src._path.c_str(), &st) != 0) return false;
+            localtime_r(&st.st_mtime, &src._date);
+            src._date.tm_hour = src._date.tm_min = src._date.tm_sec = 0;
+            uint32_t mask = _opts._by_level ? logSys::RecordMeta::atLeast(_opts._level) : ~0u;
+            src._ranges = logSys::LogIndex::query(src._path, _opts._from, _opts._to, mask);
+            src._compressed = isCompressed(src._path);
+            if(src._compressed)
+            {
+                if(src._reader.open(src._path)) return true;
+                std::cerr << "无法解压: " << src._path << std::endl;
+                return false;
+            }
+            if(st.st_size == 0) return false;
+            int fd = ::open(src._path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0) return false;
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if(addr == MAP_FAILED) return false;
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+            src._data = (const char *)addr;
+            src._size = st.st_size;
+            return true;
+        }
+        std::unique_ptr<Task> nextChunk(Source &src)
+        {
+            if(src._offset >= src._size) return std::unique_ptr<Task>();
+            size_t begin = src._offset;
+            size_t end = std::min(begin + CHUNK_SIZE, src._size);
+            src._offset = end;
+            std::unique_ptr<Task> task(new Task(&src, begin, end));
+            task->_last = end == src._size;
+            return task;
+        }
+        // 读出至少GZIP_BLOCK_SIZE字节并在最后一个换行处切开, 剩余部分留给下一块; 超长的行整行放在一块中
+        std::unique_ptr<Task> nextBlock(Source &src)
+        {
+            std::string block;
+            block.swap(src._carry);
+            size_t cut = std::string::npos;
+            while(1)
+            {
+                size_t old = block.size();
+                size_t want = std::max(GZIP_BLOCK_SIZE, old + 1) - old;
+                block.resize(old + want);
+                ssize_t n = src._reader.read(&block[old], want);
+                block.resize(old + (n > 0 ? n : 0));
+                if(n <= 0)
+                {
+                    // 解压结束, 最后一行可能没有换行
+                    src._reader.close();
+                    break;
+                }
+                cut = block.rfind('\n');
+                if(cut != std::string::npos) break;
+            }
+            if(cut != std::string::npos && cut + 1 < block.size())
+            {
+                src._carry.assign(block, cut + 1, std::string::npos);
+                block.resize(cut + 1);
+            }
+            if(block.empty()) return std::unique_ptr<Task>();
+            std::unique_ptr<Task> task(new Task(&src, src._offset, src._offset + block.size()));
+            src._offset += block.size();
+            task->_block.swap(block);
+            return task;
+        }
+    private:
+        const Options &_opts;
+        std::vector<Source> &_sources;
+        size_t _cur; // 正在分发的文件
+    };
+
+    void usage()
+    {
+        std::cout << "用法: logsys-grep [-l 最低等级] [-f 开始时间] [-t 结束时间] [-p 格式模式] [-j 线程数] [-c] [文本] 文件或目录 ..." << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    opts._by_level = opts._by_time = opts._count = false;
+    opts._level = logSys::LogLevel::Level::DEBUG;
+    opts._from = 0;
+    opts._to = (time_t)INT64_MAX;
+    std::string pattern = "%d{%H:%M:%S}%T%t%T[%p]%T[%c]%T%f:%l%T%m%n";
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> args;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if((arg == "-f" || arg == "-t") && has_value)
+        {
+            if(!parseTime(argv[++i], arg == "-f" ? opts._from : opts._to))
+            {
+                std::cout << "无法解析时间: " << argv[i] << std::endl;
+                return 2;
+            }
+            opts._by_time = true;
+        }
+        else if(arg == "-l" && has_value)
+        {
+            if(!parseLevel(argv[++i], opts._level))
+            {
+                std::cout << "未知等级: " << argv[i] << std::endl;
+                return 2;
+            }
+            opts._by_level = true;
+        }
+        else if(arg == "-p" && has_value) pattern = argv[++i];
+        else if(arg == "-j" && has_value) threads = std::max(1, atoi(argv[++i]));
+        else if(arg == "-c") opts._count = true;
+        else if(!arg.empty() && arg[0] == '-')
+        {
+            usage();
+            return 2;
+        }
+        else args.push_back(arg);
+    }
+    // 只有一个位置参数时它是路径, 只按等级和时间过滤; 否则第一个是检索文本
+    if(args.size() >= 2)
+    {
+        opts._text = args[0];
+        args.erase(args.begin());
+    }
+    if(args.empty())
+    {
+        usage();
+        return 2;
+    }
+    std::vector<std::string> files;
+    for(auto &path : args) collect(path, files);
+    opts._with_name = files.size() > 1;
+
+    std::vector<Source> sources(files.size());
+    for(size_t i = 0; i < files.size(); i++) sources[i]._path = files[i];
+
+    // 工作线程按文件顺序领取任务, 主线程按同样的顺序输出
+    // 已领取还没输出的任务不超过线程数的两倍, 输出慢时工作线程等待, 内存不随文件数增长
+    logSys::Formatter formatter(pattern);
+    Searcher searcher(opts, formatter);
+    Dispatcher dispatcher(opts, sources);
+    const size_t window_limit = 2 * threads;
+    std::deque<std::unique_ptr<Task>> window;
+    size_t inflight = 0;   // 已经占用名额的任务数, 包括正在分发的
+    bool exhausted = false;
+    std::mutex dispatch_mutex; // 串行化分发, 先于mutex加锁
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::thread> workers;
+    for(size_t i = 0; i < threads; i++)
+    {
+        workers.emplace_back([&](){
+            while(1)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [&](){ return exhausted || inflight < window_limit; });
+                    if(exhausted) return;
+                    inflight++;
+                }
+                Task *task;
+                {
+                    std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex);
+                    std::unique_ptr<Task> next = dispatcher.next();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(!next)
+                    {
+                        exhausted = true;
+                        inflight--;
+                        cond.notify_all();
+                        return;
+                    }
+                    task = next.get();
+                    window.push_back(std::move(next));
+                }
+                searcher.run(*task);
+                std::lock_guard<std::mutex> lock(mutex);
+                task->_done = true;
+                cond.notify_all();
+            }
+        });
+    }
+    uint64_t matches = 0;
+    while(1)
+    {
+        std::unique_ptr<Task> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&](){ return (!window.empty() && window.front()->_done) || (exhausted && window.empty()); });
+            if(window.empty()) break;
+            task = std::move(window.front());
+            window.pop_front();
+        }
+        logSys::util::File::writeAll(STDOUT_FILENO, task->_out.data(), task->_out.size());
+        matches += task->_matches;
+        Source &src = *task->_source;
+        // 之前的任务都已经输出, 普通文件可以解除映射
+        if(task->_last)
+        {
+            munmap((void *)src._data, src._size);
+            src._data = nullptr;
+        }
+        task.reset();
+        std::lock_guard<std::mutex> lock(mutex);
+        inflight--;
+        cond.notify_all();
+    }
+    for(auto &w : workers) w.join();
+    if(opts._count) std::cout << matches << std::endl;
+    return matches > 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+extern char **environ;
+/*
+    命令行工具读取压缩分段: 启动 gzip -dc 把解压结果写到管道, 顺序读取
+    参数直接传给gzip, 不经过shell, 文件名中的特殊字符不会被解释
+*/
+namespace logSys
+{
+    class GzipReader
+    {
+    public:
+        GzipReader() :_fd(-1), _pid(-1) {}
+        ~GzipReader() { close(); }
+        GzipReader(const GzipReader &) = delete;
+        GzipReader &operator=(const GzipReader &) = delete;
+        bool open(const std::string &path)
+        {
+            close();
+            int fds[2];
+            // 读写两端都不被其他子进程继承, 否则并发解压时管道不会结束
+            if(pipe2(fds, O_CLOEXEC) != 0) return false;
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+            std::string arg0 = "gzip", arg1 = "-dc", arg2 = "--", arg3 = path;
+            char *argv[] = { &arg0[0], &arg1[0], &arg2[0], &arg3[0], nullptr };
+            int ret = posix_spawnp(&_pid, "gzip", &actions, nullptr, argv, environ);
+            posix_spawn_file_actions_destroy(&actions);
+            ::close(fds[1]);
+            if(ret != 0)
+            {
+                ::close(fds[0]);
+                _pid = -1;
+                return false;
+            }
+            _fd = fds[0];
+            return true;
+        }
+        // 读满len字节或到结尾为止, 返回读到的字节数, 出错返回-1
+        ssize_t read(char *buf, size_t len)
+        {
+            size_t got = 0;
+            while(got < len)
+            {
+                ssize_t n = ::read(_fd, buf + got, len - got);
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0) return -1;
+                if(n == 0) break;
+                got += n;
+            }
+            return got;
+        }
+        // 提前关闭时gzip因管道关闭退出; 返回gzip是否正常结束
+        bool close()
+        {
+            if(_fd >= 0) ::close(_fd);
+            _fd = -1;
+            if(_pid < 0) return true;
+            int status = 0;
+            while(waitpid(_pid, &status, 0) < 0 && errno == EINTR);
+            _pid = -1;
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+    private:
+        int _fd;
+        pid_t _pid;
+    };
+}
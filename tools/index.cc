@@ -0,0 +1,195 @@
+#include "index.hpp"
+#include "gzip.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+/*
+    logsys-index: 用旁路索引找出日志文件中可能包含目标记录的块, 只读取这些块
+    用法: logsys-index [-f 开始时间] [-t 结束时间] [-l 最低等级] [-r] 日志文件 ...
+        时间写作unix秒数或本地时间 "2024-01-02 15:04:05"
+        -r 只打印需要扫描的区间(偏移 长度)和扫描比例, 不输出内容
+        logsys-index -f "2024-01-02 15:04:00" -t "2024-01-02 15:04:05" -l ERROR ./logdir/app-*.log | grep ERROR
+    没有索引的文件整个输出; 压缩分段通过gzip -dc顺序读取, 跳过不需要的块
+*/
+namespace
+{
+    bool parseTime(const char *arg, time_t &t)
+    {
+        char *end = nullptr;
+        long long v = strtoll(arg, &end, 10);
+        if(end != arg && *end == '\0')
+        {
+            t = (time_t)v;
+            return true;
+        }
+        struct tm tl;
+        memset(&tl, 0, sizeof(tl));
+        const char *rest = strptime(arg, "%Y-%m-%d %H:%M:%S", &tl);
+        if(rest == nullptr || *rest != '\0') return false;
+        tl.tm_isdst = -1;
+        t = mktime(&tl);
+        return true;
+    }
+
+    bool parseLevel(const std::string &name, logSys::LogLevel::Level &level)
+    {
+        for(int i = (int)logSys::LogLevel::Level::DEBUG; i <= (int)logSys::LogLevel::Level::FATAL; i++)
+        {
+            if(logSys::LogLevel::toString((logSys::LogLevel::Level)i) == name)
+            {
+                level = (logSys::LogLevel::Level)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isCompressed(const std::string &path)
+    {
+        return path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+    }
+
+    // 普通文件直接按区间pread
+    bool dumpPlain(const std::string &path, const std::vector<logSys::LogIndex::Range> &ranges)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) return false;
+        std::vector<char> buf(1 << 20);
+        for(auto &r : ranges)
+        {
+            uint64_t off = r._offset;
+            uint64_t left = r._length;
+            while(left > 0)
+            {
+                size_t want = left < buf.size() ? (size_t)left : buf.size();
+                ssize_t n = pread(fd, buf.data(), want, (off_t)off);
+                if(n <= 0) break;
+                logSys::util::File::writeAll(STDOUT_FILENO, buf.data(), n);
+                off += n;
+                left = left == UINT64_MAX ? left : left - n;
+            }
+        }
+        close(fd);
+        return true;
+    }
+
+    // 压缩分段不能随机访问, 解压后顺序读取, 只输出区间内的部分
+    bool dumpCompressed(const std::string &path, const std::vector<logSys::LogIndex::Range> &ranges)
+    {
+        logSys::GzipReader reader;
+        if(!reader.open(path)) return false;
+        std::vector<char> buf(1 << 20);
+        uint64_t pos = 0;
+        size_t ri = 0;
+        ssize_t n;
+        while(ri < ranges.size() && (n = reader.read(buf.data(), buf.size())) > 0)
+        {
+            uint64_t end = pos + n;
+            while(ri < ranges.size())
+            {
+                const logSys::LogIndex::Range &r = ranges[ri];
+                uint64_t rend = r._length == UINT64_MAX ? UINT64_MAX : r._offset + r._length;
+                uint64_t from = r._offset > pos ? r._offset : pos;
+                uint64_t to = rend < end ? rend : end;
+                if(from < to) logSys::util::File::writeAll(STDOUT_FILENO, buf.data() + (from - pos), to - from);
+                if(rend > end) break;
+                ri++;
+            }
+            pos = end;
+        }
+        // 需要的区间读完后提前结束, 此时gzip因管道关闭退出, 不算失败
+        bool ok = reader.close();
+        return ok || ri == ranges.size();
+    }
+
+    void usage()
+    {
+        std::cout << "用法: logsys-index [-f 开始时间] [-t 结束时间] [-l 最低等级] [-r] 日志文件 ..." << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    time_t from = 0;
+    time_t to = (time_t)INT64_MAX;
+    uint32_t mask = ~0u;
+    bool ranges_only = false;
+    std::vector<std::string> files;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if((arg == "-f" || arg == "-t") && i + 1 < argc)
+        {
+            if(!parseTime(argv[++i], arg == "-f" ? from : to))
+            {
+                std::cout << "无法解析时间: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "-l" && i + 1 < argc)
+        {
+            logSys::LogLevel::Level level;
+            if(!parseLevel(argv[++i], level))
+            {
+                std::cout << "未知等级: " << argv[i] << std::endl;
+                return 1;
+            }
+            mask = logSys::RecordMeta::atLeast(level);
+        }
+        else if(arg == "-r")
+        {
+            ranges_only = true;
+        }
+        else if(!arg.empty() && arg[0] != '-')
+        {
+            files.push_back(arg);
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if(files.empty())
+    {
+        usage();
+        return 1;
+    }
+    for(auto &file : files)
+    {
+        std::vector<logSys::LogIndex::Range> ranges = logSys::LogIndex::query(file, from, to, mask);
+        if(ranges_only)
+        {
+            struct stat st;
+            uint64_t size = stat(file.c_str(), &st) == 0 ? st.st_size : 0;
+            uint64_t selected = 0;
+            std::cout << file << std::endl;
+            for(auto &r : ranges)
+            {
+                if(r._length == UINT64_MAX)
+                {
+                    // 压缩分段的大小是压缩后的, 尾部只给出起点
+                    std::cout << "  " << r._offset << " -" << std::endl;
+                    if(!isCompressed(file) && size > r._offset) selected += size - r._offset;
+                }
+                else
+                {
+                    std::cout << "  " << r._offset << " " << r._length << std::endl;
+                    selected += r._length;
+                }
+            }
+            if(!isCompressed(file) && size > 0)
+                std::cout << "  扫描 " << selected << "/" << size << " 字节" << std::endl;
+            continue;
+        }
+        bool ok = isCompressed(file) ? dumpCompressed(file, ranges) : dumpPlain(file, ranges);
+        if(!ok) std::cerr << "读取失败: " << file << std::endl;
+    }
+    return 0;
+}